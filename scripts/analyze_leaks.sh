@@ -70,8 +70,13 @@ echo "==== 分析文件: $RAW ===="
 
 # 检查分析文件是否有 func 字段（第5列）
 HAS_FUNC=$(head -1 "$RAW" | grep -q 'func' && echo 1 || echo 0)
-# 检查是否为 callers 格式（第3列为 comma-separated addr@binary）
+# 检查是否为 callers 格式（第4列为 comma-separated addr@binary）
 HAS_CALLERS=$(head -1 "$RAW" | grep -q 'callers' && echo 1 || echo 0)
+# 按分配点聚合的报告（默认格式）：#sites count bytes est_bytes min max type callers
+HAS_SITES=$(head -1 "$RAW" | grep -q '^#sites' && echo 1 || echo 0)
+# 采样模式（LEAK_SAMPLE_BYTES）下头部带 sample_bytes=N，大小需按 s/(1-exp(-s/N)) 还原
+SAMPLE_BYTES=$(head -1 "$RAW" | sed -n 's/.*sample_bytes=\([0-9][0-9]*\).*/\1/p')
+SAMPLE_BYTES=${SAMPLE_BYTES:-0}
 
 # If the analysis file only contains ptr and size (2 columns), print simple summary
 NUM_COLS=$(awk '$1!~/^#/ {print NF; exit}' "$RAW" || echo 0)
@@ -90,10 +95,20 @@ if [ "$HAS_CALLERS" -eq 1 ]; then
       \#*) continue ;;
     esac
     # read fields
-    ptr=$(awk '{print $1}' <<<"$line")
-    size=$(awk '{print $2}' <<<"$line")
-    type=$(awk '{print $3}' <<<"$line")
-    callers_field=$(awk '{print $4}' <<<"$line")
+    count=1
+    if [ "$HAS_SITES" -eq 1 ]; then
+      read -r count size est min_size max_size type callers_field <<<"$line"
+      ptr="site"
+    else
+      ptr=$(awk '{print $1}' <<<"$line")
+      size=$(awk '{print $2}' <<<"$line")
+      est=$size
+      if [ "$SAMPLE_BYTES" -gt 0 ]; then
+        est=$(awk -v s="$size" -v n="$SAMPLE_BYTES" 'BEGIN { if (s == 0) print 0; else printf "%.0f\n", s / (1 - exp(-s / n)) }')
+      fi
+      type=$(awk '{print $3}' <<<"$line")
+      callers_field=$(awk '{print $4}' <<<"$line")
+    fi
 
     chain_items=()
     func_names=()
@@ -190,7 +205,7 @@ if [ "$HAS_CALLERS" -eq 1 ]; then
     total_filtered=${#filtered_chain[@]}
     # If hiding _start-only leaks is requested and no frames remain after filtering, skip printing this leak
     if [ "$HIDE_START" -eq 1 ] && [ "$total_filtered" -eq 0 ]; then
-      printf "%s\t%s\t%s\t%s\t%s\t%s\n" "$ptr" "$size" "$type" "$outer_func" "$outer_fileline" "$outer_bin" >> "$AGG_TMP"
+      printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$ptr" "$est" "$type" "$outer_func" "$outer_fileline" "$outer_bin" "$count" >> "$AGG_TMP"
       continue
     fi
 
@@ -256,13 +271,22 @@ if [ "$HAS_CALLERS" -eq 1 ]; then
     # If user asked to hide system-only leaks and this leak is system-only, skip printing/JSON
     if [ "$HIDE_SYSTEM_ONLY" -eq 1 ] && [ "$all_system" -eq 1 ]; then
       # still append aggregate meta for summary but do not print frames or raw or JSON
-      printf "%s	%s	%s	%s	%s
-" "$ptr" "$size" "$outer_func" "$outer_fileline" "$outer_bin" >> "$AGG_TMP"
+      printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$ptr" "$est" "$type" "$outer_func" "$outer_fileline" "$outer_bin" "$count" >> "$AGG_TMP"
       continue
     fi
 
     if [ "$JSON_MODE" -eq 0 ]; then
-      printf "Leak: %s (%s bytes) [%s]\n" "$ptr" "$size" "$type"
+      if [ "$HAS_SITES" -eq 1 ]; then
+        if [ "$SAMPLE_BYTES" -gt 0 ]; then
+          printf "Site: %s blocks, %s bytes, ~%s bytes estimated (min %s, max %s) [%s]\n" "$count" "$size" "$est" "$min_size" "$max_size" "$type"
+        else
+          printf "Site: %s blocks, %s bytes (min %s, max %s) [%s]\n" "$count" "$size" "$min_size" "$max_size" "$type"
+        fi
+      elif [ "$SAMPLE_BYTES" -gt 0 ]; then
+        printf "Leak: %s (%s bytes, ~%s bytes estimated) [%s]\n" "$ptr" "$size" "$est" "$type"
+      else
+        printf "Leak: %s (%s bytes) [%s]\n" "$ptr" "$size" "$type"
+      fi
     fi
 
     # Apply frame-range on filtered list
@@ -314,7 +338,7 @@ if [ "$HAS_CALLERS" -eq 1 ]; then
       fi
     fi
 
-    printf "%s\t%s\t%s\t%s\t%s\t%s\n" "$ptr" "$size" "$type" "$outer_func" "$outer_fileline" "$outer_bin" >> "$AGG_TMP"
+    printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "$ptr" "$est" "$type" "$outer_func" "$outer_fileline" "$outer_bin" "$count" >> "$AGG_TMP"
 
     if [ "$JSON_MODE" -eq 1 ]; then
       json_frames=""
@@ -348,7 +372,11 @@ if [ "$HAS_CALLERS" -eq 1 ]; then
       esc_ptr=$(printf "%s" "$ptr" | sed -e 's/\\/\\\\/g' -e 's/"/\\\"/g')
       esc_size=$size
       esc_type=$(printf "%s" "$type" | sed -e 's/\\/\\\\/g' -e 's/"/\\\"/g')
-      leak_json="{\"ptr\":\"$esc_ptr\",\"size\":$esc_size,\"type\":\"$esc_type\",\"frames\":[$json_frames]}"
+      if [ "$HAS_SITES" -eq 1 ]; then
+        leak_json="{\"count\":$count,\"size\":$esc_size,\"est_size\":$est,\"min\":$min_size,\"max\":$max_size,\"type\":\"$esc_type\",\"frames\":[$json_frames]}"
+      else
+        leak_json="{\"ptr\":\"$esc_ptr\",\"size\":$esc_size,\"est_size\":$est,\"type\":\"$esc_type\",\"frames\":[$json_frames]}"
+      fi
       if grep -q -s "^\[\]$" "$JSON_TMP_LEAKS" 2>/dev/null; then
         echo "$leak_json" > "$JSON_TMP_LEAKS.items"
       else
@@ -377,8 +405,11 @@ if [ "$HAS_CALLERS" -eq 1 ]; then
   if [ "$SUMMARY" -eq 1 ]; then
     echo
     echo "==== 汇总 (按 binary / file / function) ===="
+    if [ "$SAMPLE_BYTES" -gt 0 ]; then
+      echo "(采样模式：每 $SAMPLE_BYTES 字节采样一次，BYTES 为还原后的估计值)"
+    fi
     AGG_RES=$(mktemp)
-    awk -F"\t" '{ key=$6"\t"$5"\t"$4; cnt[key]++; sum[key]+=($2+0) } END { for (k in cnt) { printf "%d\t%d\t%s\n", cnt[k], sum[k], k } }' "$AGG_TMP" > "$AGG_RES"
+    awk -F"\t" '{ key=$6"\t"$5"\t"$4; cnt[key]+=($7 == "" ? 1 : $7); sum[key]+=($2+0) } END { for (k in cnt) { printf "%d\t%d\t%s\n", cnt[k], sum[k], k } }' "$AGG_TMP" > "$AGG_RES"
     printf "%6s %10s %s\n" "COUNT" "BYTES" "BINARY | FILE | FUNCTION"
     sort -t$'\t' -k2,2nr "$AGG_RES" | awk -F"\t" '{ printf "%6d %10d %s | %s | %s\n", $1, $2, $3, $4, $5 }'
     rm -f "$AGG_RES"
@@ -0,0 +1,291 @@
+/* leak_bench.c
+ * Allocator overhead benchmark, run once per detector variant (plain
+ * glibc, or one libleak_detector*.so in LD_PRELOAD; `make bench` runs
+ * them all).
+ *
+ * For every live-set size it first allocates that many 64-byte blocks and
+ * keeps them alive, so the detectors' tables are that full, then times
+ * malloc, free, calloc and realloc for each size class and thread count.
+ * Each thread works through batches: allocate a batch, then free it (or
+ * realloc every block to twice, then back to its size). Every 8th call
+ * is timed on its own for the latency percentiles; the rest only count
+ * towards ns/op and throughput.
+ *
+ * One CSV row (or JSON object per line) per (op, size, threads, live):
+ *   ns_per_op    mean time per call, per thread
+ *   mops         calls per second, in millions, over all threads
+ *   p50_ns/p99_ns latency of single calls, timer overhead subtracted
+ *   rss_kb       resident set after the live set was allocated
+ *   live_b_per_block resident bytes per live block (payload 64 bytes):
+ *                the allocator's and the detector's per-block overhead;
+ *                only meaningful for the larger live sets
+ */
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BATCH 256
+#define SAMPLE_EVERY 8
+#define LIVE_BLOCK 64
+#define MAX_LIST 32
+
+enum { OP_MALLOC, OP_FREE, OP_CALLOC, OP_REALLOC, OP_COUNT };
+static const char *const op_names[OP_COUNT] = { "malloc", "free", "calloc", "realloc" };
+
+typedef struct {
+    long v[MAX_LIST];
+    int n;
+} list_t;
+
+static struct {
+    const char *variant;
+    list_t sizes, threads, live;
+    long ops;               /* calls per thread per op */
+    int json;
+    int header;
+    uint64_t timer_ns;      /* cost of an empty timed region */
+} cfg;
+
+/* bench memory comes from mmap, so it stays out of the detectors' tables */
+static void *map(size_t len) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("leak_bench: mmap");
+        exit(1);
+    }
+    return p;
+}
+
+static inline uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static long rss_kb(void) {
+    FILE *f = fopen("/proc/self/statm", "r");
+    long pages = 0, rss = 0;
+    if (f) {
+        if (fscanf(f, "%ld %ld", &pages, &rss) != 2) rss = 0;
+        fclose(f);
+    }
+    return rss * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static int cmp_u64(const void *x, const void *y) {
+    uint64_t a = *(const uint64_t *)x, b = *(const uint64_t *)y;
+    return a < b ? -1 : a > b;
+}
+
+/* ---- one cell ---- */
+
+typedef struct {
+    int op;
+    size_t size;
+    long ops;
+    pthread_barrier_t *start;
+    uint64_t elapsed;       /* ns spent in the measured calls */
+    uint64_t *samples;
+    long nsamples;
+} worker_t;
+
+/* Run `call` on every slot of the batch; time every SAMPLE_EVERY-th call
+ * on its own, and the whole batch for the mean. */
+#define TIMED_BATCH(w, n, call)                                              \
+    do {                                                                     \
+        uint64_t t0 = now_ns();                                              \
+        for (int i = 0; i < (n); ++i) {                                      \
+            if (i % SAMPLE_EVERY == 0) {                                     \
+                uint64_t s = now_ns();                                       \
+                call;                                                        \
+                (w)->samples[(w)->nsamples++] = now_ns() - s;                \
+            } else {                                                         \
+                call;                                                        \
+            }                                                                \
+        }                                                                    \
+        (w)->elapsed += now_ns() - t0;                                       \
+    } while (0)
+
+static void *worker(void *arg) {
+    worker_t *w = arg;
+    void *slot[BATCH];
+    size_t size = w->size;
+    pthread_barrier_wait(w->start);
+    for (long done = 0; done < w->ops; done += BATCH) {
+        int n = w->ops - done < BATCH ? (int)(w->ops - done) : BATCH;
+        switch (w->op) {
+        case OP_MALLOC:
+            TIMED_BATCH(w, n, slot[i] = malloc(size));
+            for (int i = 0; i < n; ++i) free(slot[i]);
+            break;
+        case OP_FREE:
+            for (int i = 0; i < n; ++i) slot[i] = malloc(size);
+            TIMED_BATCH(w, n, free(slot[i]));
+            break;
+        case OP_CALLOC:
+            TIMED_BATCH(w, n, slot[i] = calloc(1, size));
+            for (int i = 0; i < n; ++i) free(slot[i]);
+            break;
+        case OP_REALLOC:
+            /* grow then shrink back: half the calls each way */
+            for (int i = 0; i < n; ++i) slot[i] = malloc(size);
+            TIMED_BATCH(w, n, slot[i] = realloc(slot[i], (i & 1) ? size : 2 * size));
+            for (int i = 0; i < n; ++i) free(slot[i]);
+            break;
+        }
+        __asm__ __volatile__("" : : "r"(slot) : "memory");
+    }
+    return NULL;
+}
+
+static void run_cell(int op, size_t size, int threads, long live, long rss, double per_block) {
+    long max_samples = cfg.ops / SAMPLE_EVERY + BATCH;
+    worker_t *w = map(threads * sizeof(*w));
+    uint64_t *samples = map((size_t)threads * max_samples * sizeof(uint64_t));
+    pthread_t *tid = map(threads * sizeof(*tid));
+    pthread_barrier_t start;
+    pthread_barrier_init(&start, NULL, threads + 1);
+    for (int t = 0; t < threads; ++t) {
+        w[t].op = op;
+        w[t].size = size;
+        w[t].ops = cfg.ops;
+        w[t].start = &start;
+        w[t].samples = samples + (size_t)t * max_samples;
+        pthread_create(&tid[t], NULL, worker, &w[t]);
+    }
+    pthread_barrier_wait(&start);
+
+    uint64_t total = 0, slowest = 0;
+    long n = 0;
+    for (int t = 0; t < threads; ++t) {
+        pthread_join(tid[t], NULL);
+        total += w[t].elapsed;
+        if (w[t].elapsed > slowest) slowest = w[t].elapsed;
+        /* pack every thread's samples together */
+        memmove(samples + n, w[t].samples, w[t].nsamples * sizeof(uint64_t));
+        n += w[t].nsamples;
+    }
+    pthread_barrier_destroy(&start);
+    qsort(samples, n, sizeof(uint64_t), cmp_u64);
+    uint64_t p50 = n ? samples[n / 2] : 0, p99 = n ? samples[n * 99 / 100] : 0;
+    p50 = p50 > cfg.timer_ns ? p50 - cfg.timer_ns : 0;
+    p99 = p99 > cfg.timer_ns ? p99 - cfg.timer_ns : 0;
+
+    long calls = cfg.ops * threads;
+    double ns_per_op = (double)total / (double)calls;
+    double mops = slowest ? (double)calls * 1e3 / (double)slowest : 0;
+    if (cfg.json)
+        printf("{\"variant\":\"%s\",\"op\":\"%s\",\"size\":%zu,\"threads\":%d,\"live\":%ld,"
+               "\"ops\":%ld,\"ns_per_op\":%.1f,\"mops\":%.2f,\"p50_ns\":%llu,\"p99_ns\":%llu,"
+               "\"rss_kb\":%ld,\"live_b_per_block\":%.1f}\n",
+               cfg.variant, op_names[op], size, threads, live, calls, ns_per_op, mops,
+               (unsigned long long)p50, (unsigned long long)p99, rss, per_block);
+    else
+        printf("%s,%s,%zu,%d,%ld,%ld,%.1f,%.2f,%llu,%llu,%ld,%.1f\n", cfg.variant, op_names[op],
+               size, threads, live, calls, ns_per_op, mops, (unsigned long long)p50,
+               (unsigned long long)p99, rss, per_block);
+    fflush(stdout);
+
+    munmap(w, threads * sizeof(*w));
+    munmap(samples, (size_t)threads * max_samples * sizeof(uint64_t));
+    munmap(tid, threads * sizeof(*tid));
+}
+
+/* ---- setup ---- */
+
+static void calibrate_timer(void) {
+    uint64_t s[1001];
+    for (int i = 0; i < 1001; ++i) {
+        uint64_t t = now_ns();
+        s[i] = now_ns() - t;
+    }
+    qsort(s, 1001, sizeof(s[0]), cmp_u64);
+    cfg.timer_ns = s[500];
+}
+
+static int parse_list(const char *arg, list_t *l) {
+    l->n = 0;
+    for (const char *p = arg; *p && l->n < MAX_LIST; ) {
+        char *end;
+        long v = strtol(p, &end, 10);
+        if (end == p || v <= 0) return 0;
+        if (*end == 'k' || *end == 'K') v *= 1000, end++;
+        else if (*end == 'M') v *= 1000000, end++;
+        l->v[l->n++] = v;
+        p = *end == ',' ? end + 1 : end;
+        if (*end && *end != ',') return 0;
+    }
+    return l->n > 0;
+}
+
+static void usage(void) {
+    fprintf(stderr,
+            "usage: leak_bench [--variant NAME] [--sizes LIST] [--threads LIST]\n"
+            "                  [--live LIST] [--ops N] [--json] [--no-header]\n"
+            "  LIST is comma-separated, with k/M suffixes (e.g. 1k,100k,10M)\n"
+            "  defaults: --sizes 16,256,4096,65536 --threads 1,2,4..nproc\n"
+            "            --live 1k,100k,1M,10M --ops 100000\n");
+    exit(2);
+}
+
+int main(int argc, char **argv) {
+    const char *pre = getenv("LD_PRELOAD");
+    cfg.variant = pre && pre[0] ? pre : "glibc";
+    cfg.ops = 100000;
+    cfg.header = 1;
+    parse_list("16,256,4096,65536", &cfg.sizes);
+    parse_list("1k,100k,1M,10M", &cfg.live);
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    cfg.threads.n = 0;
+    for (long t = 1; t < ncpu && cfg.threads.n < MAX_LIST - 1; t *= 2) cfg.threads.v[cfg.threads.n++] = t;
+    cfg.threads.v[cfg.threads.n++] = ncpu > 0 ? ncpu : 1;
+
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *v = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!strcmp(a, "--json")) cfg.json = 1;
+        else if (!strcmp(a, "--no-header")) cfg.header = 0;
+        else if (!v) usage();
+        else if (!strcmp(a, "--variant")) cfg.variant = v, i++;
+        else if (!strcmp(a, "--ops") && (cfg.ops = atol(v)) > 0) i++;
+        else if (!strcmp(a, "--sizes") && parse_list(v, &cfg.sizes)) i++;
+        else if (!strcmp(a, "--threads") && parse_list(v, &cfg.threads)) i++;
+        else if (!strcmp(a, "--live") && parse_list(v, &cfg.live)) i++;
+        else usage();
+    }
+    /* a path in LD_PRELOAD names the variant by its file name */
+    const char *slash = strrchr(cfg.variant, '/');
+    if (slash) cfg.variant = slash + 1;
+
+    calibrate_timer();
+    long baseline = rss_kb();
+    if (cfg.header && !cfg.json)
+        printf("variant,op,size,threads,live,ops,ns_per_op,mops,p50_ns,p99_ns,rss_kb,live_b_per_block\n");
+
+    for (int l = 0; l < cfg.live.n; ++l) {
+        long live = cfg.live.v[l];
+        void **blocks = map(live * sizeof(void *));
+        for (long i = 0; i < live; ++i) blocks[i] = malloc(LIVE_BLOCK);
+        /* smaller live sets run first and their memory is reused, so
+         * measure from the start of the process, minus our own array */
+        long rss = rss_kb();
+        double per_block = ((double)(rss - baseline) * 1024.0 - (double)live * sizeof(void *)) /
+                           (double)live;
+
+        for (int op = 0; op < OP_COUNT; ++op)
+            for (int s = 0; s < cfg.sizes.n; ++s)
+                for (int t = 0; t < cfg.threads.n; ++t)
+                    run_cell(op, (size_t)cfg.sizes.v[s], (int)cfg.threads.v[t], live, rss,
+                             per_block);
+
+        for (long i = 0; i < live; ++i) free(blocks[i]);
+        munmap(blocks, live * sizeof(void *));
+    }
+    return 0;
+}
@@ -0,0 +1,76 @@
+/* leak_arena.h
+ * Internal memory for the detectors, taken straight from mmap so it never
+ * re-enters the interposed malloc.
+ *
+ * leak_arena_t is a slab allocator for fixed-size objects: it carves
+ * objects out of mmap'd slabs and recycles freed ones through a free
+ * list. It is not thread-safe; each user (e.g. a table shard) owns its
+ * arena and serializes access with its own lock.
+ */
+#ifndef LEAK_ARENA_H
+#define LEAK_ARENA_H
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_ARENA_SLAB (64 * 1024)
+
+typedef struct {
+    char *cur;          /* next unused byte of the current slab */
+    char *end;
+    void *free_list;    /* freed objects, linked through their first word */
+} leak_arena_t;
+
+/* Function: leak_pages_alloc
+ * Anonymous zero-filled mapping of `len` bytes, or NULL.
+ */
+static inline void *leak_pages_alloc(size_t len) {
+    void *p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static inline void leak_pages_free(void *p, size_t len) {
+    if (p) munmap(p, len);
+}
+
+/* Function: leak_arena_alloc
+ * Returns an object of `size` bytes (at least a pointer, 8-byte aligned;
+ * always the same size for a given arena), or NULL if mmap fails.
+ */
+static inline void *leak_arena_alloc(leak_arena_t *a, size_t size) {
+    if (a->free_list) {
+        void *p = a->free_list;
+        a->free_list = *(void **)p;
+        return p;
+    }
+    size = (size + 7) & ~(size_t)7;
+    if (a->cur == NULL || (size_t)(a->end - a->cur) < size) {
+        size_t slab = size * 16 > LEAK_ARENA_SLAB ? size * 16 : LEAK_ARENA_SLAB;
+        slab = (slab + 4095) & ~(size_t)4095;
+        char *p = leak_pages_alloc(slab);
+        if (!p) return NULL;
+        a->cur = p;
+        a->end = p + slab;
+    }
+    void *p = a->cur;
+    a->cur += size;
+    return p;
+}
+
+/* Function: leak_arena_free
+ * Give an object back for reuse by the next leak_arena_alloc().
+ */
+static inline void leak_arena_free(leak_arena_t *a, void *p) {
+    *(void **)p = a->free_list;
+    a->free_list = p;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_ARENA_H */
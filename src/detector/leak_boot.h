@@ -0,0 +1,86 @@
+/* leak_boot.h
+ * Static bootstrap arena for allocations made before the real allocator
+ * is resolved.
+ *
+ * dlsym() may itself call malloc, and another preloaded library's
+ * constructor may allocate before ours has run. Until the detector has
+ * published its real_* pointers, its wrappers take a slow path that runs
+ * the detector's init and, if the init is still in progress (this is the
+ * recursive call from inside dlsym), bump-allocates from a static buffer.
+ * Arena blocks are never reused: free() ignores them and realloc() copies
+ * them out, so the hot path only adds a NULL test of the real pointer and,
+ * in free/realloc, a range check.
+ */
+#ifndef LEAK_BOOT_H
+#define LEAK_BOOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_BOOT_SIZE (64 * 1024)
+#define LEAK_BOOT_HDR 16            /* block size is kept just before it */
+
+static char leak_boot_arena[LEAK_BOOT_SIZE] __attribute__((aligned(64)));
+static size_t leak_boot_used;
+
+/* Function: leak_boot_owns
+ * Returns 1 if `p` came from the bootstrap arena.
+ */
+static inline int leak_boot_owns(const void *p) {
+    return (uintptr_t)p - (uintptr_t)leak_boot_arena < LEAK_BOOT_SIZE;
+}
+
+/* Function: leak_boot_alloc
+ * Zero-filled block of `size` bytes aligned to `align` (at least 16), or
+ * NULL once the arena is used up. Thread-safe.
+ */
+static inline void *leak_boot_alloc(size_t size, size_t align) {
+    if (align < LEAK_BOOT_HDR) align = LEAK_BOOT_HDR;
+    uintptr_t base = (uintptr_t)leak_boot_arena;
+    size_t used = __atomic_load_n(&leak_boot_used, __ATOMIC_RELAXED), start, end;
+    do {
+        start = ((base + used + LEAK_BOOT_HDR + align - 1) & ~(uintptr_t)(align - 1)) - base;
+        end = start + size;
+        if (size > LEAK_BOOT_SIZE || end > LEAK_BOOT_SIZE) return NULL;
+    } while (!__atomic_compare_exchange_n(&leak_boot_used, &used, end, 1, __ATOMIC_RELAXED,
+                                          __ATOMIC_RELAXED));
+    *(size_t *)(leak_boot_arena + start - sizeof(size_t)) = size;
+    return leak_boot_arena + start;
+}
+
+/* Function: leak_boot_size
+ * Size requested for an arena block.
+ */
+static inline size_t leak_boot_size(const void *p) {
+    return *(const size_t *)((const char *)p - sizeof(size_t));
+}
+
+/* Function: leak_boot_calloc
+ * leak_boot_alloc for nmemb * size bytes, NULL on overflow.
+ */
+static inline void *leak_boot_calloc(size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) return NULL;
+    return leak_boot_alloc(total, LEAK_BOOT_HDR);
+}
+
+/* Function: leak_boot_move
+ * Copy an arena block into `dst` (of `size` bytes) for realloc; the arena
+ * block itself stays where it is.
+ */
+static inline void *leak_boot_move(void *dst, const void *src, size_t size) {
+    size_t old = leak_boot_size(src);
+    if (dst) memcpy(dst, src, old < size ? old : size);
+    return dst;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_BOOT_H */
@@ -1,9 +1,14 @@
 /* leak_common.h
- * Small helper for detector constructors to ensure init runs once.
+ * Small helpers shared by the detectors: run init once, a spinlock, and
+ * output file names.
  */
 #ifndef LEAK_COMMON_H
 #define LEAK_COMMON_H
 
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -27,6 +32,77 @@ static inline int leak_init_once(void (*cb)(void)) {
 /* Backwards-compatible macro: call without a callback */
 #define LEAK_INIT_ONCE() leak_init_once(NULL)
 
+/* Minimal test-and-set spinlock. Critical sections in the detectors are a
+ * handful of instructions and must not call into anything that could
+ * allocate, so a pthread mutex would only add overhead. */
+typedef struct {
+    int locked;
+} leak_lock_t;
+
+#define LEAK_LOCK_INIT { 0 }
+
+static inline void leak_cpu_relax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static inline void leak_lock(leak_lock_t *l) {
+    while (__atomic_exchange_n(&l->locked, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED)) leak_cpu_relax();
+    }
+}
+
+static inline void leak_unlock(leak_lock_t *l) {
+    __atomic_store_n(&l->locked, 0, __ATOMIC_RELEASE);
+}
+
+/* Function: leak_output_path
+ * Name an output file after the template `tmpl` (`dflt` if it is unset or
+ * empty): %p becomes the pid and %% a single %. In a child made by fork()
+ * (`forked`), a name without %p gets ".<pid>" before its first extension,
+ * so no child overwrites its parent's or a sibling's file.
+ */
+static inline void leak_output_path(const char *tmpl, const char *dflt, int forked, char *buf,
+                                    size_t len) {
+    if (!tmpl || !tmpl[0]) tmpl = dflt;
+    char pid[16];
+    snprintf(pid, sizeof(pid), "%d", (int)getpid());
+    int has_pid = 0;
+    for (const char *s = tmpl; *s; ++s) {
+        if (s[0] == '%' && s[1] == 'p') has_pid = 1;
+        if (s[0] == '%' && s[1]) ++s;
+    }
+    const char *base = strrchr(tmpl, '/');
+    const char *ext = strchr(base ? base + 1 : tmpl, '.');
+    if (!ext) ext = tmpl + strlen(tmpl);
+    size_t n = 0;
+#define LEAK_PATH_PUT(str, k) \
+    do { \
+        size_t k_ = (k); \
+        if (n + k_ < len) memcpy(buf + n, (str), k_); \
+        n += k_; \
+    } while (0)
+    for (const char *s = tmpl;; ++s) {
+        if (forked && !has_pid && s == ext) {
+            LEAK_PATH_PUT(".", 1);
+            LEAK_PATH_PUT(pid, strlen(pid));
+        }
+        if (!*s) break;
+        if (s[0] == '%' && s[1] == 'p') {
+            LEAK_PATH_PUT(pid, strlen(pid));
+            ++s;
+        } else {
+            if (s[0] == '%' && s[1] == '%') ++s;
+            LEAK_PATH_PUT(s, 1);
+        }
+    }
+#undef LEAK_PATH_PUT
+    if (len) buf[n < len ? n : len - 1] = '\0';
+}
+
 #ifdef __cplusplus
 }
 #endif
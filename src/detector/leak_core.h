@@ -0,0 +1,1734 @@
+/* leak_core.h
+ * The detector itself: allocator interposition, the live-block table and
+ * the exit report, configured at compile time. Each libleak_detector*.so
+ * is one translation unit that sets the policy macros below and includes
+ * this header once; code for features a policy leaves out is not
+ * compiled, so the cheapest variant pays only for the table.
+ *
+ *   LEAK_CORE_CAPTURE  what each record remembers about its origin:
+ *                      LEAK_CAPTURE_NONE, LEAK_CAPTURE_CALLER (the
+ *                      wrapper's return address) or LEAK_CAPTURE_STACK
+ *                      (a full backtrace, interned in the stack depot)
+ *   LEAK_CORE_DEPTH    frames kept by LEAK_CAPTURE_STACK (default 32)
+ *   LEAK_CORE_WRAP_ALL 0: malloc and free only; 1: also calloc, realloc,
+ *                      strdup, strndup, fopen/fclose, aligned_alloc and
+ *                      posix_memalign, with the kind stored per record
+ *   LEAK_CORE_REPORT   LEAK_REPORT_STDERR (a list on stderr),
+ *                      LEAK_REPORT_CALLERS (that plus leak_analysis.txt
+ *                      with one caller per block) or LEAK_REPORT_SITES
+ *                      (blocks aggregated by stack, with sampling,
+ *                      tracing, snapshots, live metrics, online
+ *                      growth detection, suppressions, the reachability
+ *                      scan, pprof output and the binary report format
+ *                      of leak_report_format.h; needs LEAK_CAPTURE_STACK)
+ *   LEAK_CORE_WRAP_CXX 1: interpose C++ operator new/delete, recording
+ *                      the operator's caller and reporting releases that
+ *                      do not match the allocation; defaults to on
+ *                      whenever records capture an origin (without one,
+ *                      libstdc++'s call to malloc records the same thing)
+ *   LEAK_CORE_FDS      1: interpose the calls that open and close file
+ *                      descriptors and report the ones left open, each
+ *                      with its origin (leak_fds.h): the stack when
+ *                      records keep stacks, else the caller
+ *   LEAK_CORE_LIFETIME 1: stamp each record with its allocation time and,
+ *                      when LEAK_LIFETIME is set, profile how long each
+ *                      site's blocks live (leak_lifetime.h); needs
+ *                      LEAK_REPORT_SITES
+ *   LEAK_CORE_BANNER   printed at init when LEAK_VERBOSE is set
+ *
+ * realloc is always interposed, at least to keep bootstrap arena blocks
+ * (leak_boot.h) away from the real one.
+ *
+ * Every variant follows fork(): a child starts with an empty table
+ * (LEAK_FORK=inherit keeps a copy-on-write view of the parent's) and its
+ * own background threads, and writes its reports under its own pid (see
+ * leak_output_path) so workers of a prefork server do not overwrite one
+ * another.
+ */
+#ifndef LEAK_CORE_H
+#define LEAK_CORE_H
+
+#define LEAK_CAPTURE_NONE 0
+#define LEAK_CAPTURE_CALLER 1
+#define LEAK_CAPTURE_STACK 2
+
+#define LEAK_REPORT_STDERR 0
+#define LEAK_REPORT_CALLERS 1
+#define LEAK_REPORT_SITES 2
+
+#ifndef LEAK_CORE_CAPTURE
+#define LEAK_CORE_CAPTURE LEAK_CAPTURE_NONE
+#endif
+#ifndef LEAK_CORE_DEPTH
+#define LEAK_CORE_DEPTH 32
+#endif
+#ifndef LEAK_CORE_WRAP_ALL
+#define LEAK_CORE_WRAP_ALL 0
+#endif
+#ifndef LEAK_CORE_REPORT
+#define LEAK_CORE_REPORT LEAK_REPORT_STDERR
+#endif
+#ifndef LEAK_CORE_WRAP_CXX
+#define LEAK_CORE_WRAP_CXX (LEAK_CORE_CAPTURE != LEAK_CAPTURE_NONE)
+#endif
+#ifndef LEAK_CORE_FDS
+#define LEAK_CORE_FDS 0
+#endif
+#ifndef LEAK_CORE_LIFETIME
+#define LEAK_CORE_LIFETIME 0
+#endif
+
+#if (LEAK_CORE_REPORT == LEAK_REPORT_SITES) != (LEAK_CORE_CAPTURE == LEAK_CAPTURE_STACK)
+#error "LEAK_REPORT_SITES and LEAK_CAPTURE_STACK go together"
+#endif
+#if LEAK_CORE_REPORT == LEAK_REPORT_CALLERS && LEAK_CORE_CAPTURE != LEAK_CAPTURE_CALLER
+#error "LEAK_REPORT_CALLERS needs LEAK_CAPTURE_CALLER"
+#endif
+#if LEAK_CORE_LIFETIME && LEAK_CORE_REPORT != LEAK_REPORT_SITES
+#error "LEAK_CORE_LIFETIME needs LEAK_REPORT_SITES"
+#endif
+
+#define LEAK_CORE_SITES (LEAK_CORE_REPORT == LEAK_REPORT_SITES)
+#define LEAK_CORE_TYPED (LEAK_CORE_WRAP_ALL || LEAK_CORE_SITES || LEAK_CORE_WRAP_CXX)
+/* a guard keeps the detector's own allocations (unwinding, the report,
+ * libstdc++'s operators) out of the table; a variant that makes none does
+ * without */
+#define LEAK_CORE_GUARD (LEAK_CORE_CAPTURE != LEAK_CAPTURE_NONE || \
+                         LEAK_CORE_REPORT != LEAK_REPORT_STDERR || LEAK_CORE_WRAP_CXX)
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "leak_common.h"
+#include "leak_table.h"
+#include "leak_boot.h"
+#include "leak_types.h"
+#if LEAK_CORE_FDS
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "leak_fds.h"
+#endif
+#if LEAK_CORE_REPORT == LEAK_REPORT_CALLERS
+#include "leak_symcache.h"
+#endif
+#if LEAK_CORE_SITES
+#include "leak_depot.h"
+#include "leak_unwind.h"
+#include "leak_scan.h"
+#include "leak_sample.h"
+#include "leak_trace.h"
+#include "leak_sites.h"
+#include "leak_snapshot.h"
+#include "leak_pprof.h"
+#include "leak_report_bin.h"
+#include "leak_metrics.h"
+#include "leak_growth.h"
+#include "leak_suppress.h"
+#endif
+#if LEAK_CORE_LIFETIME
+#include "leak_lifetime.h"
+#endif
+
+typedef struct {
+    void *ptr;
+    size_t size;
+#if LEAK_CORE_CAPTURE == LEAK_CAPTURE_CALLER
+    void *caller;       /* saved return address */
+#elif LEAK_CORE_CAPTURE == LEAK_CAPTURE_STACK
+    uint32_t stack;     /* backtrace id in the stack depot, 0 if none */
+#endif
+#if LEAK_CORE_TYPED
+    uint8_t type;       /* LEAK_T_* */
+#endif
+#if LEAK_CORE_SITES
+    uint8_t metered;    /* in leak_metrics' per-stack sums */
+#endif
+#if LEAK_CORE_LIFETIME
+    uint64_t born;      /* leak_life_ticks() at allocation, 0 if not profiled */
+#endif
+} alloc_info_t;
+
+LEAK_TABLE_DEFINE(allocations, alloc_info_t);
+
+/* the wrapper's return address: the record's origin for
+ * LEAK_CAPTURE_CALLER, what suppressions match for LEAK_CAPTURE_STACK */
+#if LEAK_CORE_CAPTURE != LEAK_CAPTURE_NONE
+#define LEAK_CALLER() __builtin_return_address(0)
+#else
+#define LEAK_CALLER() NULL
+#endif
+
+/* original functions */
+static void* (*real_malloc)(size_t) = NULL;
+static void (*real_free)(void*) = NULL;
+static void* (*real_realloc)(void*, size_t) = NULL;
+#if LEAK_CORE_WRAP_ALL
+static void* (*real_calloc)(size_t, size_t) = NULL;
+static char* (*real_strdup)(const char*) = NULL;
+static char* (*real_strndup)(const char*, size_t) = NULL;
+static FILE* (*real_fopen)(const char*, const char*) = NULL;
+static int (*real_fclose)(FILE*) = NULL;
+static void* (*real_aligned_alloc)(size_t, size_t) = NULL;
+static int (*real_posix_memalign)(void**, size_t, size_t) = NULL;
+#endif
+#if LEAK_CORE_FDS
+static int (*real_open)(const char*, int, ...) = NULL;
+static int (*real_open64)(const char*, int, ...) = NULL;
+static int (*real_openat)(int, const char*, int, ...) = NULL;
+static int (*real_openat64)(int, const char*, int, ...) = NULL;
+static int (*real_socket)(int, int, int) = NULL;
+static int (*real_accept)(int, __SOCKADDR_ARG, socklen_t*) = NULL;
+static int (*real_accept4)(int, __SOCKADDR_ARG, socklen_t*, int) = NULL;
+static int (*real_dup)(int) = NULL;
+static int (*real_dup2)(int, int) = NULL;
+static int (*real_dup3)(int, int, int) = NULL;
+static int (*real_pipe)(int[2]) = NULL;
+static int (*real_pipe2)(int[2], int) = NULL;
+static int (*real_eventfd)(unsigned int, int) = NULL;
+static int (*real_epoll_create)(int) = NULL;
+static int (*real_epoll_create1)(int) = NULL;
+static int (*real_close)(int) = NULL;
+#endif
+
+#if LEAK_CORE_SITES
+int leak_snapshot(void);
+static void watch_metrics(leak_metrics_seg_t *seg, const leak_metrics_total_t *live,
+                          uint32_t nstacks);
+static uint32_t depot_count(void);
+#endif
+
+#if LEAK_CORE_GUARD
+/* thread-local guard to avoid recursion when backtrace() (or other helpers,
+ * like the first stack-bounds lookup of a thread, or the report) cause
+ * allocations that would re-enter our wrappers. */
+static __thread int leak_guard = 0;
+#define LEAK_GUARDED() leak_guard
+#else
+#define LEAK_GUARDED() 0
+#endif
+
+/* ---- fork ---- */
+
+static int leak_forked = 0;         /* this process is a fork() child */
+static int leak_fork_inherit = 0;   /* LEAK_FORK=inherit */
+
+/* Take every lock a wrapper or a background thread may hold, so the child
+ * does not inherit one from a thread that no longer exists there. */
+static void leak_fork_prepare(void) {
+#if LEAK_CORE_SITES
+    leak_lock(&leak_depot.lock);
+    leak_lock(&leak_modules.lock);
+    leak_lock(&leak_trace_orphan_lock);
+    leak_lock(&leak_scan_threads_lock);
+    leak_lock(&leak_supp.lock);
+#endif
+    leak_table_lock_all(&allocations);
+}
+
+static void leak_fork_parent(void) {
+    leak_table_unlock_all(&allocations);
+#if LEAK_CORE_SITES
+    leak_unlock(&leak_supp.lock);
+    leak_unlock(&leak_scan_threads_lock);
+    leak_unlock(&leak_trace_orphan_lock);
+    leak_unlock(&leak_modules.lock);
+    leak_unlock(&leak_depot.lock);
+#endif
+}
+
+static void leak_fork_child(void) {
+    leak_forked = 1;
+    if (!leak_fork_inherit) leak_table_reset(&allocations);
+    leak_table_unlock_all(&allocations);
+#if LEAK_CORE_FDS
+    if (!leak_fork_inherit) leak_fds_reset();
+#endif
+#if LEAK_CORE_SITES
+    leak_scan_child();
+    leak_unlock(&leak_supp.lock);
+    leak_unlock(&leak_scan_threads_lock);
+    leak_unlock(&leak_trace_orphan_lock);
+    leak_unlock(&leak_modules.lock);
+    if (!leak_fork_inherit) leak_depot_clear_counts();
+    leak_unlock(&leak_depot.lock);
+    /* the restarted threads' own files are not the program's */
+    int guard = leak_guard;
+    leak_guard = 1;
+    leak_trace_child();
+    leak_snapshot_child();
+    leak_growth_child(leak_fork_inherit);
+    leak_metrics_child(leak_fork_inherit);
+    leak_guard = guard;
+#endif
+#if LEAK_CORE_LIFETIME
+    leak_life_child(leak_fork_inherit);
+#endif
+}
+
+/* init: obtain real symbols. real_malloc is published last: a wrapper
+ * that sees it set sees every other real_* pointer too (leak_boot.h) */
+static void leak_core_do_init(void) {
+    void* (*m)(size_t) = dlsym(RTLD_NEXT, "malloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+#if LEAK_CORE_WRAP_ALL
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_strdup = dlsym(RTLD_NEXT, "strdup");
+    real_strndup = dlsym(RTLD_NEXT, "strndup");
+    real_fopen = dlsym(RTLD_NEXT, "fopen");
+    real_fclose = dlsym(RTLD_NEXT, "fclose");
+    real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+#endif
+#if LEAK_CORE_FDS
+    real_open = dlsym(RTLD_NEXT, "open");
+    real_open64 = dlsym(RTLD_NEXT, "open64");
+    real_openat = dlsym(RTLD_NEXT, "openat");
+    real_openat64 = dlsym(RTLD_NEXT, "openat64");
+    real_socket = dlsym(RTLD_NEXT, "socket");
+    real_accept = dlsym(RTLD_NEXT, "accept");
+    real_accept4 = dlsym(RTLD_NEXT, "accept4");
+    real_dup = dlsym(RTLD_NEXT, "dup");
+    real_dup2 = dlsym(RTLD_NEXT, "dup2");
+    real_dup3 = dlsym(RTLD_NEXT, "dup3");
+    real_pipe = dlsym(RTLD_NEXT, "pipe");
+    real_pipe2 = dlsym(RTLD_NEXT, "pipe2");
+    real_eventfd = dlsym(RTLD_NEXT, "eventfd");
+    real_epoll_create = dlsym(RTLD_NEXT, "epoll_create");
+    real_epoll_create1 = dlsym(RTLD_NEXT, "epoll_create1");
+    leak_fds_init();
+    real_close = dlsym(RTLD_NEXT, "close");
+#endif
+    __atomic_store_n(&real_malloc, m, __ATOMIC_RELEASE);
+    const char *fork_mode = getenv("LEAK_FORK");
+    leak_fork_inherit = fork_mode && strcmp(fork_mode, "inherit") == 0;
+    pthread_atfork(leak_fork_prepare, leak_fork_parent, leak_fork_child);
+#if LEAK_CORE_SITES
+    /* the threads and files started here are the detector's own */
+    int guard = leak_guard;
+    leak_guard = 1;
+    leak_unwind_init();
+    leak_sample_init();
+    leak_pprof_init();
+    leak_scan_init();
+    leak_trace_start(0);
+    leak_snapshot_start(leak_snapshot);
+    leak_metrics_start(watch_metrics, depot_count, leak_growth_init());
+    leak_suppress_init();
+    leak_guard = guard;
+#endif
+#if LEAK_CORE_LIFETIME
+    leak_life_init();
+#endif
+#ifdef LEAK_CORE_BANNER
+    if (getenv("LEAK_VERBOSE")) fprintf(stderr, "%s\n", LEAK_CORE_BANNER);
+#endif
+}
+
+void __attribute__((constructor)) init_hooks() {
+    leak_init_once(leak_core_do_init);
+}
+
+/* Slow path of every wrapper until init has run: returns 1 once the real
+ * functions are there, 0 while dlsym is still resolving them. */
+static __attribute__((noinline)) int leak_boot(void) {
+    leak_init_once(leak_core_do_init);
+    return __atomic_load_n(&real_malloc, __ATOMIC_ACQUIRE) != NULL;
+}
+
+#if LEAK_CORE_SITES
+static void record_allocation(void *ptr, size_t size, uint8_t type, void *caller) {
+    if (!ptr) return;
+    /* before sampling and unwinding: a suppressed site costs one lookup */
+    if (leak_suppressed(caller)) return;
+    /* zero-sized records (fopen, malloc(0)) carry no bytes to sample */
+    if (size && !leak_sample_take(size)) return;
+    alloc_info_t a;
+    a.ptr = ptr;
+    a.size = size;
+    a.type = type;
+    a.stack = 0;
+    a.metered = 0;
+#if LEAK_CORE_LIFETIME
+    a.born = leak_life_on ? leak_life_ticks() : 0;
+#endif
+
+    if (!leak_guard) {
+        leak_guard = 1;
+        void *btbuf[LEAK_CORE_DEPTH];
+        int n = leak_unwind(btbuf, LEAK_CORE_DEPTH);
+        a.stack = leak_depot_put(btbuf, n);
+        leak_scan_register_thread();
+        /* the module index saw a dlopen or dlclose: resolve again, and
+         * check again, as this block may come from the module just loaded */
+        if (leak_supp.npats && __atomic_load_n(&leak_modules.gen, __ATOMIC_RELAXED) !=
+                                   __atomic_load_n(&leak_supp.gen, __ATOMIC_RELAXED)) {
+            leak_suppress_refresh();
+            if (leak_suppressed(caller)) {
+                leak_guard = 0;
+                return;
+            }
+        }
+        leak_guard = 0;
+    }
+
+    /* counted first, so that the record says whether it was */
+    if (leak_metrics.on) a.metered = (uint8_t)leak_metrics_alloc(a.stack, type, size);
+    if (!leak_table_insert(&allocations, ptr, &a)) {
+        if (leak_metrics.on) leak_metrics_free(a.stack, type, size, a.metered);
+        return;
+    }
+    if (leak_pprof_on && a.stack) leak_depot_account(a.stack, size, leak_sample_estimate(size));
+    if (leak_trace_fd >= 0) leak_trace_push(LEAK_EV_ALLOC, type, a.stack, ptr, size);
+}
+
+/* the FREE event is stamped before the block goes back to the allocator,
+ * so a replay never sees an address reused before it was freed */
+static int remove_allocation(void *ptr, alloc_info_t *out) {
+    alloc_info_t a;
+    if (!out && leak_metrics.on) out = &a;
+#if LEAK_CORE_LIFETIME
+    if (!out && leak_life_on) out = &a;
+#endif
+    if (!leak_table_remove(&allocations, ptr, out)) return 0;
+    if (leak_metrics.on) leak_metrics_free(out->stack, out->type, out->size, out->metered);
+#if LEAK_CORE_LIFETIME
+    if (out && out->born) leak_life_add(out->stack, out->size, out->born);
+#endif
+    if (leak_trace_fd >= 0) leak_trace_push(LEAK_EV_FREE, 0, 0, ptr, 0);
+    return 1;
+}
+
+/* put back a block a failed realloc left allocated */
+static void restore_allocation(const alloc_info_t *old) {
+    alloc_info_t a = *old;
+    if (leak_metrics.on) a.metered = (uint8_t)leak_metrics_alloc(a.stack, a.type, a.size);
+    if (!leak_table_insert(&allocations, a.ptr, &a)) {
+        if (leak_metrics.on) leak_metrics_free(a.stack, a.type, a.size, a.metered);
+        return;
+    }
+    if (leak_trace_fd >= 0)
+        leak_trace_push(LEAK_EV_ALLOC, old->type, old->stack, old->ptr, old->size);
+}
+#else
+static inline __attribute__((always_inline)) void record_allocation(void *ptr, size_t size,
+                                                                    uint8_t type, void *caller) {
+    (void)type;
+    (void)caller;
+    if (!ptr) return;
+    alloc_info_t a;
+    a.ptr = ptr;
+    a.size = size;
+#if LEAK_CORE_CAPTURE == LEAK_CAPTURE_CALLER
+    a.caller = caller;
+#endif
+#if LEAK_CORE_TYPED
+    a.type = type;
+#endif
+    leak_table_insert(&allocations, ptr, &a);
+}
+
+static inline int remove_allocation(void *ptr, alloc_info_t *out) {
+    return leak_table_remove(&allocations, ptr, out);
+}
+
+static inline void restore_allocation(const alloc_info_t *old) {
+    leak_table_insert(&allocations, old->ptr, old);
+}
+#endif
+
+#if LEAK_CORE_FDS
+#if LEAK_CORE_SITES
+/* a descriptor's origin is its stack, as for a block */
+static __attribute__((noinline)) uint64_t leak_fd_origin(void *caller) {
+    (void)caller;
+    leak_guard = 1;
+    void *btbuf[LEAK_CORE_DEPTH];
+    int n = leak_unwind(btbuf, LEAK_CORE_DEPTH);
+    uint32_t id = leak_depot_put(btbuf, n);
+    leak_guard = 0;
+    return id;
+}
+#else
+#define leak_fd_origin(caller) ((uint64_t)(uintptr_t)(caller))
+#endif
+
+static inline __attribute__((always_inline)) void record_fd(int fd, uint8_t type, void *caller) {
+    if (fd < 0 || LEAK_GUARDED()) return;
+    uint64_t origin = leak_fd_origin(caller);
+    uint64_t old = leak_fds_open(fd, type, origin);
+    (void)old;
+#if LEAK_CORE_SITES
+    if (leak_trace_fd >= 0) {
+        if (old) leak_trace_push(LEAK_EV_FD_CLOSE, 0, 0, (void *)(uintptr_t)fd, 0);
+        leak_trace_push(LEAK_EV_FD_OPEN, type, (uint32_t)origin, (void *)(uintptr_t)fd, 0);
+    }
+#endif
+}
+
+static inline __attribute__((always_inline)) void remove_fd(int fd) {
+    uint64_t old = leak_fds_close(fd);
+    (void)old;
+#if LEAK_CORE_SITES
+    if (old && leak_trace_fd >= 0)
+        leak_trace_push(LEAK_EV_FD_CLOSE, 0, 0, (void *)(uintptr_t)fd, 0);
+#endif
+}
+#endif
+
+/* lets tests check what the detector currently tracks */
+int leak_lookup(const void *ptr, size_t *size) {
+    alloc_info_t a;
+    if (!leak_table_find(&allocations, ptr, &a)) return 0;
+    if (size) *size = a.size;
+    return 1;
+}
+
+size_t leak_live_count(void) {
+    return leak_table_count(&allocations);
+}
+
+/* ---- reports ---- */
+
+#if LEAK_CORE_SITES
+/* Write a depot stack as comma-separated offset@binary frames, with
+ * `skip_self` from the first frame outside the detector. The modules were
+ * resolved when the stack was first seen; a frame that was in none then
+ * (a library loaded later) is looked up in the current map. */
+static void write_callers(FILE *f, uint32_t stack, int skip_self) {
+    const leak_stack_t *st = leak_depot_get(stack);
+    uint32_t first = st && skip_self ? leak_stack_skip_self(st) : 0;
+    if (!st || first >= st->depth) {
+        fputs("-", f);
+        return;
+    }
+    const uint32_t *ids = leak_stack_modules(st);
+    for (uint32_t j = first; j < st->depth; ++j) {
+        uintptr_t addr = (uintptr_t)st->frames[j];
+        const leak_module_t *m = leak_module_get(ids[j] ? ids[j] : leak_module_of(addr));
+        if (j > first) fputc(',', f);
+        if (m)
+            fprintf(f, "0x%lx@%s", (unsigned long)(addr - m->base), m->path);
+        else
+            fprintf(f, "0x%lx@-", (unsigned long)addr);
+    }
+}
+
+/* write_callers with skip_self into `buf`, leaving out the frames that
+ * do not fit */
+static void format_callers(char *buf, size_t len, uint32_t stack) {
+    const leak_stack_t *st = leak_depot_get(stack);
+    size_t n = 0;
+    buf[0] = '\0';
+    for (uint32_t j = st ? leak_stack_skip_self(st) : 0; st && j < st->depth; ++j) {
+        uintptr_t addr = (uintptr_t)st->frames[j];
+        const uint32_t *ids = leak_stack_modules(st);
+        const leak_module_t *m = leak_module_get(ids[j] ? ids[j] : leak_module_of(addr));
+        int k = m ? snprintf(buf + n, len - n, "%s0x%lx@%s", n ? "," : "",
+                             (unsigned long)(addr - m->base), m->path)
+                  : snprintf(buf + n, len - n, "%s0x%lx@-", n ? "," : "", (unsigned long)addr);
+        if (k < 0 || (size_t)k >= len - n) {
+            buf[n] = '\0';
+            break;
+        }
+        n += (size_t)k;
+    }
+    if (!n && len > 1) snprintf(buf, len, "-");
+}
+
+static uint32_t depot_count(void) {
+    return __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE);
+}
+
+/* LEAK_METRICS=1: fill in the published part of the segment from the
+ * per-stack live sums, on the metrics thread. Sites are ranked by how much
+ * they grew since the previous call (since start for the first). */
+static void publish_metrics(leak_metrics_seg_t *seg, const leak_metrics_total_t *live,
+                            uint32_t nstacks) {
+    static leak_metrics_total_t *prev;
+    static size_t prev_len;
+    static uint64_t prev_ns;
+    size_t len = ((size_t)nstacks + 1) * sizeof(*prev);
+    if (len > prev_len) {
+        leak_metrics_total_t *p = leak_pages_alloc(len * 2);
+        if (!p) return;
+        if (prev) memcpy(p, prev, prev_len);
+        leak_pages_free(prev, prev_len);
+        prev = p;
+        prev_len = len * 2;
+    }
+    int guard = leak_guard;
+    leak_guard = 1;
+
+    uint32_t top[LEAK_METRICS_TOP];
+    int64_t growth[LEAK_METRICS_TOP];
+    uint32_t k = 0;
+    for (uint32_t id = 0; id <= nstacks; ++id) {
+        int64_t g = live[id].bytes - prev[id].bytes;
+        if (g <= 0 || (k == LEAK_METRICS_TOP && g <= growth[k - 1])) continue;
+        uint32_t i = k < LEAK_METRICS_TOP ? k++ : k - 1;
+        for (; i && growth[i - 1] < g; --i) {
+            top[i] = top[i - 1];
+            growth[i] = growth[i - 1];
+        }
+        top[i] = id;
+        growth[i] = g;
+    }
+
+    uint64_t seq = seg->seq;
+    __atomic_store_n(&seg->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    uint64_t now = leak_metrics_now();
+    seg->window_ns = now - (prev_ns ? prev_ns : seg->start_ns);
+    seg->now_ns = prev_ns = now;
+    seg->sample_bytes = leak_sample_bytes;
+    seg->table_records = leak_table_count(&allocations);
+    seg->table_slots = leak_table_slots(&allocations);
+    seg->threads = __atomic_load_n(&leak_metrics.nthreads, __ATOMIC_RELAXED);
+    uint32_t nd = 0;
+#define METRICS_DROPPED(label, v) \
+    do { \
+        snprintf(seg->dropped[nd].name, sizeof(seg->dropped[nd].name), "%s", label); \
+        seg->dropped[nd++].value = (uint64_t)(v); \
+    } while (0)
+    METRICS_DROPPED("table", __atomic_load_n(&allocations.dropped, __ATOMIC_RELAXED));
+    METRICS_DROPPED("stacks", __atomic_load_n(&leak_depot.dropped, __ATOMIC_RELAXED));
+    METRICS_DROPPED("sites", __atomic_load_n(&leak_metrics.sites_dropped, __ATOMIC_RELAXED));
+    METRICS_DROPPED("trace", __atomic_load_n(&leak_trace_dropped, __ATOMIC_RELAXED));
+#if LEAK_CORE_FDS
+    METRICS_DROPPED("fds", __atomic_load_n(&leak_fds.dropped, __ATOMIC_RELAXED));
+#endif
+#if LEAK_CORE_LIFETIME
+    METRICS_DROPPED("lifetime", __atomic_load_n(&leak_life_dropped, __ATOMIC_RELAXED));
+#endif
+#undef METRICS_DROPPED
+    seg->ndropped = nd;
+    for (uint32_t i = 0; i < k; ++i) {
+        leak_metrics_site_t *s = &seg->sites[i];
+        s->bytes = live[top[i]].bytes;
+        s->blocks = live[top[i]].blocks;
+        s->growth = growth[i];
+        s->stack = top[i];
+        format_callers(s->callers, sizeof(s->callers), top[i]);
+    }
+    seg->nsites = k;
+    __atomic_store_n(&seg->seq, seq + 2, __ATOMIC_RELEASE);
+
+    memcpy(prev, live, len);
+    leak_guard = guard;
+}
+
+/* The metrics thread's callback, at the shorter of LEAK_METRICS_MS and
+ * LEAK_GROWTH_MS: publish for leaktop when that is due, and sample for
+ * the growth detector. */
+static void watch_metrics(leak_metrics_seg_t *seg, const leak_metrics_total_t *live,
+                          uint32_t nstacks) {
+    uint64_t now = leak_metrics_now();
+    if (leak_metrics.shared &&
+        now - seg->now_ns + leak_metrics.tick_ms * 500000 >= seg->interval_ms * 1000000)
+        publish_metrics(seg, live, nstacks);
+    if (!leak_growth.on) return;
+    int guard = leak_guard;
+    leak_guard = 1;
+    leak_growth_check(live, nstacks, now, format_callers);
+    leak_guard = guard;
+}
+
+/* Function: collect_live
+ * Copy every live record into one mmap'd array of `*cap` records, shard
+ * by shard under each shard's own lock, so allocating threads are held up
+ * for at most one shard's memcpy. Returns the array (NULL if there is
+ * nothing or mmap fails) and the record count in `*n`.
+ */
+static alloc_info_t *collect_live(size_t *n, size_t *cap) {
+    alloc_info_t *buf = NULL;
+    *n = *cap = 0;
+    for (size_t s = 0; s < LEAK_SHARDS; ++s) {
+        size_t got;
+        while ((got = leak_table_copy_shard(&allocations, s, buf ? buf + *n : NULL,
+                                            *cap - *n)) > *cap - *n) {
+            size_t cap2 = (*n + got) * 2;
+            alloc_info_t *b = leak_pages_alloc(cap2 * sizeof(*b));
+            if (!b) return buf;
+            if (buf) {
+                memcpy(b, buf, *n * sizeof(*b));
+                leak_pages_free(buf, *cap * sizeof(*b));
+            }
+            buf = b;
+            *cap = cap2;
+        }
+        *n += got;
+    }
+    return buf;
+}
+
+#if LEAK_CORE_FDS
+/* Append a record per tracked descriptor still open to `live` (of `*cap`
+ * records), growing it as collect_live does: the descriptor as `ptr`, no
+ * size, its kind and the stack that opened it. */
+static alloc_info_t *append_fds(alloc_info_t *live, size_t *n, size_t *cap) {
+    uint32_t top = __atomic_load_n(&leak_fds.top, __ATOMIC_RELAXED);
+    for (uint32_t fd = 0; fd < top; ++fd) {
+        uint8_t type;
+        uint64_t origin;
+        if (!leak_fds_get(fd, &type, &origin)) continue;
+        if (*n == *cap) {
+            size_t cap2 = *cap ? *cap * 2 : 64;
+            alloc_info_t *b = leak_pages_alloc(cap2 * sizeof(*b));
+            if (!b) break;
+            if (live) {
+                memcpy(b, live, *n * sizeof(*b));
+                leak_pages_free(live, *cap * sizeof(*b));
+            }
+            live = b;
+            *cap = cap2;
+        }
+        alloc_info_t *a = &live[(*n)++];
+        a->ptr = (void *)(uintptr_t)fd;
+        a->size = 0;
+        a->stack = (uint32_t)origin;
+        a->type = type;
+#if LEAK_CORE_LIFETIME
+        a->born = 0;
+#endif
+    }
+    return live;
+}
+#endif
+
+/* LEAK_REPORT_ALL=1: one line per leaked block */
+static void report_all(FILE *f, const alloc_info_t *live, size_t n) {
+    double est_bytes = 0;
+    if (leak_sample_bytes)
+        fprintf(f, "#ptr size type callers sample_bytes=%zu\n", leak_sample_bytes);
+    else
+        fprintf(f, "#ptr size type callers\n");
+    for (size_t i = 0; i < n; ++i) {
+        const alloc_info_t *a = &live[i];
+        fprintf(f, "%p %zu %s ", a->ptr, a->size, leak_type_name(a->type));
+        write_callers(f, a->stack, 0);
+        fputc('\n', f);
+
+        if (leak_type_is_fd(a->type))
+            fprintf(stderr, "FD leak: %d [%s]\n", (int)(uintptr_t)a->ptr, leak_type_name(a->type));
+        else
+            fprintf(stderr, "Leak: %p (%zu bytes)\n", a->ptr, a->size);
+        est_bytes += leak_sample_estimate(a->size);
+    }
+    if (leak_sample_bytes && n)
+        fprintf(stderr, "Sampled %zu leaks (1 per %zu bytes), estimated %.0f bytes leaked\n",
+                n, leak_sample_bytes, est_bytes);
+}
+
+/* Write the first `top` of the sorted `sites`; `tag` ends the header. */
+static void write_sites(FILE *f, const leak_sites_t *sites, size_t top, const char *tag) {
+    fprintf(f, "#sites count bytes est_bytes min max type callers");
+    if (leak_sample_bytes) fprintf(f, " sample_bytes=%zu", leak_sample_bytes);
+    fprintf(f, "%s\n", tag);
+    for (size_t i = 0; i < top; ++i) {
+        const leak_site_t *s = &sites->slots[i];
+        fprintf(f, "%zu %zu %.0f %zu %zu %s ", s->count, s->bytes, s->est, s->min, s->max,
+                leak_type_name(s->type));
+        write_callers(f, s->stack, 0);
+        fputc('\n', f);
+    }
+}
+
+/* Default: aggregate by stack and kind, write the LEAK_TOP_N (default 50,
+ * 0 = all) largest sites. */
+static void report_sites(FILE *f, const alloc_info_t *live, size_t n) {
+    leak_sites_t sites;
+    memset(&sites, 0, sizeof(sites));
+    size_t bytes = 0;
+    double est_bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+        leak_sites_add(&sites, live[i].stack, live[i].type, live[i].size);
+        bytes += live[i].size;
+        est_bytes += leak_sample_estimate(live[i].size);
+    }
+    leak_sites_sort(&sites);
+
+    size_t top = 50;
+    const char *v = getenv("LEAK_TOP_N");
+    if (v) top = strtoull(v, NULL, 10);
+    if (!top || top > sites.n) top = sites.n;
+
+    write_sites(f, &sites, top, "");
+    for (size_t i = 0; i < top; ++i) {
+        const leak_site_t *s = &sites.slots[i];
+        fprintf(stderr, "Leak site: %zu blocks, %zu bytes [%s]\n", s->count, s->bytes,
+                leak_type_name(s->type));
+    }
+    if (n) {
+        fprintf(stderr, "%zu leaks (%zu bytes) from %zu sites", n, bytes, sites.n);
+        if (top < sites.n) fprintf(stderr, ", top %zu written", top);
+        if (leak_sample_bytes)
+            fprintf(stderr, "; sampled 1 per %zu bytes, estimated %.0f bytes leaked",
+                    leak_sample_bytes, est_bytes);
+        fprintf(stderr, "\n");
+    }
+    leak_sites_free(&sites);
+}
+
+static int live_site_cmp(const void *x, const void *y) {
+    const alloc_info_t *a = x, *b = y;
+    if (a->stack != b->stack) return a->stack < b->stack ? -1 : 1;
+    if (a->type != b->type) return a->type < b->type ? -1 : 1;
+    return a->ptr < b->ptr ? -1 : a->ptr > b->ptr;
+}
+
+static int report_site_cmp(const void *x, const void *y) {
+    const leak_report_site_t *a = x, *b = y;
+    if (a->est != b->est) return a->est > b->est ? -1 : 1;
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    return a->stack < b->stack ? -1 : a->stack > b->stack;
+}
+
+/* LEAK_REPORT_FORMAT=bin: the same sites as report_sites, and the blocks
+ * of each, in the binary report format. `live` is reordered by site. */
+static void report_bin(FILE *f, alloc_info_t *live, size_t n) {
+    if (n) qsort(live, n, sizeof(*live), live_site_cmp);
+    size_t nsites = 0;
+    for (size_t i = 0; i < n; ++i)
+        if (!i || live[i].stack != live[i - 1].stack || live[i].type != live[i - 1].type) nsites++;
+    size_t sites_len = (nsites ? nsites : 1) * sizeof(leak_report_site_t);
+    size_t blocks_len = (n ? n : 1) * sizeof(leak_report_block_t);
+    leak_report_site_t *sites = leak_pages_alloc(sites_len);
+    leak_report_block_t *blocks = leak_pages_alloc(blocks_len);
+    if (!sites || !blocks) {
+        fprintf(stderr, "leak detector: out of memory for the binary report\n");
+        goto out;
+    }
+
+    size_t k = 0, bytes = 0;
+    double est_bytes = 0, site_est = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const alloc_info_t *a = &live[i];
+        if (!i || a->stack != live[i - 1].stack || a->type != live[i - 1].type) {
+            if (i) sites[k - 1].est = (uint64_t)(site_est + 0.5);
+            leak_report_site_t *s = &sites[k++];
+            s->first = i;
+            s->stack = a->stack;
+            s->type = a->type;
+            s->min = a->size;
+            site_est = 0;
+        }
+        leak_report_site_t *s = &sites[k - 1];
+        s->count++;
+        s->bytes += a->size;
+        if (a->size < s->min) s->min = a->size;
+        if (a->size > s->max) s->max = a->size;
+        site_est += leak_sample_estimate(a->size);
+        blocks[i].ptr = (uintptr_t)a->ptr;
+        blocks[i].size = a->size;
+        bytes += a->size;
+        est_bytes += leak_sample_estimate(a->size);
+    }
+    if (k) sites[k - 1].est = (uint64_t)(site_est + 0.5);
+    if (k) qsort(sites, k, sizeof(*sites), report_site_cmp);
+
+    size_t top = 50;
+    const char *v = getenv("LEAK_TOP_N");
+    if (v) top = strtoull(v, NULL, 10);
+    if (!top || top > k) top = k;
+    for (size_t i = 0; i < top; ++i)
+        fprintf(stderr, "Leak site: %llu blocks, %llu bytes [%s]\n",
+                (unsigned long long)sites[i].count, (unsigned long long)sites[i].bytes,
+                leak_type_name(sites[i].type));
+    if (n) {
+        fprintf(stderr, "%zu leaks (%zu bytes) from %zu sites", n, bytes, k);
+        if (top < k) fprintf(stderr, ", top %zu written", top);
+        if (leak_sample_bytes)
+            fprintf(stderr, "; sampled 1 per %zu bytes, estimated %.0f bytes leaked",
+                    leak_sample_bytes, est_bytes);
+        fprintf(stderr, "\n");
+    }
+
+    /* the blocks of the sites left out go too: pack the rest to the front,
+     * site by site */
+    size_t nblocks = 0;
+    for (size_t i = 0; i < top; ++i) {
+        memmove(&blocks[nblocks], &blocks[sites[i].first], sites[i].count * sizeof(*blocks));
+        sites[i].first = nblocks;
+        nblocks += sites[i].count;
+    }
+    if (!leak_report_bin_write(f, sites, top, blocks, nblocks, leak_sample_bytes))
+        fprintf(stderr, "leak detector: cannot write the binary report\n");
+out:
+    leak_pages_free(sites, sites_len);
+    leak_pages_free(blocks, blocks_len);
+}
+
+/* Function: leak_snapshot
+ * Write every live site to the next leak_snapshot.<pid>.<n>.txt while the
+ * process keeps running (see collect_live). Returns the snapshot number,
+ * or -1 if it could not be written.
+ */
+int leak_snapshot(void) {
+    int guard = leak_guard;
+    leak_guard = 1;
+    size_t n, cap, bytes = 0;
+    alloc_info_t *live = collect_live(&n, &cap);
+#if LEAK_CORE_FDS
+    live = append_fds(live, &n, &cap);
+#endif
+    leak_sites_t sites;
+    memset(&sites, 0, sizeof(sites));
+    for (size_t i = 0; i < n; ++i) {
+        leak_sites_add(&sites, live[i].stack, live[i].type, live[i].size);
+        bytes += live[i].size;
+    }
+    leak_pages_free(live, cap * sizeof(*live));
+    leak_sites_sort(&sites);
+    leak_modules_refresh();
+
+    char path[4096], tag[64];
+    unsigned seq = leak_snapshot_path(path, sizeof(path));
+    FILE *f = fopen(path, "w");
+    if (f) {
+        snprintf(tag, sizeof(tag), " snapshot=%u time=%lld", seq, (long long)time(NULL));
+        write_sites(f, &sites, sites.n, tag);
+        fclose(f);
+        if (getenv("LEAK_VERBOSE"))
+            fprintf(stderr, "leak snapshot %u: %zu blocks (%zu bytes) from %zu sites -> %s\n", seq,
+                    n, bytes, sites.n, path);
+    }
+    leak_sites_free(&sites);
+    leak_guard = guard;
+    return f ? (int)seq : -1;
+}
+
+/* LEAK_PPROF=path: the leaked blocks as pprof's inuse_* values, next to
+ * everything each stack ever allocated */
+static void write_pprof(const char *path, const alloc_info_t *live, size_t n) {
+    uint32_t nstacks = __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE);
+    size_t len = ((size_t)nstacks + 1) * sizeof(leak_pprof_inuse_t);
+    leak_pprof_inuse_t *inuse = leak_pages_alloc(len);
+    if (!inuse) return;
+    for (size_t i = 0; i < n; ++i) {
+        uint32_t id = live[i].stack <= nstacks ? live[i].stack : 0;
+        double est = leak_sample_estimate(live[i].size);
+        inuse[id].objects += live[i].size ? est / (double)live[i].size : 1;
+        inuse[id].bytes += est;
+    }
+    if (!leak_pprof_write(path, inuse, nstacks, leak_sample_bytes))
+        fprintf(stderr, "leak detector: cannot write pprof profile %s\n", path);
+    leak_pages_free(inuse, len);
+}
+
+#if LEAK_CORE_LIFETIME
+typedef struct {
+    uint32_t stack;
+    uint64_t freed;                         /* blocks freed at any age */
+    uint64_t short_blocks, short_bytes;     /* freed younger than short */
+    uint64_t long_blocks, long_bytes;       /* freed at long or older */
+    uint64_t live_blocks, live_bytes;       /* still live, long or older */
+} life_site_t;
+
+static int life_churn_cmp(const void *x, const void *y) {
+    const life_site_t *a = x, *b = y;
+    if (a->short_blocks != b->short_blocks) return a->short_blocks > b->short_blocks ? -1 : 1;
+    return a->stack < b->stack ? -1 : a->stack > b->stack;
+}
+
+static int life_long_cmp(const void *x, const void *y) {
+    const life_site_t *a = x, *b = y;
+    uint64_t ab = a->long_bytes + a->live_bytes, bb = b->long_bytes + b->live_bytes;
+    if (ab != bb) return ab > bb ? -1 : 1;
+    return a->stack < b->stack ? -1 : a->stack > b->stack;
+}
+
+static void write_life_ns(FILE *f, double ns) {
+    if (ns < 1e3) fprintf(f, "%.0fns", ns);
+    else if (ns < 1e6) fprintf(f, "%.3gus", ns / 1e3);
+    else if (ns < 1e9) fprintf(f, "%.3gms", ns / 1e6);
+    else fprintf(f, "%.3gs", ns / 1e9);
+}
+
+/* a site's freed blocks as upper-bound:count per nonempty bucket */
+static void write_life_hist(FILE *f, uint32_t stack, double ns_per_tick) {
+    uint64_t count[LEAK_LIFE_BUCKETS] = { 0 };
+    for (leak_life_table_t *t = __atomic_load_n(&leak_life_tables, __ATOMIC_ACQUIRE); t;
+         t = t->next) {
+        const leak_life_site_t *s = leak_life_find(t, stack);
+        if (!s) continue;
+        for (unsigned b = 0; b < LEAK_LIFE_BUCKETS; ++b)
+            count[b] += __atomic_load_n(&s->count[b], __ATOMIC_RELAXED);
+    }
+    int any = 0;
+    for (unsigned b = 0; b < LEAK_LIFE_BUCKETS; ++b) {
+        if (!count[b]) continue;
+        if (any++) fputc(',', f);
+        fputs("<", f);
+        write_life_ns(f, (double)((uint64_t)1 << (b + LEAK_LIFE_SHIFT)) * ns_per_tick);
+        fprintf(f, ":%lu", (unsigned long)count[b]);
+    }
+    if (!any) fputs("-", f);
+}
+
+/* LEAK_LIFETIME=path: the LEAK_TOP_N sites freeing the most blocks younger
+ * than LEAK_LIFETIME_SHORT_US (default 1000), by rate, then those holding
+ * the most bytes for LEAK_LIFETIME_LONG_MS (default 1000) or longer, freed
+ * or still live. A bucket counts as short only if it ends below the
+ * threshold and as long only if it starts at or past it. */
+static void write_lifetime(const char *path, const alloc_info_t *live, size_t n) {
+    double ns_per_tick = leak_life_ns_per_tick();
+    double elapsed = (double)(leak_life_ns() - leak_life_ns0) / 1e9;
+    const char *v = getenv("LEAK_LIFETIME_SHORT_US");
+    double short_ns = (v ? strtod(v, NULL) : 1000) * 1e3;
+    v = getenv("LEAK_LIFETIME_LONG_MS");
+    double long_ns = (v ? strtod(v, NULL) : 1000) * 1e6;
+
+    uint32_t nstacks = __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE);
+    size_t len = ((size_t)nstacks + 1) * sizeof(life_site_t);
+    life_site_t *sites = leak_pages_alloc(len);
+    if (!sites) return;
+    for (leak_life_table_t *t = __atomic_load_n(&leak_life_tables, __ATOMIC_ACQUIRE); t;
+         t = t->next) {
+        for (uint32_t id = 0; id <= nstacks; ++id) {
+            const leak_life_site_t *s = leak_life_find(t, id);
+            if (!s) continue;
+            life_site_t *d = &sites[id];
+            for (unsigned b = 0; b < LEAK_LIFE_BUCKETS; ++b) {
+                uint64_t c = __atomic_load_n(&s->count[b], __ATOMIC_RELAXED);
+                uint64_t bytes = __atomic_load_n(&s->bytes[b], __ATOMIC_RELAXED);
+                double lo = b ? (double)((uint64_t)1 << (b - 1 + LEAK_LIFE_SHIFT)) * ns_per_tick : 0;
+                double hi = (double)((uint64_t)1 << (b + LEAK_LIFE_SHIFT)) * ns_per_tick;
+                d->freed += c;
+                if (hi <= short_ns) {
+                    d->short_blocks += c;
+                    d->short_bytes += bytes;
+                }
+                if (lo >= long_ns) {
+                    d->long_blocks += c;
+                    d->long_bytes += bytes;
+                }
+            }
+        }
+    }
+    uint64_t now = leak_life_ticks();
+    for (size_t i = 0; i < n; ++i) {
+        if (!live[i].born || live[i].stack > nstacks) continue;
+        if (now < live[i].born || (double)(now - live[i].born) * ns_per_tick < long_ns) continue;
+        sites[live[i].stack].live_blocks++;
+        sites[live[i].stack].live_bytes += live[i].size;
+    }
+    size_t k = 0;
+    for (uint32_t id = 0; id <= nstacks; ++id) {
+        life_site_t *d = &sites[id];
+        if (!d->freed && !d->live_blocks) continue;
+        d->stack = id;
+        sites[k++] = *d;
+    }
+
+    size_t top = 50;
+    v = getenv("LEAK_TOP_N");
+    if (v) top = strtoull(v, NULL, 10);
+    if (!top || top > k) top = k;
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "leak detector: cannot write lifetime profile %s\n", path);
+        leak_pages_free(sites, len);
+        return;
+    }
+    fprintf(f, "#lifetime elapsed_s=%.3f short_us=%g long_ms=%g ns_per_tick=%.4f dropped=%lu",
+            elapsed, short_ns / 1e3, long_ns / 1e6, ns_per_tick,
+            (unsigned long)__atomic_load_n(&leak_life_dropped, __ATOMIC_RELAXED));
+    if (leak_sample_bytes) fprintf(f, " sample_bytes=%zu", leak_sample_bytes);
+    fputc('\n', f);
+
+    qsort(sites, k, sizeof(*sites), life_churn_cmp);
+    fprintf(f, "#churn short_per_s short_blocks short_bytes freed_blocks callers lifetimes\n");
+    for (size_t i = 0; i < top && sites[i].short_blocks; ++i) {
+        const life_site_t *d = &sites[i];
+        fprintf(f, "%.1f %lu %lu %lu ", elapsed > 0 ? (double)d->short_blocks / elapsed : 0,
+                (unsigned long)d->short_blocks, (unsigned long)d->short_bytes,
+                (unsigned long)d->freed);
+        write_callers(f, d->stack, 1);
+        fputc(' ', f);
+        write_life_hist(f, d->stack, ns_per_tick);
+        fputc('\n', f);
+    }
+
+    qsort(sites, k, sizeof(*sites), life_long_cmp);
+    fprintf(f, "#long long_bytes long_blocks live_bytes live_blocks callers lifetimes\n");
+    for (size_t i = 0; i < top && sites[i].long_bytes + sites[i].live_bytes; ++i) {
+        const life_site_t *d = &sites[i];
+        fprintf(f, "%lu %lu %lu %lu ", (unsigned long)d->long_bytes,
+                (unsigned long)d->long_blocks, (unsigned long)d->live_bytes,
+                (unsigned long)d->live_blocks);
+        write_callers(f, d->stack, 1);
+        fputc(' ', f);
+        write_life_hist(f, d->stack, ns_per_tick);
+        fputc('\n', f);
+    }
+    fclose(f);
+    leak_pages_free(sites, len);
+}
+#endif
+
+/* Drop the blocks the reachability scan (leak_scan.h) still finds a
+ * pointer to, keeping the order of the rest. */
+static size_t drop_reachable(alloc_info_t *live, size_t n, const void *stack_from) {
+    leak_range_t *r = leak_pages_alloc(n * sizeof(*r));
+    uint8_t *mark = leak_pages_alloc(n);
+    if (!r || !mark) {
+        leak_pages_free(r, n * sizeof(*r));
+        leak_pages_free(mark, n);
+        return n;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        /* an fopen record has no size; scan the FILE, which points to
+         * its buffer */
+        size_t size = live[i].type == LEAK_T_FOPEN ? sizeof(FILE) : live[i].size;
+        r[i].lo = (uintptr_t)live[i].ptr;
+        r[i].hi = r[i].lo + (size ? size : 1);
+    }
+    leak_scan(r, n, mark, stack_from);
+    size_t k = 0, kept_bytes = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (!mark[i]) live[k++] = live[i];
+        else kept_bytes += live[i].size;
+    }
+    if (k < n)
+        fprintf(stderr, "%zu blocks (%zu bytes) still reachable, not reported\n", n - k, kept_bytes);
+    leak_pages_free(r, n * sizeof(*r));
+    leak_pages_free(mark, n);
+    return k;
+}
+
+void __attribute__((destructor)) cleanup() {
+    char outname[4096];
+    const char *format = getenv("LEAK_REPORT_FORMAT");
+    int bin = format && strcmp(format, "bin") == 0;
+    leak_output_path(getenv("LEAK_OUTPUT"), bin ? "leak_analysis.bin" : "leak_analysis.txt",
+                     leak_forked, outname, sizeof(outname));
+
+    leak_snapshot_stop();
+    leak_metrics_stop();
+    leak_trace_stop();
+
+    /* keep the report's own allocations out of the table while we walk it */
+    leak_guard = 1;
+    size_t n, cap;
+    alloc_info_t *live = collect_live(&n, &cap);
+#if LEAK_CORE_LIFETIME
+    /* before the scan: a block still reachable after a long life is
+     * exactly what this profile is after */
+    if (leak_life_on) {
+        char path[4096];
+        leak_output_path(getenv("LEAK_LIFETIME"), NULL, leak_forked, path, sizeof(path));
+        leak_modules_refresh();
+        write_lifetime(path, live, n);
+    }
+#endif
+    if (leak_scan_enabled && n) n = drop_reachable(live, n, __builtin_frame_address(0));
+    const char *pprof = getenv("LEAK_PPROF");
+    if (pprof && pprof[0]) {
+        char path[4096];
+        leak_output_path(pprof, NULL, leak_forked, path, sizeof(path));
+        write_pprof(path, live, n);
+    }
+#if LEAK_CORE_FDS
+    /* after the scan and the profile, which are about memory */
+    live = append_fds(live, &n, &cap);
+#endif
+
+    leak_modules_refresh();
+    FILE *f = fopen(outname, bin ? "wb" : "w");
+    if (!f) {
+        for (size_t i = 0; i < n; ++i)
+            fprintf(stderr, "Leak: %p (%zu bytes)\n", live[i].ptr, live[i].size);
+        leak_pages_free(live, cap * sizeof(*live));
+        return;
+    }
+
+    const char *all = getenv("LEAK_REPORT_ALL");
+    if (bin) report_bin(f, live, n);
+    else if (all && atoi(all)) report_all(f, live, n);
+    else report_sites(f, live, n);
+    fclose(f);
+    leak_pages_free(live, cap * sizeof(*live));
+}
+
+#else /* LEAK_REPORT_STDERR, LEAK_REPORT_CALLERS */
+
+#if LEAK_CORE_REPORT == LEAK_REPORT_CALLERS
+/* leak_analysis.txt: one line per block, "#ptr size caller binary func" */
+static void report_callers(FILE *f) {
+    alloc_info_t *a;
+    fprintf(f, "#ptr size caller binary func\n");
+    LEAK_TABLE_FOREACH(&allocations, a) {
+        const char *bin = "-";
+        const char *func = "-";
+        Dl_info info;
+        if (a->caller && dladdr(a->caller, &info) && info.dli_fname) {
+            bin = info.dli_fname;
+            func = info.dli_sname ? info.dli_sname : "-";
+            uintptr_t off = (uintptr_t)a->caller - (uintptr_t)info.dli_fbase;
+            /* static functions have no dynamic symbol; a previous
+             * leak_analyze run may have cached their name */
+            const char *cfunc, *cfile;
+            unsigned cline;
+            if (!info.dli_sname &&
+                leak_symcache_lookup_loaded(info.dli_fbase, off, &cfunc, &cfile, &cline) && cfunc)
+                func = cfunc;
+            fprintf(f, "%p %zu 0x%lx %s %s\n",
+                    a->ptr,
+                    a->size,
+                    (unsigned long)off,
+                    bin,
+                    func);
+        } else {
+            fprintf(f, "%p %zu %p %s %s\n",
+                    a->ptr,
+                    a->size,
+                    a->caller ? a->caller : (void*)0,
+                    bin,
+                    func);
+        }
+    }
+}
+#endif
+
+#if LEAK_CORE_FDS
+static void report_fds(void) {
+    uint32_t top = __atomic_load_n(&leak_fds.top, __ATOMIC_RELAXED);
+    for (uint32_t fd = 0; fd < top; ++fd) {
+        uint8_t type;
+        uint64_t origin;
+        if (leak_fds_get(fd, &type, &origin))
+            fprintf(stderr, "FD leak: %u [%s] (caller %p)\n", fd, leak_type_name(type),
+                    (void *)(uintptr_t)origin);
+    }
+}
+#endif
+
+void __attribute__((destructor)) cleanup() {
+#if LEAK_CORE_FDS
+    report_fds();
+#endif
+    if (leak_table_count(&allocations) == 0) return;
+
+    if (leak_forked)
+        fprintf(stderr, "\n=== Memory Leak Report (pid %d) ===\n", (int)getpid());
+    else
+        fprintf(stderr, "\n=== Memory Leak Report ===\n");
+#if LEAK_CORE_GUARD
+    leak_guard = 1;
+#endif
+#if LEAK_CORE_REPORT == LEAK_REPORT_CALLERS
+    char outname[4096];
+    leak_output_path(getenv("LEAK_OUTPUT"), "leak_analysis.txt", leak_forked, outname,
+                     sizeof(outname));
+    fprintf(stderr, "分析文件: %s\n", outname);
+    /* 默认输出到当前路径下的 leak_analysis.txt，直接覆盖，无时间戳；
+     * fork 出的子进程写 leak_analysis.<pid>.txt */
+    FILE *f = fopen(outname, "w");
+    if (f) {
+        report_callers(f);
+        fclose(f);
+    }
+#endif
+
+    alloc_info_t *a;
+    LEAK_TABLE_FOREACH(&allocations, a) {
+#if LEAK_CORE_CAPTURE == LEAK_CAPTURE_CALLER
+        fprintf(stderr, "Leak: %p (%zu bytes) [caller %p]\n",
+                a->ptr, a->size, a->caller ? a->caller : (void*)0);
+#else
+        fprintf(stderr, "Leak: %p (%zu bytes)\n", a->ptr, a->size);
+#endif
+    }
+}
+#endif
+
+/* ---- wrappers: nothing is recorded while the guard is set ---- */
+
+void* malloc(size_t size) {
+    if (__builtin_expect(!real_malloc, 0) && !leak_boot()) return leak_boot_alloc(size, 0);
+    void *ptr = real_malloc(size);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_MALLOC, LEAK_CALLER());
+    return ptr;
+}
+
+#if LEAK_CORE_WRAP_CXX
+static void leak_mismatch(const alloc_info_t *a, uint8_t kind, int sized, size_t size,
+                          void *caller);
+
+/* what releases a block of `type`: free, delete or delete[] */
+static inline uint8_t leak_release_kind(uint8_t type) {
+    return type == LEAK_T_NEW || type == LEAK_T_NEW_ARRAY ? type : LEAK_T_MALLOC;
+}
+
+/* Drop `ptr` from the table and hand it back to the allocator, reporting
+ * a release of the wrong kind (`kind` as from leak_release_kind) or, for
+ * sized delete, of the wrong size. */
+static inline __attribute__((always_inline)) void leak_release(void *ptr, uint8_t kind,
+                                                               int sized, size_t size,
+                                                               void *caller) {
+    /* before init only NULL and arena blocks can come back here */
+    if (__builtin_expect(leak_boot_owns(ptr) || !real_free, 0)) return;
+    alloc_info_t a;
+    if (remove_allocation(ptr, &a) &&
+        __builtin_expect(leak_release_kind(a.type) != kind || (sized && a.size != size), 0))
+        leak_mismatch(&a, kind, sized, size, caller);
+    real_free(ptr);
+}
+#endif
+
+void free(void *ptr) {
+#if LEAK_CORE_WRAP_CXX
+    leak_release(ptr, LEAK_T_MALLOC, 0, 0, __builtin_return_address(0));
+#else
+    /* before init only NULL and arena blocks can come back here */
+    if (__builtin_expect(leak_boot_owns(ptr) || !real_free, 0)) return;
+    remove_allocation(ptr, NULL);
+    real_free(ptr);
+#endif
+}
+
+void* realloc(void *ptr, size_t size) {
+    if (__builtin_expect(leak_boot_owns(ptr), 0))
+        return size ? leak_boot_move(malloc(size), ptr, size) : NULL;
+    if (__builtin_expect(!real_realloc, 0) && !leak_boot()) return ptr ? NULL : leak_boot_alloc(size, 0);
+#if LEAK_CORE_WRAP_ALL
+    alloc_info_t old;
+    int had = remove_allocation(ptr, &old);
+    void *new_ptr = real_realloc(ptr, size);
+    if (!new_ptr && size && had) {
+        /* failed realloc leaves the old block allocated */
+        restore_allocation(&old);
+    } else if (!LEAK_GUARDED()) {
+        record_allocation(new_ptr, size, LEAK_T_REALLOC, LEAK_CALLER());
+    }
+    return new_ptr;
+#else
+    return real_realloc(ptr, size);
+#endif
+}
+
+#if LEAK_CORE_WRAP_ALL
+void* calloc(size_t nmemb, size_t size) {
+    if (__builtin_expect(!real_calloc, 0) && !leak_boot()) return leak_boot_calloc(nmemb, size);
+    void *ptr = real_calloc(nmemb, size);
+    if (!LEAK_GUARDED()) record_allocation(ptr, nmemb * size, LEAK_T_CALLOC, LEAK_CALLER());
+    return ptr;
+}
+
+char* strdup(const char *s) {
+    if (__builtin_expect(!real_strdup, 0) && !leak_boot()) {
+        char *p = leak_boot_alloc(strlen(s) + 1, 0);
+        return p ? strcpy(p, s) : NULL;
+    }
+    char *ptr = real_strdup(s);
+    if (!LEAK_GUARDED())
+        record_allocation(ptr, ptr ? strlen(ptr) + 1 : 0, LEAK_T_STRDUP, LEAK_CALLER());
+    return ptr;
+}
+
+char* strndup(const char *s, size_t n) {
+    if (__builtin_expect(!real_strndup, 0) && !leak_boot()) {
+        char *p = leak_boot_alloc(strnlen(s, n) + 1, 0);
+        return p ? memcpy(p, s, strnlen(s, n)) : NULL;     /* arena is zeroed */
+    }
+    char *ptr = real_strndup(s, n);
+    if (!LEAK_GUARDED())
+        record_allocation(ptr, ptr ? strnlen(s, n) + 1 : 0, LEAK_T_STRNDUP, LEAK_CALLER());
+    return ptr;
+}
+
+FILE* fopen(const char *pathname, const char *mode) {
+    if (__builtin_expect(!real_fopen, 0) && !leak_boot()) return NULL;
+    FILE *file = real_fopen(pathname, mode);
+    if (!LEAK_GUARDED()) record_allocation(file, 0, LEAK_T_FOPEN, LEAK_CALLER());
+    return file;
+}
+
+int fclose(FILE *stream) {
+    if (__builtin_expect(!real_fclose, 0) && !leak_boot()) return EOF;
+    remove_allocation(stream, NULL);
+    return real_fclose(stream);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+    if (__builtin_expect(!real_aligned_alloc, 0) && !leak_boot())
+        return leak_boot_alloc(size, alignment);
+    void *ptr = real_aligned_alloc(alignment, size);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_ALIGNED_ALLOC, LEAK_CALLER());
+    return ptr;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (__builtin_expect(!real_posix_memalign, 0) && !leak_boot()) {
+        *memptr = leak_boot_alloc(size, alignment);
+        return *memptr ? 0 : ENOMEM;
+    }
+    int result = real_posix_memalign(memptr, alignment, size);
+    if (result == 0 && !LEAK_GUARDED())
+        record_allocation(*memptr, size, LEAK_T_POSIX_MEMALIGN, LEAK_CALLER());
+    return result;
+}
+#endif
+
+#if LEAK_CORE_FDS
+/* ---- file descriptors: one atomic slot write each (leak_fds.h) ---- */
+
+/* only open and close can come before init (from dlsym itself); the rest
+ * fail the way a kernel without them would */
+#define LEAK_FD_BOOT(real)                                   \
+    do {                                                     \
+        if (__builtin_expect(!(real), 0) && !leak_boot()) {  \
+            errno = ENOSYS;                                  \
+            return -1;                                       \
+        }                                                    \
+    } while (0)
+
+static inline mode_t leak_open_mode(int flags, va_list ap) {
+    return (flags & O_CREAT) || (flags & O_TMPFILE) == O_TMPFILE ? va_arg(ap, mode_t) : 0;
+}
+
+int open(const char *path, int flags, ...) {
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = leak_open_mode(flags, ap);
+    va_end(ap);
+    if (__builtin_expect(!real_open, 0) && !leak_boot())
+        return (int)syscall(SYS_openat, AT_FDCWD, path, flags, mode);
+    int fd = real_open(path, flags, mode);
+    record_fd(fd, LEAK_T_OPEN, __builtin_return_address(0));
+    return fd;
+}
+
+int open64(const char *path, int flags, ...) {
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = leak_open_mode(flags, ap);
+    va_end(ap);
+    if (__builtin_expect(!real_open64, 0) && !leak_boot())
+        return (int)syscall(SYS_openat, AT_FDCWD, path, flags | O_LARGEFILE, mode);
+    int fd = real_open64(path, flags, mode);
+    record_fd(fd, LEAK_T_OPEN, __builtin_return_address(0));
+    return fd;
+}
+
+int openat(int dirfd, const char *path, int flags, ...) {
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = leak_open_mode(flags, ap);
+    va_end(ap);
+    if (__builtin_expect(!real_openat, 0) && !leak_boot())
+        return (int)syscall(SYS_openat, dirfd, path, flags, mode);
+    int fd = real_openat(dirfd, path, flags, mode);
+    record_fd(fd, LEAK_T_OPEN, __builtin_return_address(0));
+    return fd;
+}
+
+int openat64(int dirfd, const char *path, int flags, ...) {
+    va_list ap;
+    va_start(ap, flags);
+    mode_t mode = leak_open_mode(flags, ap);
+    va_end(ap);
+    if (__builtin_expect(!real_openat64, 0) && !leak_boot())
+        return (int)syscall(SYS_openat, dirfd, path, flags | O_LARGEFILE, mode);
+    int fd = real_openat64(dirfd, path, flags, mode);
+    record_fd(fd, LEAK_T_OPEN, __builtin_return_address(0));
+    return fd;
+}
+
+int socket(int domain, int type, int protocol) {
+    LEAK_FD_BOOT(real_socket);
+    int fd = real_socket(domain, type, protocol);
+    record_fd(fd, LEAK_T_SOCKET, __builtin_return_address(0));
+    return fd;
+}
+
+int accept(int sockfd, __SOCKADDR_ARG addr, socklen_t *addrlen) {
+    LEAK_FD_BOOT(real_accept);
+    int fd = real_accept(sockfd, addr, addrlen);
+    record_fd(fd, LEAK_T_ACCEPT, __builtin_return_address(0));
+    return fd;
+}
+
+int accept4(int sockfd, __SOCKADDR_ARG addr, socklen_t *addrlen, int flags) {
+    LEAK_FD_BOOT(real_accept4);
+    int fd = real_accept4(sockfd, addr, addrlen, flags);
+    record_fd(fd, LEAK_T_ACCEPT, __builtin_return_address(0));
+    return fd;
+}
+
+int dup(int oldfd) {
+    LEAK_FD_BOOT(real_dup);
+    int fd = real_dup(oldfd);
+    record_fd(fd, LEAK_T_DUP, __builtin_return_address(0));
+    return fd;
+}
+
+/* dup2 and dup3 close `newfd` first if it was open: recording the new
+ * origin replaces the old one */
+int dup2(int oldfd, int newfd) {
+    LEAK_FD_BOOT(real_dup2);
+    int fd = real_dup2(oldfd, newfd);
+    if (fd != oldfd) record_fd(fd, LEAK_T_DUP, __builtin_return_address(0));
+    return fd;
+}
+
+int dup3(int oldfd, int newfd, int flags) {
+    LEAK_FD_BOOT(real_dup3);
+    int fd = real_dup3(oldfd, newfd, flags);
+    record_fd(fd, LEAK_T_DUP, __builtin_return_address(0));
+    return fd;
+}
+
+int pipe(int fds[2]) {
+    LEAK_FD_BOOT(real_pipe);
+    int r = real_pipe(fds);
+    if (r == 0) {
+        record_fd(fds[0], LEAK_T_PIPE, __builtin_return_address(0));
+        record_fd(fds[1], LEAK_T_PIPE, __builtin_return_address(0));
+    }
+    return r;
+}
+
+int pipe2(int fds[2], int flags) {
+    LEAK_FD_BOOT(real_pipe2);
+    int r = real_pipe2(fds, flags);
+    if (r == 0) {
+        record_fd(fds[0], LEAK_T_PIPE, __builtin_return_address(0));
+        record_fd(fds[1], LEAK_T_PIPE, __builtin_return_address(0));
+    }
+    return r;
+}
+
+int eventfd(unsigned int count, int flags) {
+    LEAK_FD_BOOT(real_eventfd);
+    int fd = real_eventfd(count, flags);
+    record_fd(fd, LEAK_T_EVENTFD, __builtin_return_address(0));
+    return fd;
+}
+
+int epoll_create(int size) {
+    LEAK_FD_BOOT(real_epoll_create);
+    int fd = real_epoll_create(size);
+    record_fd(fd, LEAK_T_EPOLL, __builtin_return_address(0));
+    return fd;
+}
+
+int epoll_create1(int flags) {
+    LEAK_FD_BOOT(real_epoll_create1);
+    int fd = real_epoll_create1(flags);
+    record_fd(fd, LEAK_T_EPOLL, __builtin_return_address(0));
+    return fd;
+}
+
+/* the slot is cleared before the descriptor is: see leak_fds_close */
+int close(int fd) {
+    if (__builtin_expect(!real_close, 0) && !leak_boot()) return (int)syscall(SYS_close, fd);
+    remove_fd(fd);
+    return real_close(fd);
+}
+#endif
+
+#if LEAK_CORE_WRAP_CXX
+/* ---- C++ operators ----
+ * Defined under their Itanium C++ ABI names. new takes its block straight
+ * from malloc and records it with operator new's own caller, so the site
+ * is the user's code rather than libstdc++. libstdc++'s operator is only
+ * called for what it alone does: the new_handler loop and bad_alloc once
+ * malloc has failed, and the aligned overloads. delete goes straight to
+ * free, as libstdc++'s does. The library is built with -fexceptions, so a
+ * bad_alloc passes through these frames and restores the guard. */
+
+#if __SIZEOF_SIZE_T__ == 8
+#define LEAK_CXX_SIZE "m"
+#else
+#define LEAK_CXX_SIZE "j"
+#endif
+#define LEAK_CXX_ALIGN "St11align_val_t"
+#define LEAK_CXX_NOTHROW "RKSt9nothrow_t"
+#define LEAK_CXX_UNUSED __attribute__((unused))
+
+/* libstdc++'s operators, looked up on first use: a program that never
+ * loads it never calls ours */
+static void* (*real_new)(size_t) = NULL;
+static void* (*real_new_array)(size_t) = NULL;
+static void* (*real_new_nothrow)(size_t, const void*) = NULL;
+static void* (*real_new_array_nothrow)(size_t, const void*) = NULL;
+static void* (*real_new_aligned)(size_t, size_t) = NULL;
+static void* (*real_new_array_aligned)(size_t, size_t) = NULL;
+static void* (*real_new_aligned_nothrow)(size_t, size_t, const void*) = NULL;
+static void* (*real_new_array_aligned_nothrow)(size_t, size_t, const void*) = NULL;
+
+static void leak_guard_restore(int *saved) {
+    leak_guard = *saved;
+}
+
+/* Call libstdc++'s operator `fn` (mangled `name`) with the guard held, so
+ * the malloc it makes is not recorded as well; the guard is restored even
+ * if it throws. */
+#define LEAK_CXX_NEXT(fn, name, ...) __extension__ ({                           \
+    int leak_saved_ __attribute__((cleanup(leak_guard_restore))) = leak_guard;  \
+    leak_guard = 1;                                                             \
+    __typeof__(fn) f_ = __atomic_load_n(&fn, __ATOMIC_RELAXED);                 \
+    if (!f_) {                                                                  \
+        f_ = (__typeof__(fn))dlsym(RTLD_NEXT, name);                            \
+        __atomic_store_n(&fn, f_, __ATOMIC_RELAXED);                            \
+    }                                                                           \
+    f_ ? f_(__VA_ARGS__) : NULL;                                                \
+})
+
+/* malloc for operator new, which never asks for 0 bytes */
+static inline __attribute__((always_inline)) void *leak_cxx_malloc(size_t size) {
+    if (__builtin_expect(!real_malloc, 0) && !leak_boot()) return leak_boot_alloc(size, 0);
+    return real_malloc(size ? size : 1);
+}
+
+/* Report a release that does not match its block. Not a hot path. */
+static __attribute__((noinline, cold)) void leak_mismatch(const alloc_info_t *a, uint8_t kind,
+                                                          int sized, size_t size,
+                                                          void *caller) {
+    int guard = leak_guard;
+    leak_guard = 1;
+    const char *rel = kind == LEAK_T_NEW         ? "delete"
+                      : kind == LEAK_T_NEW_ARRAY ? "delete[]"
+                                                 : "free";
+    char where[1024];
+    Dl_info info;
+    if (caller && dladdr(caller, &info) && info.dli_fname)
+        snprintf(where, sizeof(where), "0x%lx@%s",
+                 (unsigned long)((uintptr_t)caller - (uintptr_t)info.dli_fbase), info.dli_fname);
+    else
+        snprintf(where, sizeof(where), "%p", caller);
+    if (leak_release_kind(a->type) != kind)
+        fprintf(stderr, "Mismatch: %p allocated by %s, released by %s at %s\n", a->ptr,
+                leak_type_name(a->type), rel, where);
+    else if (sized)
+        fprintf(stderr, "Mismatch: %p of %zu bytes released by sized %s of %zu bytes at %s\n",
+                a->ptr, a->size, rel, size, where);
+    leak_guard = guard;
+}
+
+void *leak_op_new(size_t size) __asm__("_Znw" LEAK_CXX_SIZE);
+void *leak_op_new(size_t size) {
+    void *ptr = leak_cxx_malloc(size);
+    if (__builtin_expect(!ptr, 0)) ptr = LEAK_CXX_NEXT(real_new, "_Znw" LEAK_CXX_SIZE, size);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW, LEAK_CALLER());
+    return ptr;
+}
+
+void *leak_op_new_array(size_t size) __asm__("_Zna" LEAK_CXX_SIZE);
+void *leak_op_new_array(size_t size) {
+    void *ptr = leak_cxx_malloc(size);
+    if (__builtin_expect(!ptr, 0))
+        ptr = LEAK_CXX_NEXT(real_new_array, "_Zna" LEAK_CXX_SIZE, size);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW_ARRAY, LEAK_CALLER());
+    return ptr;
+}
+
+void *leak_op_new_nothrow(size_t size, const void *nt)
+    __asm__("_Znw" LEAK_CXX_SIZE LEAK_CXX_NOTHROW);
+void *leak_op_new_nothrow(size_t size, const void *nt) {
+    void *ptr = leak_cxx_malloc(size);
+    if (__builtin_expect(!ptr, 0))
+        ptr = LEAK_CXX_NEXT(real_new_nothrow, "_Znw" LEAK_CXX_SIZE LEAK_CXX_NOTHROW, size, nt);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW, LEAK_CALLER());
+    return ptr;
+}
+
+void *leak_op_new_array_nothrow(size_t size, const void *nt)
+    __asm__("_Zna" LEAK_CXX_SIZE LEAK_CXX_NOTHROW);
+void *leak_op_new_array_nothrow(size_t size, const void *nt) {
+    void *ptr = leak_cxx_malloc(size);
+    if (__builtin_expect(!ptr, 0))
+        ptr = LEAK_CXX_NEXT(real_new_array_nothrow, "_Zna" LEAK_CXX_SIZE LEAK_CXX_NOTHROW, size,
+                            nt);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW_ARRAY, LEAK_CALLER());
+    return ptr;
+}
+
+void *leak_op_new_aligned(size_t size, size_t align)
+    __asm__("_Znw" LEAK_CXX_SIZE LEAK_CXX_ALIGN);
+void *leak_op_new_aligned(size_t size, size_t align) {
+    if (__builtin_expect(!real_malloc, 0) && !leak_boot()) return leak_boot_alloc(size, align);
+    void *ptr = LEAK_CXX_NEXT(real_new_aligned, "_Znw" LEAK_CXX_SIZE LEAK_CXX_ALIGN, size, align);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW, LEAK_CALLER());
+    return ptr;
+}
+
+void *leak_op_new_array_aligned(size_t size, size_t align)
+    __asm__("_Zna" LEAK_CXX_SIZE LEAK_CXX_ALIGN);
+void *leak_op_new_array_aligned(size_t size, size_t align) {
+    if (__builtin_expect(!real_malloc, 0) && !leak_boot()) return leak_boot_alloc(size, align);
+    void *ptr = LEAK_CXX_NEXT(real_new_array_aligned, "_Zna" LEAK_CXX_SIZE LEAK_CXX_ALIGN, size,
+                              align);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW_ARRAY, LEAK_CALLER());
+    return ptr;
+}
+
+void *leak_op_new_aligned_nothrow(size_t size, size_t align, const void *nt)
+    __asm__("_Znw" LEAK_CXX_SIZE LEAK_CXX_ALIGN LEAK_CXX_NOTHROW);
+void *leak_op_new_aligned_nothrow(size_t size, size_t align, const void *nt) {
+    if (__builtin_expect(!real_malloc, 0) && !leak_boot()) return leak_boot_alloc(size, align);
+    void *ptr = LEAK_CXX_NEXT(real_new_aligned_nothrow,
+                              "_Znw" LEAK_CXX_SIZE LEAK_CXX_ALIGN LEAK_CXX_NOTHROW, size, align,
+                              nt);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW, LEAK_CALLER());
+    return ptr;
+}
+
+void *leak_op_new_array_aligned_nothrow(size_t size, size_t align, const void *nt)
+    __asm__("_Zna" LEAK_CXX_SIZE LEAK_CXX_ALIGN LEAK_CXX_NOTHROW);
+void *leak_op_new_array_aligned_nothrow(size_t size, size_t align, const void *nt) {
+    if (__builtin_expect(!real_malloc, 0) && !leak_boot()) return leak_boot_alloc(size, align);
+    void *ptr = LEAK_CXX_NEXT(real_new_array_aligned_nothrow,
+                              "_Zna" LEAK_CXX_SIZE LEAK_CXX_ALIGN LEAK_CXX_NOTHROW, size, align,
+                              nt);
+    if (!LEAK_GUARDED()) record_allocation(ptr, size, LEAK_T_NEW_ARRAY, LEAK_CALLER());
+    return ptr;
+}
+
+/* every delete overload: plain, sized, aligned and nothrow. The size sized
+ * delete is given is checked against the record instead of being looked
+ * up. */
+#define LEAK_CXX_DELETE(fn, mangled, kind, sized, size, ...)                     \
+    void fn(void *ptr, ##__VA_ARGS__) __asm__(mangled);                          \
+    void fn(void *ptr, ##__VA_ARGS__) {                                          \
+        leak_release(ptr, kind, sized, size, __builtin_return_address(0));       \
+    }
+
+LEAK_CXX_DELETE(leak_op_delete, "_ZdlPv", LEAK_T_NEW, 0, 0)
+LEAK_CXX_DELETE(leak_op_delete_array, "_ZdaPv", LEAK_T_NEW_ARRAY, 0, 0)
+LEAK_CXX_DELETE(leak_op_delete_sized, "_ZdlPv" LEAK_CXX_SIZE, LEAK_T_NEW, 1, size, size_t size)
+LEAK_CXX_DELETE(leak_op_delete_array_sized, "_ZdaPv" LEAK_CXX_SIZE, LEAK_T_NEW_ARRAY, 1, size,
+                size_t size)
+LEAK_CXX_DELETE(leak_op_delete_nothrow, "_ZdlPv" LEAK_CXX_NOTHROW, LEAK_T_NEW, 0, 0,
+                const void *nt LEAK_CXX_UNUSED)
+LEAK_CXX_DELETE(leak_op_delete_array_nothrow, "_ZdaPv" LEAK_CXX_NOTHROW, LEAK_T_NEW_ARRAY, 0, 0,
+                const void *nt LEAK_CXX_UNUSED)
+LEAK_CXX_DELETE(leak_op_delete_aligned, "_ZdlPv" LEAK_CXX_ALIGN, LEAK_T_NEW, 0, 0,
+                size_t align LEAK_CXX_UNUSED)
+LEAK_CXX_DELETE(leak_op_delete_array_aligned, "_ZdaPv" LEAK_CXX_ALIGN, LEAK_T_NEW_ARRAY, 0, 0,
+                size_t align LEAK_CXX_UNUSED)
+LEAK_CXX_DELETE(leak_op_delete_sized_aligned, "_ZdlPv" LEAK_CXX_SIZE LEAK_CXX_ALIGN, LEAK_T_NEW,
+                1, size, size_t size, size_t align LEAK_CXX_UNUSED)
+LEAK_CXX_DELETE(leak_op_delete_array_sized_aligned, "_ZdaPv" LEAK_CXX_SIZE LEAK_CXX_ALIGN,
+                LEAK_T_NEW_ARRAY, 1, size, size_t size, size_t align LEAK_CXX_UNUSED)
+LEAK_CXX_DELETE(leak_op_delete_aligned_nothrow, "_ZdlPv" LEAK_CXX_ALIGN LEAK_CXX_NOTHROW,
+                LEAK_T_NEW, 0, 0, size_t align LEAK_CXX_UNUSED,
+                const void *nt LEAK_CXX_UNUSED)
+LEAK_CXX_DELETE(leak_op_delete_array_aligned_nothrow,
+                "_ZdaPv" LEAK_CXX_ALIGN LEAK_CXX_NOTHROW, LEAK_T_NEW_ARRAY, 0, 0,
+                size_t align LEAK_CXX_UNUSED, const void *nt LEAK_CXX_UNUSED)
+#endif
+
+#endif /* LEAK_CORE_H */
@@ -0,0 +1,227 @@
+/* leak_depot.h
+ * Stack depot: an append-only, hash-consed store of unique backtraces.
+ *
+ * A few hundred call sites produce almost all allocations, so records keep
+ * a 32-bit stack id instead of their own copy of the frames. Lookups walk
+ * a bucket chain with acquire loads and take no lock, so a hit costs one
+ * hash and one compare. Misses take the depot lock, re-check and append
+ * a new entry; entries are never moved or freed once published and never
+ * written afterwards. Id 0 means "no stack".
+ *
+ * The per-stack allocation counters (for pprof's alloc_* values) live
+ * apart from the entries, in chunks mapped on first use, each stack's on
+ * its own cache line: threads counting blocks from one stack do not
+ * contend on the line that every lookup of that stack reads.
+ *
+ * A new entry also records the module each frame was in when it was first
+ * seen (leak_modules.h), so a report can name a library that has been
+ * dlclose'd since, and needs no loader lookups of its own.
+ */
+#ifndef LEAK_DEPOT_H
+#define LEAK_DEPOT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "leak_common.h"
+#include "leak_arena.h"
+#include "leak_modules.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_DEPOT_BUCKET_BITS 18
+#define LEAK_DEPOT_CHUNK_BITS 12            /* ids per directory chunk */
+#define LEAK_DEPOT_CHUNKS 4096              /* up to 16M unique stacks */
+#define LEAK_DEPOT_SLAB (1024 * 1024)
+
+typedef struct {
+    uint32_t next;      /* next id in the bucket chain */
+    uint32_t hash;
+    uint32_t depth;
+    uint32_t reserved;
+    void *frames[];     /* then uint32_t modules[depth], see leak_stack_modules */
+} leak_stack_t;
+
+typedef struct {
+    uint64_t allocs;    /* blocks ever recorded from the stack */
+    uint64_t bytes;     /* their bytes */
+    uint64_t est;       /* bytes scaled back up in sampling mode */
+} __attribute__((aligned(64))) leak_stack_counts_t;
+
+/* Function: leak_stack_modules
+ * Module id of each frame of `s` (0: in no loaded module).
+ */
+static inline const uint32_t *leak_stack_modules(const leak_stack_t *s) {
+    return (const uint32_t *)&s->frames[s->depth];
+}
+
+typedef struct {
+    leak_lock_t lock;
+    uint32_t count;                         /* ids handed out so far */
+    uint32_t dropped;                       /* stacks lost to a full depot */
+    char *cur;                              /* bump pointer for entries */
+    char *end;
+    uint32_t buckets[1 << LEAK_DEPOT_BUCKET_BITS];
+    leak_stack_t **dir[LEAK_DEPOT_CHUNKS];
+    leak_stack_counts_t *counts[LEAK_DEPOT_CHUNKS];
+} leak_depot_t;
+
+static leak_depot_t leak_depot;
+
+static inline uint32_t leak_depot_hash(void *const *frames, int depth) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ (uint64_t)depth;
+    for (int i = 0; i < depth; ++i) {
+        h ^= (uint64_t)(uintptr_t)frames[i];
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 32;
+    }
+    return (uint32_t)h;
+}
+
+/* Function: leak_depot_get
+ * Returns the stack for `id`, or NULL for id 0 / unknown ids.
+ */
+static inline const leak_stack_t *leak_depot_get(uint32_t id) {
+    if (id == 0 || id > __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE)) return NULL;
+    leak_stack_t **chunk = __atomic_load_n(&leak_depot.dir[id >> LEAK_DEPOT_CHUNK_BITS],
+                                           __ATOMIC_ACQUIRE);
+    return chunk ? chunk[id & ((1u << LEAK_DEPOT_CHUNK_BITS) - 1)] : NULL;
+}
+
+static inline uint32_t leak_depot_find(uint32_t head, uint32_t hash,
+                                       void *const *frames, int depth) {
+    for (uint32_t id = head; id; ) {
+        const leak_stack_t *s = leak_depot_get(id);
+        if (!s) break;
+        if (s->hash == hash && s->depth == (uint32_t)depth &&
+            memcmp(s->frames, frames, depth * sizeof(void *)) == 0)
+            return id;
+        id = s->next;
+    }
+    return 0;
+}
+
+/* Function: leak_depot_put
+ * Intern a backtrace and return its id (0 if depth is 0 or the depot is
+ * out of ids or memory). Identical stacks always get the same id.
+ */
+static inline uint32_t leak_depot_put(void *const *frames, int depth) {
+    if (depth <= 0) return 0;
+    leak_depot_t *d = &leak_depot;
+    uint32_t hash = leak_depot_hash(frames, depth);
+    uint32_t *bucket = &d->buckets[hash & ((1u << LEAK_DEPOT_BUCKET_BITS) - 1)];
+
+    uint32_t id = leak_depot_find(__atomic_load_n(bucket, __ATOMIC_ACQUIRE), hash, frames, depth);
+    if (id) return id;
+
+    /* resolved before taking the lock: a refresh calls into the loader */
+    uint32_t modules[depth];
+    leak_modules_resolve(frames, modules, depth);
+
+    leak_lock(&d->lock);
+    uint32_t head = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+    id = leak_depot_find(head, hash, frames, depth);
+    if (id) goto out;
+
+    uint32_t next_id = d->count + 1;
+    size_t chunk_i = next_id >> LEAK_DEPOT_CHUNK_BITS;
+    size_t size = sizeof(leak_stack_t) + depth * sizeof(void *) +
+                  ((depth * sizeof(uint32_t) + 7) & ~(size_t)7);
+    if (chunk_i >= LEAK_DEPOT_CHUNKS) goto fail;
+    if (!d->dir[chunk_i]) {
+        leak_stack_t **chunk = leak_pages_alloc(sizeof(leak_stack_t *) << LEAK_DEPOT_CHUNK_BITS);
+        if (!chunk) goto fail;
+        __atomic_store_n(&d->dir[chunk_i], chunk, __ATOMIC_RELEASE);
+    }
+    if (!d->cur || (size_t)(d->end - d->cur) < size) {
+        char *slab = leak_pages_alloc(LEAK_DEPOT_SLAB);
+        if (!slab) goto fail;
+        d->cur = slab;
+        d->end = slab + LEAK_DEPOT_SLAB;
+    }
+
+    leak_stack_t *s = (leak_stack_t *)d->cur;
+    d->cur += size;
+    s->next = head;
+    s->hash = hash;
+    s->depth = (uint32_t)depth;
+    memcpy(s->frames, frames, depth * sizeof(void *));
+    memcpy((uint32_t *)leak_stack_modules(s), modules, depth * sizeof(uint32_t));
+    d->dir[chunk_i][next_id & ((1u << LEAK_DEPOT_CHUNK_BITS) - 1)] = s;
+    /* publish: the entry is complete before its id becomes visible */
+    __atomic_store_n(&d->count, next_id, __ATOMIC_RELEASE);
+    __atomic_store_n(bucket, next_id, __ATOMIC_RELEASE);
+    id = next_id;
+    goto out;
+fail:
+    d->dropped++;
+out:
+    leak_unlock(&d->lock);
+    return id;
+}
+
+/* Function: leak_stack_skip_self
+ * How many leading frames of `s` are in the detector itself (the
+ * unwinder, the interposed function), so that output made from a stack
+ * can start at the allocating code.
+ */
+static inline uint32_t leak_stack_skip_self(const leak_stack_t *s) {
+    uint32_t self = leak_module_of((uintptr_t)&leak_depot_put);
+    const uint32_t *ids = leak_stack_modules(s);
+    uint32_t j = 0;
+    while (self && j < s->depth && ids[j] == self) j++;
+    return j;
+}
+
+/* Function: leak_depot_counts
+ * The allocation counters of stack `id`, or NULL if nothing was counted
+ * for it or its neighbours yet.
+ */
+static inline const leak_stack_counts_t *leak_depot_counts(uint32_t id) {
+    if (id == 0 || id > __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE)) return NULL;
+    leak_stack_counts_t *chunk = __atomic_load_n(&leak_depot.counts[id >> LEAK_DEPOT_CHUNK_BITS],
+                                                 __ATOMIC_ACQUIRE);
+    return chunk ? &chunk[id & ((1u << LEAK_DEPOT_CHUNK_BITS) - 1)] : NULL;
+}
+
+/* Function: leak_depot_account
+ * Count one more block of `size` bytes (standing for `est` bytes when
+ * sampled) allocated from stack `id`; cumulative, frees do not subtract.
+ */
+static inline void leak_depot_account(uint32_t id, size_t size, double est) {
+    if (id == 0 || id > __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE)) return;
+    leak_stack_counts_t **slot = &leak_depot.counts[id >> LEAK_DEPOT_CHUNK_BITS];
+    leak_stack_counts_t *chunk = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!chunk, 0)) {
+        size_t len = sizeof(leak_stack_counts_t) << LEAK_DEPOT_CHUNK_BITS;
+        leak_stack_counts_t *fresh = leak_pages_alloc(len);
+        if (!fresh) return;
+        if (__atomic_compare_exchange_n(slot, &chunk, fresh, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            chunk = fresh;
+        else
+            leak_pages_free(fresh, len);
+    }
+    leak_stack_counts_t *c = &chunk[id & ((1u << LEAK_DEPOT_CHUNK_BITS) - 1)];
+    __atomic_fetch_add(&c->allocs, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->bytes, size, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&c->est, (uint64_t)(est + 0.5), __ATOMIC_RELAXED);
+}
+
+/* Function: leak_depot_clear_counts
+ * Zero every stack's allocation counters (the stacks themselves stay),
+ * for a child after fork() that starts counting afresh.
+ */
+static inline void leak_depot_clear_counts(void) {
+    for (size_t i = 0; i < LEAK_DEPOT_CHUNKS; ++i)
+        if (leak_depot.counts[i])
+            memset(leak_depot.counts[i], 0, sizeof(leak_stack_counts_t) << LEAK_DEPOT_CHUNK_BITS);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_DEPOT_H */
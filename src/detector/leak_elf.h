@@ -0,0 +1,597 @@
+/* leak_elf.h
+ * Minimal in-process symbolizer: ELF symbol tables and DWARF .debug_line
+ * (versions 2-5), read from mmap'd files without spawning addr2line.
+ *
+ * leak_elf_open() loads one binary; leak_elf_lookup() then maps a link-time
+ * address to function, file and line. Separate debug files are found via
+ * the build-id (/usr/lib/debug/.build-id/xx/yyyy.debug) or .gnu_debuglink.
+ * Compressed debug sections are not supported; such binaries resolve to
+ * symbol names only. Only 64-bit little-endian ELF is handled.
+ *
+ * A loaded leak_elf_t is read-only, so lookups may run from many threads.
+ */
+#ifndef LEAK_ELF_H
+#define LEAK_ELF_H
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint64_t lo, size;
+    const char *name;
+    int bind;
+} leak_sym_t;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t file;          /* index into files, UINT32_MAX ends a sequence */
+    uint32_t line;
+    uint32_t order;         /* keeps rows at the same address in program order */
+} leak_line_row_t;
+
+typedef struct {
+    const char *map;        /* the binary itself */
+    size_t map_len;
+    const char *dbg;        /* separate debug file, if any */
+    size_t dbg_len;
+    uint64_t base_vaddr;    /* page-aligned vaddr of the first PT_LOAD */
+    char build_id[41];      /* hex, empty if none */
+
+    leak_sym_t *syms;
+    size_t nsyms;
+    leak_line_row_t *rows;
+    size_t nrows;
+    char **files;
+    size_t nfiles;
+} leak_elf_t;
+
+/* ---- raw file access ---- */
+
+static inline const char *leak_elf_map(const char *path, size_t *len) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return NULL;
+    struct stat st;
+    const char *p = NULL;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(Elf64_Ehdr)) {
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p == MAP_FAILED) p = NULL;
+        else *len = (size_t)st.st_size;
+    }
+    close(fd);
+    if (p && (memcmp(p, ELFMAG, SELFMAG) != 0 || p[EI_CLASS] != ELFCLASS64 ||
+              p[EI_DATA] != ELFDATA2LSB)) {
+        munmap((void *)p, *len);
+        p = NULL;
+    }
+    return p;
+}
+
+static inline const Elf64_Shdr *leak_elf_shdrs(const char *m, size_t len, size_t *n) {
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)m;
+    *n = 0;
+    if (!eh->e_shoff || eh->e_shentsize != sizeof(Elf64_Shdr) ||
+        eh->e_shoff + (uint64_t)eh->e_shnum * sizeof(Elf64_Shdr) > len)
+        return NULL;
+    *n = eh->e_shnum;
+    return (const Elf64_Shdr *)(m + eh->e_shoff);
+}
+
+/* Find a section by name; returns its bytes (NULL if absent or NOBITS). */
+static inline const char *leak_elf_section(const char *m, size_t len, const char *name,
+                                           size_t *size) {
+    size_t n;
+    const Elf64_Shdr *sh = leak_elf_shdrs(m, len, &n);
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)m;
+    if (!sh || eh->e_shstrndx >= n) return NULL;
+    const Elf64_Shdr *strs = &sh[eh->e_shstrndx];
+    if (strs->sh_offset + strs->sh_size > len) return NULL;
+    for (size_t i = 0; i < n; ++i) {
+        if (sh[i].sh_name >= strs->sh_size) continue;
+        if (strcmp(m + strs->sh_offset + sh[i].sh_name, name) != 0) continue;
+        if (sh[i].sh_type == SHT_NOBITS || sh[i].sh_offset + sh[i].sh_size > len) return NULL;
+        if (sh[i].sh_flags & SHF_COMPRESSED) return NULL;
+        *size = sh[i].sh_size;
+        return m + sh[i].sh_offset;
+    }
+    return NULL;
+}
+
+static inline void leak_elf_read_build_id(const char *m, size_t len, char out[41]) {
+    size_t size;
+    const char *p = leak_elf_section(m, len, ".note.gnu.build-id", &size);
+    out[0] = '\0';
+    if (!p || size < 12) return;
+    const Elf64_Nhdr *nh = (const Elf64_Nhdr *)p;
+    size_t name_sz = (nh->n_namesz + 3) & ~3u;
+    if (nh->n_type != NT_GNU_BUILD_ID || 12 + name_sz + nh->n_descsz > size) return;
+    const unsigned char *d = (const unsigned char *)p + 12 + name_sz;
+    size_t n = nh->n_descsz > 20 ? 20 : nh->n_descsz;
+    for (size_t i = 0; i < n; ++i) snprintf(out + 2 * i, 3, "%02x", d[i]);
+}
+
+/* ---- symbols ---- */
+
+static int leak_sym_cmp(const void *x, const void *y) {
+    const leak_sym_t *a = x, *b = y;
+    if (a->lo != b->lo) return a->lo < b->lo ? -1 : 1;
+    /* for aliases prefer exported names, then sized ones, then the one
+     * with fewer leading underscores (puts over _IO_puts) */
+    int la = a->bind == STB_LOCAL, lb = b->bind == STB_LOCAL;
+    if (la != lb) return la - lb;
+    if ((a->size == 0) != (b->size == 0)) return (a->size == 0) - (b->size == 0);
+    size_t ua = strspn(a->name, "_"), ub = strspn(b->name, "_");
+    if (ua != ub) return ua < ub ? -1 : 1;
+    return strcmp(a->name, b->name);
+}
+
+static inline void leak_elf_load_syms(leak_elf_t *e, const char *m, size_t len) {
+    size_t n;
+    const Elf64_Shdr *sh = leak_elf_shdrs(m, len, &n);
+    const Elf64_Shdr *tab = NULL;
+    for (size_t i = 0; sh && i < n; ++i)
+        if (sh[i].sh_type == SHT_SYMTAB) tab = &sh[i];
+    for (size_t i = 0; sh && !tab && i < n; ++i)
+        if (sh[i].sh_type == SHT_DYNSYM) tab = &sh[i];
+    if (!tab || tab->sh_link >= n || tab->sh_offset + tab->sh_size > len) return;
+    const Elf64_Shdr *str = &sh[tab->sh_link];
+    if (str->sh_offset + str->sh_size > len) return;
+
+    const Elf64_Sym *s = (const Elf64_Sym *)(m + tab->sh_offset);
+    size_t count = tab->sh_size / sizeof(Elf64_Sym);
+    leak_sym_t *out = malloc((count + 1) * sizeof(*out));
+    if (!out) return;
+    size_t k = 0;
+    for (size_t i = 0; i < count; ++i) {
+        int type = ELF64_ST_TYPE(s[i].st_info);
+        if (type != STT_FUNC && type != STT_GNU_IFUNC) continue;
+        if (s[i].st_shndx == SHN_UNDEF || !s[i].st_value || s[i].st_name >= str->sh_size)
+            continue;
+        out[k].lo = s[i].st_value;
+        out[k].size = s[i].st_size;
+        out[k].name = m + str->sh_offset + s[i].st_name;
+        out[k].bind = ELF64_ST_BIND(s[i].st_info);
+        k++;
+    }
+    qsort(out, k, sizeof(*out), leak_sym_cmp);
+    /* keep one name per address */
+    size_t u = 0;
+    for (size_t i = 0; i < k; ++i)
+        if (!u || out[u - 1].lo != out[i].lo) out[u++] = out[i];
+    e->syms = out;
+    e->nsyms = u;
+}
+
+static inline const char *leak_elf_symbol(const leak_elf_t *e, uint64_t addr) {
+    size_t lo = 0, hi = e->nsyms;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (e->syms[mid].lo <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (!lo) return NULL;
+    const leak_sym_t *s = &e->syms[lo - 1];
+    if (s->size ? addr < s->lo + s->size : lo < e->nsyms) return s->name;
+    return NULL;
+}
+
+/* ---- DWARF .debug_line ---- */
+
+typedef struct {
+    const uint8_t *p, *end;
+    int err;
+} leak_dw_cur_t;
+
+static inline uint64_t leak_dw_fixed(leak_dw_cur_t *c, int n) {
+    if (c->err || c->end - c->p < n) {
+        c->err = 1;
+        return 0;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < n; ++i) v |= (uint64_t)c->p[i] << (8 * i);
+    c->p += n;
+    return v;
+}
+
+static inline uint64_t leak_dw_uleb(leak_dw_cur_t *c) {
+    uint64_t v = 0;
+    int shift = 0;
+    while (!c->err) {
+        if (c->p >= c->end) { c->err = 1; break; }
+        uint8_t b = *c->p++;
+        if (shift < 64) v |= (uint64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) break;
+    }
+    return v;
+}
+
+static inline int64_t leak_dw_sleb(leak_dw_cur_t *c) {
+    int64_t v = 0;
+    int shift = 0;
+    uint8_t b = 0;
+    while (!c->err) {
+        if (c->p >= c->end) { c->err = 1; break; }
+        b = *c->p++;
+        if (shift < 64) v |= (int64_t)(b & 0x7f) << shift;
+        shift += 7;
+        if (!(b & 0x80)) break;
+    }
+    if (shift < 64 && (b & 0x40)) v |= -((int64_t)1 << shift);
+    return v;
+}
+
+static inline const char *leak_dw_cstr(leak_dw_cur_t *c) {
+    const uint8_t *s = c->p;
+    while (c->p < c->end && *c->p) c->p++;
+    if (c->p >= c->end) {
+        c->err = 1;
+        return "";
+    }
+    c->p++;
+    return (const char *)s;
+}
+
+typedef struct {
+    leak_elf_t *e;
+    const char *line_str;       /* .debug_line_str */
+    size_t line_str_len;
+    const char *str;            /* .debug_str */
+    size_t str_len;
+    size_t cap_rows, cap_files;
+    uint32_t order;
+} leak_dw_ctx_t;
+
+static inline const char *leak_dw_strp(const char *sec, size_t len, uint64_t off) {
+    if (!sec || off >= len || !memchr(sec + off, 0, len - off)) return "";
+    return sec + off;
+}
+
+/* Read one attribute of a v5 directory/file entry. Strings come back in
+ * *s, numbers in *v. Returns 0 for forms a line table cannot use. */
+static inline int leak_dw_form(leak_dw_ctx_t *x, leak_dw_cur_t *c, uint64_t form, int off_size,
+                               const char **s, uint64_t *v) {
+    *s = NULL;
+    *v = 0;
+    switch (form) {
+    case 0x08: *s = leak_dw_cstr(c); break;                                     /* string */
+    case 0x1f: *s = leak_dw_strp(x->line_str, x->line_str_len, leak_dw_fixed(c, off_size)); break;
+    case 0x0e: *s = leak_dw_strp(x->str, x->str_len, leak_dw_fixed(c, off_size)); break;
+    case 0x0f: *v = leak_dw_uleb(c); break;                                     /* udata */
+    case 0x0b: *v = leak_dw_fixed(c, 1); break;                                 /* data1 */
+    case 0x05: *v = leak_dw_fixed(c, 2); break;                                 /* data2 */
+    case 0x06: *v = leak_dw_fixed(c, 4); break;                                 /* data4 */
+    case 0x07: *v = leak_dw_fixed(c, 8); break;                                 /* data8 */
+    case 0x1e: leak_dw_fixed(c, 8); leak_dw_fixed(c, 8); break;                 /* data16 */
+    case 0x09: {                                                                /* block */
+        uint64_t n = leak_dw_uleb(c);
+        if ((uint64_t)(c->end - c->p) < n) c->err = 1;
+        else c->p += n;
+        break;
+    }
+    default: return 0;
+    }
+    return !c->err;
+}
+
+static inline uint32_t leak_dw_add_file(leak_dw_ctx_t *x, const char *dir, const char *name) {
+    leak_elf_t *e = x->e;
+    if (e->nfiles == x->cap_files) {
+        size_t cap = x->cap_files ? x->cap_files * 2 : 64;
+        char **f = realloc(e->files, cap * sizeof(*f));
+        if (!f) return UINT32_MAX;
+        e->files = f;
+        x->cap_files = cap;
+    }
+    size_t dl = (dir && name[0] != '/') ? strlen(dir) : 0;
+    char *p = malloc(dl + strlen(name) + 2);
+    if (!p) return UINT32_MAX;
+    if (dl) sprintf(p, "%s/%s", dir, name);
+    else strcpy(p, name);
+    e->files[e->nfiles] = p;
+    return (uint32_t)e->nfiles++;
+}
+
+static inline void leak_dw_add_row(leak_dw_ctx_t *x, uint64_t addr, uint32_t file, uint32_t line) {
+    leak_elf_t *e = x->e;
+    if (e->nrows == x->cap_rows) {
+        size_t cap = x->cap_rows ? x->cap_rows * 2 : 1024;
+        leak_line_row_t *r = realloc(e->rows, cap * sizeof(*r));
+        if (!r) return;
+        e->rows = r;
+        x->cap_rows = cap;
+    }
+    leak_line_row_t *r = &e->rows[e->nrows++];
+    r->addr = addr;
+    r->file = file;
+    r->line = line;
+    r->order = x->order++;
+}
+
+/* Parse one line-number program; returns the offset of the next unit or 0. */
+static inline size_t leak_dw_unit(leak_dw_ctx_t *x, const uint8_t *sec, size_t len, size_t off) {
+    leak_dw_cur_t c = { sec + off, sec + len, 0 };
+    int off_size = 4;
+    uint64_t unit_len = leak_dw_fixed(&c, 4);
+    if (unit_len == 0xffffffffu) {
+        off_size = 8;
+        unit_len = leak_dw_fixed(&c, 8);
+    }
+    if (c.err || unit_len > (uint64_t)(c.end - c.p)) return 0;
+    size_t next = (size_t)(c.p - sec) + unit_len;
+    c.end = c.p + unit_len;
+
+    int version = (int)leak_dw_fixed(&c, 2);
+    if (version < 2 || version > 5) return next;
+    int addr_size = 8;
+    if (version >= 5) {
+        addr_size = (int)leak_dw_fixed(&c, 1);
+        leak_dw_fixed(&c, 1);                   /* segment selector size */
+    }
+    uint64_t header_len = leak_dw_fixed(&c, off_size);
+    if (c.err || header_len > (uint64_t)(c.end - c.p)) return next;
+    const uint8_t *prog = c.p + header_len;
+    unsigned min_inst = (unsigned)leak_dw_fixed(&c, 1);
+    if (version >= 4) leak_dw_fixed(&c, 1);     /* max ops per instruction (VLIW only) */
+    int default_is_stmt = (int)leak_dw_fixed(&c, 1);
+    int line_base = (int8_t)leak_dw_fixed(&c, 1);
+    unsigned line_range = (unsigned)leak_dw_fixed(&c, 1);
+    unsigned opcode_base = (unsigned)leak_dw_fixed(&c, 1);
+    uint8_t std_len[256];
+    for (unsigned i = 1; i < opcode_base; ++i) std_len[i] = (uint8_t)leak_dw_fixed(&c, 1);
+    if (c.err || !line_range || !opcode_base) return next;
+    (void)default_is_stmt;
+
+    /* file table, mapped to global file ids */
+    enum { MAX_DIRS = 1024, MAX_FILES = 4096 };
+    const char *dirs[MAX_DIRS];
+    size_t ndirs = 0;
+    uint32_t files[MAX_FILES];
+    size_t nfiles = 0;
+    if (version >= 5) {
+        uint64_t fmt[2][32][2];
+        for (int pass = 0; pass < 2 && !c.err; ++pass) {
+            unsigned nfmt = (unsigned)leak_dw_fixed(&c, 1);
+            if (nfmt > 32) return next;
+            for (unsigned i = 0; i < nfmt; ++i) {
+                fmt[pass][i][0] = leak_dw_uleb(&c);
+                fmt[pass][i][1] = leak_dw_uleb(&c);
+            }
+            uint64_t count = leak_dw_uleb(&c);
+            for (uint64_t k = 0; k < count && !c.err; ++k) {
+                const char *path = "";
+                uint64_t dir = 0;
+                for (unsigned i = 0; i < nfmt; ++i) {
+                    const char *s;
+                    uint64_t v;
+                    if (!leak_dw_form(x, &c, fmt[pass][i][1], off_size, &s, &v)) return next;
+                    if (fmt[pass][i][0] == 1 && s) path = s;        /* DW_LNCT_path */
+                    if (fmt[pass][i][0] == 2) dir = v;              /* DW_LNCT_directory_index */
+                }
+                if (pass == 0) {
+                    if (ndirs < MAX_DIRS) dirs[ndirs++] = path;
+                } else if (nfiles < MAX_FILES) {
+                    const char *d = dir < ndirs ? dirs[dir] : NULL;
+                    char joined[4096];
+                    /* relative directories hang off the compilation dir (entry 0) */
+                    if (d && dir > 0 && d[0] != '/' && ndirs > 0) {
+                        snprintf(joined, sizeof(joined), "%s/%s", dirs[0], d);
+                        d = joined;
+                    }
+                    files[nfiles++] = leak_dw_add_file(x, d, path);
+                }
+            }
+        }
+    } else {
+        dirs[ndirs++] = NULL;                   /* 0: compilation dir, unknown here */
+        for (;;) {
+            const char *d = leak_dw_cstr(&c);
+            if (c.err || !d[0]) break;
+            if (ndirs < MAX_DIRS) dirs[ndirs++] = d;
+        }
+        files[nfiles++] = UINT32_MAX;           /* file numbers start at 1 */
+        for (;;) {
+            const char *name = leak_dw_cstr(&c);
+            if (c.err || !name[0]) break;
+            uint64_t dir = leak_dw_uleb(&c);
+            leak_dw_uleb(&c);
+            leak_dw_uleb(&c);
+            if (nfiles < MAX_FILES)
+                files[nfiles++] = leak_dw_add_file(x, dir < ndirs ? dirs[dir] : NULL, name);
+        }
+    }
+    if (c.err) return next;
+
+    /* state machine */
+    c.p = prog;
+    uint64_t addr = 0;
+    uint64_t file = 1, line = 1;
+    #define LEAK_DW_FILE(f) ((f) < nfiles ? files[f] : UINT32_MAX)
+    while (c.p < c.end && !c.err) {
+        unsigned op = *c.p++;
+        if (op >= opcode_base) {
+            unsigned adj = op - opcode_base;
+            addr += (uint64_t)(adj / line_range) * min_inst;
+            line += line_base + (int)(adj % line_range);
+            leak_dw_add_row(x, addr, LEAK_DW_FILE(file), (uint32_t)line);
+            continue;
+        }
+        switch (op) {
+        case 0: {
+            uint64_t n = leak_dw_uleb(&c);
+            if (c.err || !n || n > (uint64_t)(c.end - c.p)) { c.err = 1; break; }
+            const uint8_t *ext_end = c.p + n;
+            unsigned sub = *c.p++;
+            if (sub == 1) {                     /* end_sequence */
+                leak_dw_add_row(x, addr, UINT32_MAX, 0);
+                addr = 0;
+                file = 1;
+                line = 1;
+            } else if (sub == 2) {              /* set_address */
+                addr = leak_dw_fixed(&c, (int)(n - 1) < addr_size ? (int)(n - 1) : addr_size);
+            }
+            c.p = ext_end;                      /* define_file, discriminator, vendor */
+            break;
+        }
+        case 1: leak_dw_add_row(x, addr, LEAK_DW_FILE(file), (uint32_t)line); break;
+        case 2: addr += leak_dw_uleb(&c) * min_inst; break;
+        case 3: line += leak_dw_sleb(&c); break;
+        case 4: file = leak_dw_uleb(&c); break;
+        case 8: addr += (uint64_t)((255 - opcode_base) / line_range) * min_inst; break;
+        case 9: addr += leak_dw_fixed(&c, 2); break;
+        default:
+            for (unsigned i = 0; i < std_len[op]; ++i) leak_dw_uleb(&c);
+            break;
+        }
+    }
+    #undef LEAK_DW_FILE
+    return next;
+}
+
+static int leak_row_cmp(const void *x, const void *y) {
+    const leak_line_row_t *a = x, *b = y;
+    if (a->addr != b->addr) return a->addr < b->addr ? -1 : 1;
+    /* a sequence end sorts before a sequence starting at the same address */
+    int ea = a->file == UINT32_MAX && !a->line, eb = b->file == UINT32_MAX && !b->line;
+    if (ea != eb) return eb - ea;
+    return a->order < b->order ? -1 : a->order > b->order;
+}
+
+static inline void leak_elf_load_lines(leak_elf_t *e, const char *m, size_t len) {
+    size_t size;
+    const char *sec = leak_elf_section(m, len, ".debug_line", &size);
+    if (!sec) return;
+    leak_dw_ctx_t x;
+    memset(&x, 0, sizeof(x));
+    x.e = e;
+    x.line_str = leak_elf_section(m, len, ".debug_line_str", &x.line_str_len);
+    x.str = leak_elf_section(m, len, ".debug_str", &x.str_len);
+    size_t off = 0;
+    while (off < size) {
+        size_t next = leak_dw_unit(&x, (const uint8_t *)sec, size, off);
+        if (next <= off) break;
+        off = next;
+    }
+    qsort(e->rows, e->nrows, sizeof(*e->rows), leak_row_cmp);
+}
+
+/* ---- separate debug info ---- */
+
+static inline const char *leak_elf_find_debug(const char *path, const char *m, size_t len,
+                                              const char *build_id, size_t *dbg_len) {
+    char buf[4096];
+    const char *d;
+    if (build_id[0] && build_id[1]) {
+        snprintf(buf, sizeof(buf), "/usr/lib/debug/.build-id/%.2s/%s.debug", build_id, build_id + 2);
+        if ((d = leak_elf_map(buf, dbg_len))) return d;
+    }
+    size_t size;
+    const char *link = leak_elf_section(m, len, ".gnu_debuglink", &size);
+    if (!link || !memchr(link, 0, size)) return NULL;
+    const char *slash = strrchr(path, '/');
+    int dl = slash ? (int)(slash - path) : 1;
+    const char *dir = slash ? path : ".";
+    static const char *const fmts[] = { "%.*s/%s", "%.*s/.debug/%s", "/usr/lib/debug%.*s/%s" };
+    for (int i = 0; i < 3; ++i) {
+        snprintf(buf, sizeof(buf), fmts[i], dl, dir, link);
+        if (strcmp(buf, path) == 0) continue;
+        if ((d = leak_elf_map(buf, dbg_len))) return d;
+    }
+    return NULL;
+}
+
+/* Function: leak_elf_probe
+ * Map `path` and read only its load base and build-id, which is enough to
+ * consult a symbol cache. Returns 0 if the file is not a readable 64-bit
+ * ELF.
+ */
+static inline int leak_elf_probe(leak_elf_t *e, const char *path) {
+    memset(e, 0, sizeof(*e));
+    e->map = leak_elf_map(path, &e->map_len);
+    if (!e->map) return 0;
+
+    const Elf64_Ehdr *eh = (const Elf64_Ehdr *)e->map;
+    if (eh->e_phoff + (uint64_t)eh->e_phnum * sizeof(Elf64_Phdr) <= e->map_len) {
+        const Elf64_Phdr *ph = (const Elf64_Phdr *)(e->map + eh->e_phoff);
+        e->base_vaddr = UINT64_MAX;
+        for (int i = 0; i < eh->e_phnum; ++i)
+            if (ph[i].p_type == PT_LOAD && ph[i].p_vaddr < e->base_vaddr)
+                e->base_vaddr = ph[i].p_vaddr;
+        if (e->base_vaddr == UINT64_MAX) e->base_vaddr = 0;
+        e->base_vaddr &= ~(uint64_t)0xfff;
+    }
+    leak_elf_read_build_id(e->map, e->map_len, e->build_id);
+    return 1;
+}
+
+/* Function: leak_elf_load
+ * Load symbols and line tables of a probed binary.
+ */
+static inline void leak_elf_load(leak_elf_t *e, const char *path) {
+    size_t size;
+    if (!e->map || e->nsyms || e->nrows) return;
+    if (!leak_elf_section(e->map, e->map_len, ".debug_line", &size))
+        e->dbg = leak_elf_find_debug(path, e->map, e->map_len, e->build_id, &e->dbg_len);
+
+    /* a debug file carries the full .symtab of a stripped library */
+    if (e->dbg) leak_elf_load_syms(e, e->dbg, e->dbg_len);
+    if (!e->nsyms) leak_elf_load_syms(e, e->map, e->map_len);
+    leak_elf_load_lines(e, e->dbg ? e->dbg : e->map, e->dbg ? e->dbg_len : e->map_len);
+}
+
+/* Function: leak_elf_open
+ * Probe and load `path` in one go.
+ */
+static inline int leak_elf_open(leak_elf_t *e, const char *path) {
+    if (!leak_elf_probe(e, path)) return 0;
+    leak_elf_load(e, path);
+    return 1;
+}
+
+/* Function: leak_elf_lookup
+ * Resolve the link-time address `addr`. Any of func/file may come back
+ * NULL and line 0 when the information is missing.
+ */
+static inline void leak_elf_lookup(const leak_elf_t *e, uint64_t addr, const char **func,
+                                   const char **file, unsigned *line) {
+    *func = leak_elf_symbol(e, addr);
+    *file = NULL;
+    *line = 0;
+    size_t lo = 0, hi = e->nrows;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (e->rows[mid].addr <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (!lo) return;
+    const leak_line_row_t *r = &e->rows[lo - 1];
+    if (r->file == UINT32_MAX) return;          /* past the end of a sequence */
+    *file = r->file < e->nfiles ? e->files[r->file] : NULL;
+    *line = r->line;
+}
+
+static inline void leak_elf_close(leak_elf_t *e) {
+    for (size_t i = 0; i < e->nfiles; ++i) free(e->files[i]);
+    free(e->files);
+    free(e->rows);
+    free(e->syms);
+    if (e->map) munmap((void *)e->map, e->map_len);
+    if (e->dbg) munmap((void *)e->dbg, e->dbg_len);
+    memset(e, 0, sizeof(*e));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_ELF_H */
@@ -0,0 +1,112 @@
+/* leak_fds.h
+ * Open file descriptors and where each one was opened, for the descriptor
+ * wrappers of leak_core.h (LEAK_CORE_FDS).
+ *
+ * A flat array indexed by the descriptor number holds one 64-bit slot per
+ * descriptor: 0 while it is closed, else its origin (a stack depot id or
+ * a return address) shifted left by 8, with the kind (LEAK_T_*) + 1 in
+ * the low byte. Opening is one atomic store and closing one atomic
+ * exchange: no lock, no hashing and nothing written anywhere else. The
+ * array is sized for the hard RLIMIT_NOFILE and mmap'd, so only the pages
+ * of descriptors actually used are ever touched; a descriptor past its
+ * end is counted in `dropped` and not tracked.
+ */
+#ifndef LEAK_FDS_H
+#define LEAK_FDS_H
+
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include "leak_arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_FDS_MIN 1024
+#define LEAK_FDS_MAX (1u << 20)
+
+static struct {
+    uint64_t *slots;
+    uint32_t cap;
+    uint32_t top;               /* one past the highest descriptor recorded */
+    uint64_t dropped;           /* descriptors past `cap` */
+} leak_fds;
+
+/* Function: leak_fds_init
+ * Map the table. Until this has run every descriptor counts as dropped.
+ */
+static inline void leak_fds_init(void) {
+    struct rlimit rl;
+    uint64_t cap = LEAK_FDS_MAX;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_max != RLIM_INFINITY) cap = rl.rlim_max;
+    if (cap < LEAK_FDS_MIN) cap = LEAK_FDS_MIN;
+    if (cap > LEAK_FDS_MAX) cap = LEAK_FDS_MAX;
+    uint64_t *slots = leak_pages_alloc(cap * sizeof(*slots));
+    if (!slots) return;
+    leak_fds.cap = (uint32_t)cap;
+    __atomic_store_n(&leak_fds.slots, slots, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t leak_fds_slot(uint8_t type, uint64_t origin) {
+    return origin << 8 | (uint64_t)(type + 1);
+}
+
+/* Function: leak_fds_open
+ * Record `fd`, opened from `origin` as a `type`. Returns the slot's
+ * previous value: nonzero when a dup2() replaced a tracked descriptor.
+ */
+static inline uint64_t leak_fds_open(int fd, uint8_t type, uint64_t origin) {
+    uint64_t *slots = __atomic_load_n(&leak_fds.slots, __ATOMIC_ACQUIRE);
+    if (fd < 0) return 0;
+    if (!slots || (uint32_t)fd >= leak_fds.cap) {
+        __atomic_fetch_add(&leak_fds.dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    uint32_t top = __atomic_load_n(&leak_fds.top, __ATOMIC_RELAXED);
+    while ((uint32_t)fd >= top &&
+           !__atomic_compare_exchange_n(&leak_fds.top, &top, (uint32_t)fd + 1, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+    return __atomic_exchange_n(&slots[fd], leak_fds_slot(type, origin), __ATOMIC_RELAXED);
+}
+
+/* Function: leak_fds_close
+ * Forget `fd`; returns its slot (0 if it was not tracked). Call before
+ * the real close(): once that returns, another thread may get the same
+ * number from open() and record it.
+ */
+static inline uint64_t leak_fds_close(int fd) {
+    uint64_t *slots = __atomic_load_n(&leak_fds.slots, __ATOMIC_ACQUIRE);
+    if (!slots || fd < 0 || (uint32_t)fd >= leak_fds.cap) return 0;
+    if (!__atomic_load_n(&slots[fd], __ATOMIC_RELAXED)) return 0;
+    return __atomic_exchange_n(&slots[fd], 0, __ATOMIC_RELAXED);
+}
+
+/* Function: leak_fds_get
+ * The kind and origin of `fd` if it is tracked and open, else 0. Every
+ * open one is below leak_fds.top.
+ */
+static inline int leak_fds_get(uint32_t fd, uint8_t *type, uint64_t *origin) {
+    uint64_t *slots = __atomic_load_n(&leak_fds.slots, __ATOMIC_ACQUIRE);
+    if (!slots || fd >= leak_fds.cap) return 0;
+    uint64_t v = __atomic_load_n(&slots[fd], __ATOMIC_RELAXED);
+    if (!v) return 0;
+    *type = (uint8_t)((v & 0xff) - 1);
+    *origin = v >> 8;
+    return 1;
+}
+
+/* in a fork() child that does not keep the parent's records; dropping
+ * the pages zeroes them without touching the ones never used */
+static inline void leak_fds_reset(void) {
+    if (leak_fds.slots) madvise(leak_fds.slots, (size_t)leak_fds.cap * sizeof(*leak_fds.slots),
+                                MADV_DONTNEED);
+    leak_fds.dropped = 0;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_FDS_H */
@@ -0,0 +1,235 @@
+/* leak_growth.h
+ * Online leak detection for processes that never exit cleanly
+ * (LEAK_GROWTH=path): every LEAK_GROWTH_MS the live bytes of each
+ * allocation stack are sampled, and a stack whose live bytes grew
+ * steadily over the last LEAK_GROWTH_WINDOWS windows is written to `path`
+ * with its growth rate, while the process keeps running.
+ *
+ * The samples come from the per-thread site tables of leak_metrics.h,
+ * which every allocation and free already keeps up to date, so a check
+ * costs a sum over those tables and a pass over one row per stack, never
+ * a walk of the live table. Each stack has a ring of its last windows + 1
+ * samples. It is flagged when none of its windows shrank, it gained at
+ * least LEAK_GROWTH_MIN_BYTES over them, and a least-squares line fits the
+ * samples (r^2 >= LEAK_GROWTH_FIT): a cache that filled up once and then
+ * stayed put is a step, not a line. A flagged stack is not flagged again
+ * before another `windows` windows have passed. Once leak_metrics has
+ * lost a site count (a table chunk it could not map), the sums may be off
+ * by any amount, so the detector writes one "#growth stopped" line and
+ * flags nothing more.
+ *
+ * `path` takes %p like LEAK_OUTPUT; "-" writes to stderr. Lines are
+ *
+ *   #growth time_s bytes_per_s live_bytes live_blocks windows fit callers
+ *
+ * with callers as offset@binary frames, as in the reports, from the first
+ * frame outside the detector.
+ */
+#ifndef LEAK_GROWTH_H
+#define LEAK_GROWTH_H
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "leak_common.h"
+#include "leak_arena.h"
+#include "leak_metrics.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_GROWTH_MAX_WINDOWS 64
+#define LEAK_GROWTH_FIT 0.8
+#define LEAK_GROWTH_CALLERS 4096
+
+typedef void (*leak_growth_callers_fn)(char *buf, size_t len, uint32_t stack);
+
+static struct {
+    int on;
+    int fd;
+    int own_fd;                         /* not stderr */
+    uint64_t window_ns;
+    uint32_t windows;
+    int64_t min_bytes;
+    uint64_t start_ns, last_ns;
+    uint64_t nwin;                      /* samples taken */
+    int64_t *rows;                      /* per stack: windows + 1 samples, last flag */
+    size_t rows_len;
+    uint32_t nrows;
+    uint64_t flagged;
+    int stopped;                        /* the sums lost counts */
+} leak_growth;
+
+static inline size_t leak_growth_row(void) {
+    return (size_t)leak_growth.windows + 2;
+}
+
+static inline void leak_growth_open(int forked) {
+    const char *v = getenv("LEAK_GROWTH");
+    if (strcmp(v, "-") == 0) {
+        leak_growth.fd = STDERR_FILENO;
+        leak_growth.own_fd = 0;
+    } else {
+        char path[4096];
+        leak_output_path(v, NULL, forked, path, sizeof(path));
+        leak_growth.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+        leak_growth.own_fd = 1;
+    }
+    if (leak_growth.fd < 0) {
+        leak_growth.on = 0;
+        return;
+    }
+    char head[160];
+    int n = snprintf(head, sizeof(head),
+                     "#growth time_s bytes_per_s live_bytes live_blocks windows fit callers"
+                     " window_ms=%lu min_bytes=%ld\n",
+                     (unsigned long)(leak_growth.window_ns / 1000000), (long)leak_growth.min_bytes);
+    if (write(leak_growth.fd, head, (size_t)n) < 0) return;
+}
+
+/* Function: leak_growth_init
+ * Read LEAK_GROWTH and its settings and open the output. Returns the
+ * window length in milliseconds, 0 if the detector is off. Call from the
+ * detector's constructor, before leak_metrics_start.
+ */
+static inline uint64_t leak_growth_init(void) {
+    const char *v = getenv("LEAK_GROWTH");
+    if (!v || !v[0]) return 0;
+    uint64_t ms = 10000;
+    leak_growth.windows = 6;
+    leak_growth.min_bytes = 65536;
+    if ((v = getenv("LEAK_GROWTH_MS")) != NULL && atoi(v) > 0) ms = (uint64_t)atoi(v);
+    if ((v = getenv("LEAK_GROWTH_WINDOWS")) != NULL && atoi(v) >= 2)
+        leak_growth.windows = (uint32_t)atoi(v);
+    if (leak_growth.windows > LEAK_GROWTH_MAX_WINDOWS) leak_growth.windows = LEAK_GROWTH_MAX_WINDOWS;
+    if ((v = getenv("LEAK_GROWTH_MIN_BYTES")) != NULL && atoll(v) > 0)
+        leak_growth.min_bytes = atoll(v);
+    leak_growth.window_ns = ms * 1000000ull;
+    leak_growth.on = 1;
+    leak_growth_open(0);
+    if (!leak_growth.on) return 0;
+    leak_growth.start_ns = leak_growth.last_ns = leak_metrics_now();
+    return ms;
+}
+
+/* rows for stack ids 0 to `nstacks`, new ones zeroed */
+static inline int leak_growth_reserve(uint32_t nstacks) {
+    if (nstacks < leak_growth.nrows) return 1;
+    size_t len = ((size_t)nstacks + 1) * leak_growth_row() * sizeof(int64_t);
+    if (len > leak_growth.rows_len) {
+        size_t len2 = len * 2;
+        int64_t *rows = leak_pages_alloc(len2);
+        if (!rows) return 0;
+        if (leak_growth.rows) memcpy(rows, leak_growth.rows, leak_growth.rows_len);
+        leak_pages_free(leak_growth.rows, leak_growth.rows_len);
+        leak_growth.rows = rows;
+        leak_growth.rows_len = len2;
+    }
+    leak_growth.nrows = nstacks + 1;
+    return 1;
+}
+
+/* Least-squares fit of the last windows + 1 samples, oldest first: the
+ * slope in bytes per window and r^2 in `*fit`; 0 unless no window shrank
+ * and they gained `min_bytes` in all. */
+static inline double leak_growth_trend(const int64_t *row, double *fit) {
+    uint32_t w = leak_growth.windows, n = w + 1;
+    uint64_t first = leak_growth.nwin - n;
+    int64_t y[LEAK_GROWTH_MAX_WINDOWS + 1];
+    for (uint32_t i = 0; i < n; ++i) y[i] = row[(first + i) % n];
+    if (y[w] - y[0] < leak_growth.min_bytes) return 0;
+    for (uint32_t i = 0; i < w; ++i)
+        if (y[i + 1] < y[i]) return 0;
+    double mx = w / 2.0, my = 0, sxy = 0, sxx = 0, syy = 0;
+    for (uint32_t i = 0; i < n; ++i) my += (double)y[i];
+    my /= n;
+    for (uint32_t i = 0; i < n; ++i) {
+        double dx = i - mx, dy = (double)y[i] - my;
+        sxy += dx * dy;
+        sxx += dx * dx;
+        syy += dy * dy;
+    }
+    double slope = sxy / sxx;
+    *fit = syy > 0 ? slope * sxy / syy : 0;
+    return *fit >= LEAK_GROWTH_FIT ? slope : 0;
+}
+
+/* the sums lost `dropped` counts: say so, once, and flag no more */
+static inline void leak_growth_stop(uint64_t now, uint64_t dropped) {
+    char msg[128];
+    int n = snprintf(msg, sizeof(msg), "#growth stopped %.1f: %lu site counts lost\n",
+                     (now - leak_growth.start_ns) / 1e9, (unsigned long)dropped);
+    leak_growth.stopped = 1;
+    if (write(leak_growth.fd, msg, (size_t)n) < 0) return;
+}
+
+/* Function: leak_growth_check
+ * Take a sample from the per-stack sums `live` (ids 0 to `nstacks`) if a
+ * window has passed since the last, and write out the stacks that grew
+ * steadily. Runs on the metrics thread only.
+ */
+static inline void leak_growth_check(const leak_metrics_total_t *live, uint32_t nstacks,
+                                     uint64_t now, leak_growth_callers_fn callers) {
+    /* the metrics thread may wake more often than a window */
+    if (now - leak_growth.last_ns + leak_growth.window_ns / 8 < leak_growth.window_ns) return;
+    if (leak_growth.stopped) return;
+    uint64_t dropped = __atomic_load_n(&leak_metrics.sites_dropped, __ATOMIC_RELAXED);
+    if (dropped) {
+        leak_growth_stop(now, dropped);
+        return;
+    }
+    if (!leak_growth_reserve(nstacks)) return;
+    leak_growth.last_ns = now;
+    uint32_t n = leak_growth.windows + 1;
+    size_t rl = leak_growth_row();
+    uint64_t pos = leak_growth.nwin % n;
+    for (uint32_t id = 1; id <= nstacks; ++id)
+        leak_growth.rows[id * rl + pos] = live[id].bytes;
+    if (++leak_growth.nwin < n) return;
+
+    static char line[LEAK_GROWTH_CALLERS + 128];
+    double win_s = leak_growth.window_ns / 1e9;
+    for (uint32_t id = 1; id <= nstacks; ++id) {
+        int64_t *row = &leak_growth.rows[id * rl];
+        /* last flag + 1 in the slot after the samples */
+        if (row[n] && leak_growth.nwin - (uint64_t)row[n] < leak_growth.windows) continue;
+        double fit;
+        double slope = leak_growth_trend(row, &fit);
+        if (slope <= 0) continue;
+        row[n] = (int64_t)leak_growth.nwin;
+        leak_growth.flagged++;
+        int k = snprintf(line, sizeof(line), "%.1f %.0f %ld %ld %u %.2f ",
+                         (now - leak_growth.start_ns) / 1e9, slope / win_s, (long)live[id].bytes,
+                         (long)live[id].blocks, leak_growth.windows, fit);
+        callers(line + k, sizeof(line) - (size_t)k - 1, id);
+        size_t len = strlen(line);
+        line[len++] = '\n';
+        if (write(leak_growth.fd, line, len) < 0) break;
+    }
+}
+
+/* Function: leak_growth_child
+ * In a child after fork(): its own output, and the parent's samples kept
+ * only with `inherit`.
+ */
+static inline void leak_growth_child(int inherit) {
+    if (!leak_growth.on) return;
+    if (leak_growth.own_fd) close(leak_growth.fd);
+    leak_growth_open(1);
+    if (inherit) return;
+    if (leak_growth.rows) madvise(leak_growth.rows, leak_growth.rows_len, MADV_DONTNEED);
+    leak_growth.nwin = 0;
+    leak_growth.flagged = 0;
+    leak_growth.stopped = 0;
+    leak_growth.start_ns = leak_growth.last_ns = leak_metrics_now();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_GROWTH_H */
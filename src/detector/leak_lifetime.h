@@ -0,0 +1,207 @@
+/* leak_lifetime.h
+ * Allocation lifetimes per call site (LEAK_LIFETIME=path).
+ *
+ * Every recorded block is stamped with a cheap clock when it is allocated
+ * (rdtsc on x86, CLOCK_MONOTONIC_COARSE elsewhere). When it is freed, its
+ * lifetime goes into a log2 histogram of its allocation stack, counting
+ * blocks and bytes per bucket: bucket 0 is under 2^LEAK_LIFE_SHIFT ticks,
+ * bucket b covers [2^(b-1), 2^b) times that. Histograms live in a
+ * table per thread that only its owner writes, indexed by stack depot id
+ * in chunks mapped when the thread first frees a block from an id in
+ * their range, so a free costs two loads and two adds on memory no other
+ * thread touches, and a table never fills up however many sites a thread
+ * frees from; the report merges all tables. Ticks are turned into time
+ * only then, from the clock's rate over the whole run.
+ *
+ * A table is handed to a new thread once its owner has exited; its counts
+ * stay, since they are sums anyway. Frees after a thread gave its table
+ * up (TLS destructors), and those whose chunk cannot be mapped, are
+ * counted in leak_life_dropped.
+ */
+#ifndef LEAK_LIFETIME_H
+#define LEAK_LIFETIME_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "leak_arena.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_LIFE_BUCKETS 40
+#define LEAK_LIFE_SHIFT 10
+#define LEAK_LIFE_CHUNK_BITS 10         /* stack ids per chunk of a table */
+#define LEAK_LIFE_CHUNKS (1u << 14)     /* as many ids as the depot hands out */
+
+typedef struct {
+    uint64_t count[LEAK_LIFE_BUCKETS];
+    uint64_t bytes[LEAK_LIFE_BUCKETS];
+} leak_life_site_t;
+
+enum { LEAK_LIFE_FREE = 0, LEAK_LIFE_LIVE = 1 };
+
+typedef struct leak_life_table {
+    struct leak_life_table *next;       /* registry, never unlinked */
+    int state;
+    leak_life_site_t *sites[LEAK_LIFE_CHUNKS];  /* by stack id */
+} leak_life_table_t;
+
+/* frees after the thread's own table was given up (TLS destructors) */
+#define LEAK_LIFE_ORPHAN ((leak_life_table_t *)1)
+
+static int leak_life_on = 0;
+static uint64_t leak_life_dropped = 0;
+static uint64_t leak_life_t0, leak_life_ns0;        /* clock and time at start */
+static leak_life_table_t *leak_life_tables = NULL;
+static pthread_key_t leak_life_key;
+static __thread leak_life_table_t *leak_life_table = NULL;
+
+/* Function: leak_life_ticks
+ * The allocation timestamp: a raw cycle count where there is a cheap one.
+ */
+static inline uint64_t leak_life_ticks(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline uint64_t leak_life_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void leak_life_thread_exit(void *arg) {
+    leak_life_table_t *t = arg;
+    leak_life_table = LEAK_LIFE_ORPHAN;
+    __atomic_store_n(&t->state, LEAK_LIFE_FREE, __ATOMIC_RELEASE);
+}
+
+/* Function: leak_life_init
+ * Turn the mode on if LEAK_LIFETIME is set. Call from the detector's
+ * constructor.
+ */
+static inline void leak_life_init(void) {
+    const char *v = getenv("LEAK_LIFETIME");
+    if (!v || !v[0] || pthread_key_create(&leak_life_key, leak_life_thread_exit) != 0) return;
+    leak_life_t0 = leak_life_ticks();
+    leak_life_ns0 = leak_life_ns();
+    __atomic_store_n(&leak_life_on, 1, __ATOMIC_RELEASE);
+}
+
+/* First free of a thread: take a table given up by an exited thread or
+ * map a new one. */
+static __attribute__((noinline)) leak_life_table_t *leak_life_attach(void) {
+    leak_life_table_t *t;
+    for (t = __atomic_load_n(&leak_life_tables, __ATOMIC_ACQUIRE); t; t = t->next) {
+        int expect = LEAK_LIFE_FREE;
+        if (__atomic_compare_exchange_n(&t->state, &expect, LEAK_LIFE_LIVE, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+    if (!t) {
+        t = leak_pages_alloc(sizeof(*t));
+        if (!t) return NULL;
+        t->state = LEAK_LIFE_LIVE;
+        t->next = __atomic_load_n(&leak_life_tables, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&leak_life_tables, &t->next, t, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_ACQUIRE))
+            ;
+    }
+    leak_life_table = t;
+    pthread_setspecific(leak_life_key, t);
+    return t;
+}
+
+static inline unsigned leak_life_bucket(uint64_t ticks) {
+    uint64_t v = ticks >> LEAK_LIFE_SHIFT;
+    unsigned b = v ? 64 - (unsigned)__builtin_clzll(v) : 0;
+    return b < LEAK_LIFE_BUCKETS ? b : LEAK_LIFE_BUCKETS - 1;
+}
+
+/* Function: leak_life_add
+ * Account a block of `size` bytes from `stack`, allocated at tick `born`,
+ * that is being freed now. The reporter reads the counters while owners
+ * keep adding, so they are stored with relaxed atomics.
+ */
+static inline void leak_life_add(uint32_t stack, size_t size, uint64_t born) {
+    uint64_t now = leak_life_ticks();
+    leak_life_table_t *t = leak_life_table;
+    if (__builtin_expect(!t, 0)) t = leak_life_attach();
+    if (!t || t == LEAK_LIFE_ORPHAN) {
+        __atomic_fetch_add(&leak_life_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    uint32_t c = stack >> LEAK_LIFE_CHUNK_BITS;
+    leak_life_site_t *chunk = c < LEAK_LIFE_CHUNKS ? t->sites[c] : NULL;
+    if (__builtin_expect(!chunk, 0)) {
+        if (c < LEAK_LIFE_CHUNKS) chunk = leak_pages_alloc(sizeof(*chunk) << LEAK_LIFE_CHUNK_BITS);
+        if (!chunk) {
+            __atomic_fetch_add(&leak_life_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        __atomic_store_n(&t->sites[c], chunk, __ATOMIC_RELEASE);
+    }
+    leak_life_site_t *s = &chunk[stack & ((1u << LEAK_LIFE_CHUNK_BITS) - 1)];
+    unsigned b = leak_life_bucket(now > born ? now - born : 0);
+    __atomic_store_n(&s->count[b], s->count[b] + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->bytes[b], s->bytes[b] + size, __ATOMIC_RELAXED);
+}
+
+/* Function: leak_life_find
+ * The histogram of `stack` in `t`, or NULL.
+ */
+static inline const leak_life_site_t *leak_life_find(const leak_life_table_t *t, uint32_t stack) {
+    uint32_t c = stack >> LEAK_LIFE_CHUNK_BITS;
+    if (c >= LEAK_LIFE_CHUNKS) return NULL;
+    const leak_life_site_t *chunk = __atomic_load_n(&t->sites[c], __ATOMIC_ACQUIRE);
+    return chunk ? &chunk[stack & ((1u << LEAK_LIFE_CHUNK_BITS) - 1)] : NULL;
+}
+
+/* Function: leak_life_ns_per_tick
+ * The clock's rate, measured over the run so far.
+ */
+static inline double leak_life_ns_per_tick(void) {
+    uint64_t ticks = leak_life_ticks() - leak_life_t0;
+    uint64_t ns = leak_life_ns() - leak_life_ns0;
+    return ticks ? (double)ns / (double)ticks : 1.0;
+}
+
+/* Function: leak_life_child
+ * In a child after fork(). The other threads are gone, so their tables
+ * are free to take; without `inherit` every count starts from zero.
+ */
+static inline void leak_life_child(int inherit) {
+    if (!leak_life_on) return;
+    for (leak_life_table_t *t = leak_life_tables; t; t = t->next) {
+        if (t != leak_life_table) t->state = LEAK_LIFE_FREE;
+        if (inherit) continue;
+        for (uint32_t c = 0; c < LEAK_LIFE_CHUNKS; ++c)
+            if (t->sites[c])
+                madvise(t->sites[c], sizeof(leak_life_site_t) << LEAK_LIFE_CHUNK_BITS,
+                        MADV_DONTNEED);
+    }
+    if (!inherit) {
+        leak_life_dropped = 0;
+        leak_life_t0 = leak_life_ticks();
+        leak_life_ns0 = leak_life_ns();
+    }
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_LIFETIME_H */
@@ -0,0 +1,411 @@
+/* leak_metrics.h
+ * Live counters for an external monitor (LEAK_METRICS=1), kept in the
+ * shared memory segment of leak_metrics_format.h so that leaktop can
+ * watch a running process without signalling or stopping it.
+ *
+ * Every thread owns a slot of the segment and a private table of live
+ * bytes and blocks per allocation stack, and is the only one to write
+ * either: an allocation or a free adds to its own counters with relaxed
+ * loads and stores, so no cache line is shared with another thread. A
+ * table is indexed by stack depot id, in chunks mapped when the thread
+ * first counts an id in their range, so it never fills up however many
+ * stacks a thread touches. A table is handed to a new thread once its
+ * owner has exited, keeping its counts; past LEAK_METRICS_SLOTS - 1
+ * threads, the rest share slot 0 with atomic adds, and counts made after
+ * a thread gave its table up (TLS destructors) go to a shared table, also
+ * with atomic adds. A block freed by another thread than the one that
+ * allocated it is subtracted in the freeing thread's table, so only the
+ * sum over all tables means anything. Only a chunk that cannot be mapped
+ * loses counts (sites_dropped); the free of a block whose allocation was
+ * not counted is not counted either, so the sums never drift.
+ *
+ * Every LEAK_METRICS_MS (default 1000) a background thread sums the site
+ * tables and hands the result to the detector's publish function, which
+ * fills in the rest of the header. The segment's name is unlinked at
+ * exit; the mapping itself stays, since other threads may still count.
+ *
+ * The growth detector (leak_growth.h) reads the same site tables. When it
+ * is on without LEAK_METRICS, the segment is private anonymous memory
+ * with no name, and the thread wakes at the detector's interval instead.
+ */
+#ifndef LEAK_METRICS_H
+#define LEAK_METRICS_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include "leak_arena.h"
+#include "leak_metrics_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_METRICS_CHUNK_BITS 12      /* stack ids per chunk of a site table */
+#define LEAK_METRICS_CHUNKS 4096        /* as many ids as the depot hands out */
+
+typedef struct {
+    int64_t bytes, blocks;
+} leak_metrics_live_t;
+
+/* live bytes and blocks of one stack, summed over all threads */
+typedef struct {
+    int64_t bytes, blocks;
+} leak_metrics_total_t;
+
+enum { LEAK_METRICS_FREE = 0, LEAK_METRICS_LIVE = 1 };
+
+typedef struct leak_metrics_thread {
+    struct leak_metrics_thread *next;   /* registry, never unlinked */
+    int state;
+    int shared;                         /* slot 0: add atomically */
+    leak_metrics_slot_t *slot;
+    leak_metrics_live_t *sites[LEAK_METRICS_CHUNKS];    /* by stack id */
+} leak_metrics_thread_t;
+
+typedef void (*leak_metrics_fn)(leak_metrics_seg_t *seg, const leak_metrics_total_t *live,
+                                uint32_t nstacks);
+
+static struct {
+    int on;
+    int shared;                         /* LEAK_METRICS: the segment has a name */
+    uint64_t tick_ms;                   /* how often the thread sums the tables */
+    leak_metrics_seg_t *seg;
+    char name[64];
+    leak_metrics_thread_t *threads;
+    uint32_t nthreads;
+    uint64_t sites_dropped;             /* counts lost to an unmapped chunk */
+    int key_ok;
+    pthread_key_t key;
+    int running;
+    pthread_t thread;
+    sem_t sem;
+    leak_metrics_fn publish;
+    leak_metrics_total_t *live;         /* the publisher's sums */
+    size_t live_len;
+} leak_metrics;
+
+/* counts after a thread gave its own table up (TLS destructors), from
+ * any number of threads at once */
+static leak_metrics_thread_t leak_metrics_orphan = { NULL, LEAK_METRICS_LIVE, 1, NULL, { NULL } };
+static __thread leak_metrics_thread_t *leak_metrics_self = NULL;
+
+static inline uint64_t leak_metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Create this process's segment, zeroed but for its identity: named
+ * shared memory if it is `shared`, else private. */
+static inline leak_metrics_seg_t *leak_metrics_map(uint64_t interval_ms, int shared) {
+    void *p = MAP_FAILED;
+    if (shared) {
+        snprintf(leak_metrics.name, sizeof(leak_metrics.name), LEAK_METRICS_NAME, (int)getpid());
+        int fd = shm_open(leak_metrics.name, O_CREAT | O_TRUNC | O_RDWR, 0600);
+        if (fd < 0) return NULL;
+        if (ftruncate(fd, sizeof(leak_metrics_seg_t)) == 0)
+            p = mmap(NULL, sizeof(leak_metrics_seg_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (p == MAP_FAILED) shm_unlink(leak_metrics.name);
+    } else {
+        p = leak_pages_alloc(sizeof(leak_metrics_seg_t));
+        if (!p) p = MAP_FAILED;
+    }
+    if (p == MAP_FAILED) return NULL;
+    leak_metrics_seg_t *seg = p;
+    seg->version = LEAK_METRICS_VERSION;
+    seg->pid = (uint32_t)getpid();
+    seg->nslots = LEAK_METRICS_SLOTS;
+    seg->ntypes = LEAK_T_COUNT;
+    seg->interval_ms = interval_ms;
+    seg->start_ns = leak_metrics_now();
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(seg->magic, LEAK_METRICS_MAGIC, sizeof(seg->magic));
+    return seg;
+}
+
+static void leak_metrics_thread_exit(void *arg) {
+    leak_metrics_thread_t *t = arg;
+    leak_metrics_self = &leak_metrics_orphan;
+    __atomic_store_n(&t->state, LEAK_METRICS_FREE, __ATOMIC_RELEASE);
+}
+
+/* First count of a thread: take a table given up by an exited thread or
+ * map a new one, with the next free slot. */
+static __attribute__((noinline)) leak_metrics_thread_t *leak_metrics_attach(void) {
+    leak_metrics_thread_t *t;
+    for (t = __atomic_load_n(&leak_metrics.threads, __ATOMIC_ACQUIRE); t; t = t->next) {
+        int expect = LEAK_METRICS_FREE;
+        if (__atomic_compare_exchange_n(&t->state, &expect, LEAK_METRICS_LIVE, 0, __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED))
+            break;
+    }
+    if (!t) {
+        t = leak_pages_alloc(sizeof(*t));
+        if (!t) return &leak_metrics_orphan;
+        uint32_t n = __atomic_add_fetch(&leak_metrics.nthreads, 1, __ATOMIC_RELAXED);
+        t->state = LEAK_METRICS_LIVE;
+        t->shared = n >= LEAK_METRICS_SLOTS;
+        t->slot = &leak_metrics.seg->slots[t->shared ? 0 : n];
+        t->next = __atomic_load_n(&leak_metrics.threads, __ATOMIC_ACQUIRE);
+        while (!__atomic_compare_exchange_n(&leak_metrics.threads, &t->next, t, 1, __ATOMIC_RELEASE,
+                                            __ATOMIC_ACQUIRE))
+            ;
+    }
+    leak_metrics_self = t;
+    if (leak_metrics.key_ok) pthread_setspecific(leak_metrics.key, t);
+    return t;
+}
+
+static inline void leak_metrics_add(const leak_metrics_thread_t *t, uint64_t *c, uint64_t v) {
+    if (t->shared)
+        __atomic_fetch_add(c, v, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(c, __atomic_load_n(c, __ATOMIC_RELAXED) + v, __ATOMIC_RELAXED);
+}
+
+/* The counters of `stack` in `t`'s table, mapping their chunk on first
+ * use; NULL if it cannot be mapped. */
+static inline leak_metrics_live_t *leak_metrics_site_of(leak_metrics_thread_t *t, uint32_t stack) {
+    uint32_t c = stack >> LEAK_METRICS_CHUNK_BITS;
+    if (c >= LEAK_METRICS_CHUNKS) return NULL;
+    leak_metrics_live_t *chunk = __atomic_load_n(&t->sites[c], __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!chunk, 0)) {
+        /* the orphan table is shared, so install like leak_depot_account */
+        size_t len = sizeof(leak_metrics_live_t) << LEAK_METRICS_CHUNK_BITS;
+        leak_metrics_live_t *fresh = leak_pages_alloc(len);
+        if (!fresh) return NULL;
+        if (__atomic_compare_exchange_n(&t->sites[c], &chunk, fresh, 0, __ATOMIC_ACQ_REL,
+                                        __ATOMIC_ACQUIRE))
+            chunk = fresh;
+        else
+            leak_pages_free(fresh, len);
+    }
+    return &chunk[stack & ((1u << LEAK_METRICS_CHUNK_BITS) - 1)];
+}
+
+/* add to the live counters of `stack`; 0 if they were lost */
+static inline int leak_metrics_site(leak_metrics_thread_t *t, uint32_t stack, int64_t bytes,
+                                    int64_t blocks) {
+    leak_metrics_live_t *s = leak_metrics_site_of(t, stack);
+    if (!s) {
+        __atomic_fetch_add(&leak_metrics.sites_dropped, 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    if (t == &leak_metrics_orphan) {
+        __atomic_fetch_add(&s->bytes, bytes, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&s->blocks, blocks, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&s->bytes, s->bytes + bytes, __ATOMIC_RELAXED);
+        __atomic_store_n(&s->blocks, s->blocks + blocks, __ATOMIC_RELAXED);
+    }
+    return 1;
+}
+
+/* Function: leak_metrics_alloc
+ * Count a recorded block of `size` bytes of kind `type` from `stack`.
+ * Returns whether it went into the per-stack sums, to hand to
+ * leak_metrics_free with the block.
+ */
+static inline int leak_metrics_alloc(uint32_t stack, uint8_t type, size_t size) {
+    leak_metrics_thread_t *t = leak_metrics_self;
+    if (__builtin_expect(!t, 0)) t = leak_metrics_attach();
+    leak_metrics_slot_t *s = t->slot;
+    leak_metrics_add(t, &s->allocs, 1);
+    leak_metrics_add(t, &s->alloc_bytes, size);
+    if (type < LEAK_T_COUNT) {
+        leak_metrics_add(t, &s->type_allocs[type], 1);
+        leak_metrics_add(t, &s->type_alloc_bytes[type], size);
+    }
+    return leak_metrics_site(t, stack, (int64_t)size, 1);
+}
+
+/* Function: leak_metrics_free
+ * Count the release of a block leak_metrics_alloc counted, in the
+ * per-stack sums only if it was `counted` there.
+ */
+static inline void leak_metrics_free(uint32_t stack, uint8_t type, size_t size, int counted) {
+    leak_metrics_thread_t *t = leak_metrics_self;
+    if (__builtin_expect(!t, 0)) t = leak_metrics_attach();
+    leak_metrics_slot_t *s = t->slot;
+    leak_metrics_add(t, &s->frees, 1);
+    leak_metrics_add(t, &s->free_bytes, size);
+    if (type < LEAK_T_COUNT) {
+        leak_metrics_add(t, &s->type_frees[type], 1);
+        leak_metrics_add(t, &s->type_free_bytes[type], size);
+    }
+    if (counted) leak_metrics_site(t, stack, -(int64_t)size, -1);
+}
+
+/* Function: leak_metrics_sum
+ * Add every thread's live bytes and blocks per stack into `live`, which
+ * has room for ids 0 to `nstacks`.
+ */
+static inline void leak_metrics_sum_one(leak_metrics_total_t *live, uint32_t nstacks,
+                                        const leak_metrics_thread_t *t) {
+    for (uint32_t c = 0; c <= nstacks >> LEAK_METRICS_CHUNK_BITS && c < LEAK_METRICS_CHUNKS; ++c) {
+        const leak_metrics_live_t *chunk = __atomic_load_n(&t->sites[c], __ATOMIC_ACQUIRE);
+        if (!chunk) continue;
+        uint32_t id = c << LEAK_METRICS_CHUNK_BITS;
+        for (uint32_t i = 0; i < (1u << LEAK_METRICS_CHUNK_BITS) && id <= nstacks; ++i, ++id) {
+            live[id].bytes += __atomic_load_n(&chunk[i].bytes, __ATOMIC_RELAXED);
+            live[id].blocks += __atomic_load_n(&chunk[i].blocks, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+static inline void leak_metrics_sum(leak_metrics_total_t *live, uint32_t nstacks) {
+    for (leak_metrics_thread_t *t = __atomic_load_n(&leak_metrics.threads, __ATOMIC_ACQUIRE); t;
+         t = t->next)
+        leak_metrics_sum_one(live, nstacks, t);
+    leak_metrics_sum_one(live, nstacks, &leak_metrics_orphan);
+}
+
+/* Sum the site tables into leak_metrics.live, sized for the depot's
+ * `nstacks`, and publish. Runs on the metrics thread only. */
+static inline void leak_metrics_tick(uint32_t nstacks) {
+    size_t len = ((size_t)nstacks + 1) * sizeof(leak_metrics_total_t);
+    if (len > leak_metrics.live_len) {
+        size_t len2 = len * 2;
+        leak_metrics_total_t *live = leak_pages_alloc(len2);
+        if (!live) return;
+        leak_pages_free(leak_metrics.live, leak_metrics.live_len);
+        leak_metrics.live = live;
+        leak_metrics.live_len = len2;
+    }
+    memset(leak_metrics.live, 0, len);
+    leak_metrics_sum(leak_metrics.live, nstacks);
+    leak_metrics.publish(leak_metrics.seg, leak_metrics.live, nstacks);
+}
+
+typedef uint32_t (*leak_metrics_count_fn)(void);
+static leak_metrics_count_fn leak_metrics_nstacks;
+
+static void *leak_metrics_main(void *arg) {
+    (void)arg;
+    uint64_t ms = leak_metrics.tick_ms;
+    while (__atomic_load_n(&leak_metrics.running, __ATOMIC_ACQUIRE)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += (time_t)(ms / 1000);
+        ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        while (sem_timedwait(&leak_metrics.sem, &ts) != 0 && errno == EINTR)
+            ;
+        if (!__atomic_load_n(&leak_metrics.running, __ATOMIC_ACQUIRE)) break;
+        leak_metrics_tick(leak_metrics_nstacks());
+    }
+    return NULL;
+}
+
+static inline void leak_metrics_spawn(void) {
+    if (sem_init(&leak_metrics.sem, 0, 0) != 0) return;
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    __atomic_store_n(&leak_metrics.running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&leak_metrics.thread, NULL, leak_metrics_main, NULL) != 0)
+        leak_metrics.running = 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Function: leak_metrics_start
+ * Create the segment and start the publisher if LEAK_METRICS is set, or
+ * if `watch_ms` is not 0 (the growth detector's interval). `publish`
+ * gets the per-stack sums at the shorter of the two intervals and fills
+ * in the header; `nstacks` gives the highest stack id. Call from the
+ * detector's constructor.
+ */
+static inline void leak_metrics_start(leak_metrics_fn publish, leak_metrics_count_fn nstacks,
+                                      uint64_t watch_ms) {
+    const char *v = getenv("LEAK_METRICS");
+    int shared = v && atoi(v);
+    if (!shared && !watch_ms) return;
+    uint64_t ms = 1000;
+    if ((v = getenv("LEAK_METRICS_MS")) != NULL && atoi(v) > 0) ms = (uint64_t)atoi(v);
+    leak_metrics.tick_ms = shared ? ms : watch_ms;
+    if (shared && watch_ms && watch_ms < ms) leak_metrics.tick_ms = watch_ms;
+    leak_metrics.seg = leak_metrics_map(ms, shared);
+    if (!leak_metrics.seg) return;
+    leak_metrics.shared = shared;
+    leak_metrics.publish = publish;
+    leak_metrics_nstacks = nstacks;
+    leak_metrics_orphan.slot = &leak_metrics.seg->slots[0];
+    leak_metrics.key_ok = pthread_key_create(&leak_metrics.key, leak_metrics_thread_exit) == 0;
+    __atomic_store_n(&leak_metrics.on, 1, __ATOMIC_RELEASE);
+    leak_metrics_spawn();
+}
+
+static inline void leak_metrics_clear_sites(leak_metrics_thread_t *t) {
+    for (size_t c = 0; c < LEAK_METRICS_CHUNKS; ++c)
+        if (t->sites[c])
+            madvise(t->sites[c], sizeof(leak_metrics_live_t) << LEAK_METRICS_CHUNK_BITS,
+                    MADV_DONTNEED);
+}
+
+/* Function: leak_metrics_child
+ * In a child after fork(). A named segment is shared with the parent, so
+ * the child gets its own (a copy with `inherit`, else zeroed) and a
+ * publisher of its own; the other threads are gone, so their tables are
+ * free to take.
+ */
+static inline void leak_metrics_child(int inherit) {
+    if (!leak_metrics.on) return;
+    leak_metrics_seg_t *old = leak_metrics.seg;
+    leak_metrics_seg_t *seg = leak_metrics_map(old->interval_ms, leak_metrics.shared);
+    if (!seg) {
+        leak_metrics.on = 0;
+        leak_metrics.running = 0;
+        return;
+    }
+    if (inherit) memcpy(seg->slots, old->slots, sizeof(seg->slots));
+    for (leak_metrics_thread_t *t = leak_metrics.threads; t; t = t->next) {
+        t->slot = &seg->slots[t->slot - old->slots];
+        if (t != leak_metrics_self) t->state = LEAK_METRICS_FREE;
+        if (!inherit) leak_metrics_clear_sites(t);
+    }
+    if (!inherit) leak_metrics_clear_sites(&leak_metrics_orphan);
+    leak_metrics_orphan.slot = &seg->slots[0];
+    seg->threads = leak_metrics.nthreads;
+    if (!inherit) leak_metrics.sites_dropped = 0;
+    leak_metrics.seg = seg;
+    if (leak_metrics.shared)
+        munmap(old, sizeof(*old));
+    else
+        leak_pages_free(old, sizeof(*old));
+    leak_metrics.running = 0;
+    leak_metrics_spawn();
+}
+
+/* Function: leak_metrics_stop
+ * Stop the publisher and remove the segment's name, if it has one. Call
+ * from the detector's destructor.
+ */
+static inline void leak_metrics_stop(void) {
+    if (!leak_metrics.on) return;
+    if (__atomic_load_n(&leak_metrics.running, __ATOMIC_ACQUIRE)) {
+        __atomic_store_n(&leak_metrics.running, 0, __ATOMIC_RELEASE);
+        sem_post(&leak_metrics.sem);
+        pthread_join(leak_metrics.thread, NULL);
+    }
+    if (leak_metrics.shared) shm_unlink(leak_metrics.name);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_METRICS_H */
@@ -0,0 +1,85 @@
+/* leak_metrics_format.h
+ * Layout of the live metrics segment (LEAK_METRICS=1), shared by the base
+ * detector and leaktop. The detector creates it as POSIX shared memory
+ * named LEAK_METRICS_NAME with its pid; a monitor maps it read-only.
+ *
+ *   header      identity, then the fields the publisher thread rewrites
+ *               every interval: table occupancy, dropped-record counters
+ *               and the sites that grew most since the last interval
+ *   slots       leak_metrics_slot_t[LEAK_METRICS_SLOTS], one per thread,
+ *               each on its own cache lines; totals are their sums
+ *
+ * Slot counters are cumulative and only ever grow, so a reader sums them
+ * whenever it likes and takes rates from the difference of two reads. The
+ * published header fields are guarded by `seq`, odd while they change: a
+ * reader copies them and retries if `seq` was odd or moved meanwhile.
+ */
+#ifndef LEAK_METRICS_FORMAT_H
+#define LEAK_METRICS_FORMAT_H
+
+#include <stdint.h>
+#include "leak_types.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_METRICS_MAGIC "LEAKMET1"
+#define LEAK_METRICS_VERSION 1
+#define LEAK_METRICS_NAME "/leak_metrics.%d"   /* shm_open name, %d: pid */
+#define LEAK_METRICS_SLOTS 128                 /* slot 0: threads past the rest */
+#define LEAK_METRICS_TOP 32
+#define LEAK_METRICS_CALLERS 512
+#define LEAK_METRICS_DROPPED 8
+
+typedef struct {
+    uint64_t allocs, frees;
+    uint64_t alloc_bytes, free_bytes;
+    uint64_t type_allocs[LEAK_T_COUNT];
+    uint64_t type_alloc_bytes[LEAK_T_COUNT];
+    uint64_t type_frees[LEAK_T_COUNT];
+    uint64_t type_free_bytes[LEAK_T_COUNT];
+} __attribute__((aligned(64))) leak_metrics_slot_t;
+
+typedef struct {
+    int64_t bytes, blocks;      /* live from this site */
+    int64_t growth;             /* bytes gained over the last window */
+    uint32_t stack;             /* depot id, for telling sites apart */
+    uint32_t reserved;
+    char callers[LEAK_METRICS_CALLERS];     /* offset@binary,... */
+} leak_metrics_site_t;
+
+typedef struct {
+    char name[16];
+    uint64_t value;
+} leak_metrics_counter_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint32_t nslots;
+    uint32_t ntypes;                        /* LEAK_T_COUNT of the writer */
+    uint64_t sample_bytes;                  /* 0: every block is counted */
+    uint64_t interval_ms;
+    uint64_t start_ns;                      /* CLOCK_MONOTONIC */
+
+    uint64_t seq;
+    uint64_t now_ns;                        /* time of this publication */
+    uint64_t window_ns;                     /* since the previous one */
+    uint64_t table_records, table_slots;
+    uint32_t threads;                       /* slots handed out so far */
+    uint32_t ndropped;
+    leak_metrics_counter_t dropped[LEAK_METRICS_DROPPED];
+    uint32_t nsites;
+    uint32_t reserved;
+    leak_metrics_site_t sites[LEAK_METRICS_TOP];    /* largest growth first */
+
+    leak_metrics_slot_t slots[LEAK_METRICS_SLOTS];
+} leak_metrics_seg_t;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_METRICS_FORMAT_H */
@@ -0,0 +1,227 @@
+/* leak_modules.h
+ * Address -> module lookups for reports, without dladdr.
+ *
+ * dladdr takes the loader lock and searches every module linearly, once
+ * per frame. Instead, the loaded modules' address ranges are kept in a
+ * sorted array, built with dl_iterate_phdr and rebuilt only when the
+ * loader's dlopen/dlclose counters (dlpi_adds, dlpi_subs) have moved; a
+ * lookup is a binary search under a spinlock that is never held across a
+ * loader call.
+ *
+ * Every module gets a permanent id, and its descriptor (load base and
+ * path) is never freed, so a frame resolved to an id while its library
+ * was loaded still names it after a dlclose. The stack depot stores these
+ * ids with each new stack (leak_depot.h).
+ */
+#ifndef LEAK_MODULES_H
+#define LEAK_MODULES_H
+
+#include <link.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "leak_common.h"
+#include "leak_arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_MODULE_CHUNK_BITS 8
+#define LEAK_MODULE_CHUNKS 64           /* up to 16384 modules ever loaded */
+#define LEAK_MODULE_PATHS (64 * 1024)   /* path storage slab */
+
+typedef struct {
+    uintptr_t base;     /* start of the first mapping, dladdr's dli_fbase */
+    uintptr_t hi;       /* end of the last PT_LOAD segment */
+    const char *path;
+} leak_module_t;
+
+typedef struct {
+    uintptr_t lo, hi;
+    uint32_t id;
+} leak_module_range_t;
+
+static struct {
+    leak_lock_t lock;
+    uint32_t count;                             /* ids handed out so far */
+    unsigned long long gen;                     /* dlpi_adds + dlpi_subs of the index */
+    leak_module_range_t *index;                 /* loaded modules, by address */
+    size_t n, cap;
+    char *paths, *paths_end;
+    leak_module_t *dir[LEAK_MODULE_CHUNKS];
+} leak_modules = { LEAK_LOCK_INIT, 0, 0, NULL, 0, 0, NULL, NULL, { NULL } };
+
+/* Function: leak_module_get
+ * Descriptor of module `id`, NULL for 0 or an unknown id.
+ */
+static inline const leak_module_t *leak_module_get(uint32_t id) {
+    if (id == 0 || id > __atomic_load_n(&leak_modules.count, __ATOMIC_ACQUIRE)) return NULL;
+    leak_module_t *chunk = __atomic_load_n(&leak_modules.dir[(id - 1) >> LEAK_MODULE_CHUNK_BITS],
+                                           __ATOMIC_ACQUIRE);
+    return chunk ? &chunk[(id - 1) & ((1u << LEAK_MODULE_CHUNK_BITS) - 1)] : NULL;
+}
+
+/* one module as seen by dl_iterate_phdr, path copied out of the loader */
+typedef struct {
+    uintptr_t lo, hi;
+    char path[1024];
+} leak_module_scan_t;
+
+typedef struct {
+    leak_module_scan_t *m;
+    size_t n, cap;
+    unsigned long long gen;
+} leak_module_scan_list_t;
+
+static int leak_modules_count_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    leak_module_scan_list_t *l = arg;
+    if (!l->n++) l->gen = info->dlpi_adds + info->dlpi_subs;
+    return 0;
+}
+
+static int leak_modules_scan_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    leak_module_scan_list_t *l = arg;
+    if (l->n == l->cap) return 1;
+    uintptr_t lo = UINTPTR_MAX, hi = 0;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD) continue;
+        uintptr_t s = info->dlpi_addr + ph->p_vaddr;
+        if (s < lo) lo = s;
+        if (s + ph->p_memsz > hi) hi = s + ph->p_memsz;
+    }
+    if (hi == 0) return 0;
+    leak_module_scan_t *m = &l->m[l->n++];
+    m->lo = lo & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+    m->hi = hi;
+    if (info->dlpi_name && info->dlpi_name[0]) {
+        size_t k = strlen(info->dlpi_name);
+        if (k >= sizeof(m->path)) k = sizeof(m->path) - 1;
+        memcpy(m->path, info->dlpi_name, k);
+        m->path[k] = '\0';
+    } else {
+        /* the main program reports an empty name */
+        ssize_t k = readlink("/proc/self/exe", m->path, sizeof(m->path) - 1);
+        m->path[k > 0 ? k : 0] = '\0';
+    }
+    return 0;
+}
+
+/* Permanent id for a module loaded at `s`; caller holds the lock. */
+static uint32_t leak_modules_intern(const leak_module_scan_t *s) {
+    for (size_t i = 0; i < leak_modules.n; ++i) {
+        const leak_module_t *m = leak_module_get(leak_modules.index[i].id);
+        if (m && m->base == s->lo && m->hi == s->hi && strcmp(m->path, s->path) == 0)
+            return leak_modules.index[i].id;
+    }
+    uint32_t id = leak_modules.count + 1;
+    size_t chunk = (id - 1) >> LEAK_MODULE_CHUNK_BITS;
+    size_t len = strlen(s->path) + 1;
+    if (chunk >= LEAK_MODULE_CHUNKS || len > LEAK_MODULE_PATHS) return 0;
+    if (!leak_modules.dir[chunk]) {
+        leak_module_t *c = leak_pages_alloc(sizeof(leak_module_t) << LEAK_MODULE_CHUNK_BITS);
+        if (!c) return 0;
+        __atomic_store_n(&leak_modules.dir[chunk], c, __ATOMIC_RELEASE);
+    }
+    if (!leak_modules.paths || (size_t)(leak_modules.paths_end - leak_modules.paths) < len) {
+        char *p = leak_pages_alloc(LEAK_MODULE_PATHS);
+        if (!p) return 0;
+        leak_modules.paths = p;
+        leak_modules.paths_end = p + LEAK_MODULE_PATHS;
+    }
+    leak_module_t *m = &leak_modules.dir[chunk][(id - 1) & ((1u << LEAK_MODULE_CHUNK_BITS) - 1)];
+    memcpy(leak_modules.paths, s->path, len);
+    m->path = leak_modules.paths;
+    m->base = s->lo;
+    m->hi = s->hi;
+    leak_modules.paths += len;
+    __atomic_store_n(&leak_modules.count, id, __ATOMIC_RELEASE);
+    return id;
+}
+
+/* Function: leak_modules_refresh
+ * Rebuild the index if a module was loaded or unloaded since it was last
+ * built. The loader is only called with the lock released: a thread
+ * inside dlopen holds the loader lock and may allocate.
+ */
+static inline void leak_modules_refresh(void) {
+    leak_module_scan_list_t l = { NULL, 0, 0, 0 };
+    dl_iterate_phdr(leak_modules_count_cb, &l);
+    if (__atomic_load_n(&leak_modules.index, __ATOMIC_ACQUIRE) &&
+        l.gen == __atomic_load_n(&leak_modules.gen, __ATOMIC_RELAXED))
+        return;
+    size_t cap = l.n + 16;      /* room for a few dlopens in between */
+    l.cap = cap;
+    l.n = 0;
+    l.m = leak_pages_alloc(cap * sizeof(*l.m));
+    leak_module_range_t *index = leak_pages_alloc(cap * sizeof(*index));
+    if (l.m && index) {
+        dl_iterate_phdr(leak_modules_scan_cb, &l);
+        leak_lock(&leak_modules.lock);
+        size_t k = 0;
+        for (size_t i = 0; i < l.n; ++i) {
+            uint32_t id = leak_modules_intern(&l.m[i]);
+            if (!id) continue;
+            /* insertion sort: a few hundred modules, rebuilt rarely */
+            size_t j = k++;
+            while (j > 0 && index[j - 1].lo > l.m[i].lo) {
+                index[j] = index[j - 1];
+                j--;
+            }
+            index[j].lo = l.m[i].lo;
+            index[j].hi = l.m[i].hi;
+            index[j].id = id;
+        }
+        leak_module_range_t *old = leak_modules.index;
+        size_t old_cap = leak_modules.cap;
+        __atomic_store_n(&leak_modules.index, index, __ATOMIC_RELEASE);
+        leak_modules.n = k;
+        leak_modules.cap = cap;
+        leak_modules.gen = l.gen;
+        leak_unlock(&leak_modules.lock);
+        index = old;
+        cap = old_cap;
+    }
+    leak_pages_free(index, cap * sizeof(*index));
+    leak_pages_free(l.m, l.cap * sizeof(*l.m));
+}
+
+/* Function: leak_module_of
+ * Id of the loaded module holding `addr` in the current index, 0 if none.
+ */
+static inline uint32_t leak_module_of(uintptr_t addr) {
+    uint32_t id = 0;
+    leak_lock(&leak_modules.lock);
+    size_t lo = 0, hi = leak_modules.n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (leak_modules.index[mid].lo <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo && addr < leak_modules.index[lo - 1].hi) id = leak_modules.index[lo - 1].id;
+    leak_unlock(&leak_modules.lock);
+    return id;
+}
+
+/* Function: leak_modules_resolve
+ * Module ids of `depth` frames, refreshing the index once if a frame is
+ * in no known module (it may be in a library loaded since).
+ */
+static inline void leak_modules_resolve(void *const *frames, uint32_t *ids, int depth) {
+    int missing = 0;
+    for (int i = 0; i < depth; ++i)
+        missing |= !(ids[i] = leak_module_of((uintptr_t)frames[i])) && frames[i];
+    if (!missing) return;
+    leak_modules_refresh();
+    for (int i = 0; i < depth; ++i)
+        if (!ids[i]) ids[i] = leak_module_of((uintptr_t)frames[i]);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_MODULES_H */
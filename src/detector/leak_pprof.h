@@ -0,0 +1,482 @@
+/* leak_pprof.h
+ * Heap profiles in pprof's format (gzip'd profile.proto), for LEAK_PPROF.
+ *
+ * One sample per stack depot entry carries four values: alloc_objects and
+ * alloc_space (everything ever allocated from the stack, from the depot's
+ * counters, kept only while leak_pprof_on) and inuse_objects and inuse_space (what the caller still
+ * counts as live). Locations are the raw return addresses, and mappings
+ * are the executable segments of the loaded modules with their GNU
+ * build-ids, so `pprof` can symbolize against the binaries later; names
+ * dladdr() can see are filled in for viewers that do not.
+ *
+ * The protobuf encoder and the gzip container are written by hand to keep
+ * the detector free of dependencies: deflate "stored" blocks only, since
+ * a profile has one entry per distinct stack and stays small. Everything
+ * lives in mmap'd memory, so a profile can be written while the
+ * detector's recursion guard is held.
+ *
+ * Include after leak_depot.h.
+ */
+#ifndef LEAK_PPROF_H
+#define LEAK_PPROF_H
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "leak_arena.h"
+#include "leak_depot.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* LEAK_PPROF is set: the detector keeps the depot's allocation counters */
+static int leak_pprof_on = 0;
+
+/* Function: leak_pprof_init
+ * Read LEAK_PPROF. Call from the detector's constructor.
+ */
+static inline void leak_pprof_init(void) {
+    const char *v = getenv("LEAK_PPROF");
+    leak_pprof_on = v && v[0];
+}
+
+/* ---- protobuf encoding ---- */
+
+typedef struct {
+    uint8_t *p;
+    size_t n, cap;
+    int failed;             /* out of memory: the profile is not written */
+} leak_pb_t;
+
+static inline int leak_pb_reserve(leak_pb_t *b, size_t more) {
+    if (b->failed) return 0;
+    if (b->n + more <= b->cap) return 1;
+    size_t cap = b->cap ? b->cap : 64 * 1024;
+    while (cap < b->n + more) cap *= 2;
+    uint8_t *p = leak_pages_alloc(cap);
+    if (!p) {
+        b->failed = 1;
+        return 0;
+    }
+    if (b->p) {
+        memcpy(p, b->p, b->n);
+        leak_pages_free(b->p, b->cap);
+    }
+    b->p = p;
+    b->cap = cap;
+    return 1;
+}
+
+static inline void leak_pb_free(leak_pb_t *b) {
+    leak_pages_free(b->p, b->cap);
+    memset(b, 0, sizeof(*b));
+}
+
+static inline void leak_pb_varint(leak_pb_t *b, uint64_t v) {
+    if (!leak_pb_reserve(b, 10)) return;
+    while (v >= 0x80) {
+        b->p[b->n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    b->p[b->n++] = (uint8_t)v;
+}
+
+/* varint field; zero is the default and is left out */
+static inline void leak_pb_uint(leak_pb_t *b, unsigned field, uint64_t v) {
+    if (!v) return;
+    leak_pb_varint(b, (uint64_t)field << 3);
+    leak_pb_varint(b, v);
+}
+
+static inline void leak_pb_bytes(leak_pb_t *b, unsigned field, const void *p, size_t len) {
+    leak_pb_varint(b, (uint64_t)field << 3 | 2);
+    leak_pb_varint(b, len);
+    if (!leak_pb_reserve(b, len)) return;
+    memcpy(b->p + b->n, p, len);
+    b->n += len;
+}
+
+/* a nested message built in `msg`, which is emptied for the next one */
+static inline void leak_pb_msg(leak_pb_t *b, unsigned field, leak_pb_t *msg) {
+    if (msg->failed) b->failed = 1;
+    leak_pb_bytes(b, field, msg->p, msg->n);
+    msg->n = 0;
+}
+
+/* ---- string table ---- */
+
+typedef struct {
+    const char **str;       /* index -> string; 0 is "" */
+    size_t n, cap;
+    uint32_t *slots;        /* open addressing, index + 1 */
+    size_t mask;
+    int failed;
+} leak_pprof_strings_t;
+
+static inline uint64_t leak_pprof_strhash(const char *s) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (; *s; ++s) h = (h ^ (uint8_t)*s) * 0x100000001b3ULL;
+    return h;
+}
+
+static inline int leak_pprof_strings_grow(leak_pprof_strings_t *t) {
+    size_t cap = t->cap ? t->cap * 2 : 1024;
+    const char **str = leak_pages_alloc(cap * sizeof(*str));
+    uint32_t *slots = leak_pages_alloc(2 * cap * sizeof(*slots));
+    if (!str || !slots) {
+        leak_pages_free(str, cap * sizeof(*str));
+        leak_pages_free(slots, 2 * cap * sizeof(*slots));
+        t->failed = 1;
+        return 0;
+    }
+    if (t->str) memcpy(str, t->str, t->n * sizeof(*str));
+    for (size_t i = 0; i < t->n; ++i) {
+        size_t j = leak_pprof_strhash(str[i]) & (2 * cap - 1);
+        while (slots[j]) j = (j + 1) & (2 * cap - 1);
+        slots[j] = (uint32_t)i + 1;
+    }
+    leak_pages_free(t->str, t->cap * sizeof(*str));
+    leak_pages_free(t->slots, 2 * t->cap * sizeof(*slots));
+    t->str = str;
+    t->slots = slots;
+    t->cap = cap;
+    t->mask = 2 * cap - 1;
+    return 1;
+}
+
+/* Function: leak_pprof_string
+ * Index of `s` in the string table, adding it if new. `s` must stay valid
+ * until the profile is written.
+ */
+static inline uint64_t leak_pprof_string(leak_pprof_strings_t *t, const char *s) {
+    if (!s || !s[0]) return 0;
+    if (t->n + 1 > t->cap && !leak_pprof_strings_grow(t)) return 0;
+    if (!t->n) t->str[t->n++] = "";
+    size_t j = leak_pprof_strhash(s) & t->mask;
+    for (; t->slots[j]; j = (j + 1) & t->mask)
+        if (strcmp(t->str[t->slots[j] - 1], s) == 0) return t->slots[j] - 1;
+    t->str[t->n] = s;
+    t->slots[j] = (uint32_t)++t->n;
+    return t->n - 1;
+}
+
+static inline void leak_pprof_strings_free(leak_pprof_strings_t *t) {
+    leak_pages_free(t->str, t->cap * sizeof(*t->str));
+    leak_pages_free(t->slots, 2 * t->cap * sizeof(*t->slots));
+    memset(t, 0, sizeof(*t));
+}
+
+/* ---- mappings ---- */
+
+#define LEAK_PPROF_MAX_MAPPINGS 1024
+
+typedef struct {
+    uint64_t start, limit, offset;
+    char path[512];
+    char build_id[41];
+} leak_pprof_mapping_t;
+
+typedef struct {
+    leak_pprof_mapping_t *m;
+    size_t n;
+} leak_pprof_mappings_t;
+
+static inline void leak_pprof_build_id(const struct dl_phdr_info *info, char out[41]) {
+    out[0] = '\0';
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_NOTE) continue;
+        const uint8_t *p = (const uint8_t *)(info->dlpi_addr + ph->p_vaddr);
+        const uint8_t *end = p + ph->p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *nh = (const ElfW(Nhdr) *)p;
+            const uint8_t *name = p + sizeof(*nh);
+            const uint8_t *desc = name + ((nh->n_namesz + 3) & ~3u);
+            if (desc + nh->n_descsz > end) break;
+            if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 &&
+                memcmp(name, "GNU", 4) == 0) {
+                size_t k = 0;
+                for (uint32_t j = 0; j < nh->n_descsz && k + 2 < 41; ++j, k += 2) {
+                    static const char hex[] = "0123456789abcdef";
+                    out[k] = hex[desc[j] >> 4];
+                    out[k + 1] = hex[desc[j] & 15];
+                }
+                out[k] = '\0';
+                return;
+            }
+            p = desc + ((nh->n_descsz + 3) & ~3u);
+        }
+    }
+}
+
+static int leak_pprof_module_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    leak_pprof_mappings_t *ms = arg;
+    char build_id[41];
+    int have_id = 0;
+    for (int i = 0; i < info->dlpi_phnum && ms->n < LEAK_PPROF_MAX_MAPPINGS; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD || !(ph->p_flags & PF_X)) continue;
+        if (!have_id++) leak_pprof_build_id(info, build_id);
+        leak_pprof_mapping_t *m = &ms->m[ms->n++];
+        uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE);
+        m->start = (info->dlpi_addr + ph->p_vaddr) & ~(page - 1);
+        m->limit = info->dlpi_addr + ph->p_vaddr + ph->p_memsz;
+        m->offset = ph->p_offset & ~(page - 1);
+        if (info->dlpi_name && info->dlpi_name[0]) {
+            snprintf(m->path, sizeof(m->path), "%s", info->dlpi_name);
+        } else {
+            /* the main program reports an empty name */
+            ssize_t n = readlink("/proc/self/exe", m->path, sizeof(m->path) - 1);
+            m->path[n > 0 ? n : 0] = '\0';
+        }
+        memcpy(m->build_id, build_id, sizeof(build_id));
+    }
+    return 0;
+}
+
+static int leak_pprof_mapping_cmp(const void *x, const void *y) {
+    const leak_pprof_mapping_t *a = x, *b = y;
+    return a->start < b->start ? -1 : a->start > b->start;
+}
+
+/* Mapping id (1-based) holding `addr`, 0 if none. */
+static inline uint64_t leak_pprof_mapping_of(const leak_pprof_mappings_t *ms, uint64_t addr) {
+    size_t lo = 0, hi = ms->n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (ms->m[mid].start <= addr) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo && addr < ms->m[lo - 1].limit ? lo : 0;
+}
+
+/* ---- gzip ---- */
+
+static inline uint32_t leak_crc32(uint32_t crc, const uint8_t *p, size_t n) {
+    static uint32_t table[256];
+    if (!table[1]) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            table[i] = c;
+        }
+    }
+    crc = ~crc;
+    for (size_t i = 0; i < n; ++i) crc = table[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static inline int leak_write_all(int fd, const void *p, size_t n) {
+    const char *c = p;
+    while (n) {
+        ssize_t w = write(fd, c, n);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) return 0;
+        c += w;
+        n -= (size_t)w;
+    }
+    return 1;
+}
+
+/* Function: leak_gzip_write
+ * Write `n` bytes to `fd` as a gzip member of stored deflate blocks.
+ * Returns 1 on success.
+ */
+static inline int leak_gzip_write(int fd, const uint8_t *p, size_t n) {
+    static const uint8_t header[10] = { 0x1f, 0x8b, 8, 0, 0, 0, 0, 0, 0, 3 };
+    if (!leak_write_all(fd, header, sizeof(header))) return 0;
+    size_t off = 0;
+    do {
+        size_t len = n - off > 65535 ? 65535 : n - off;
+        uint8_t blk[5] = { off + len == n, (uint8_t)len, (uint8_t)(len >> 8),
+                           (uint8_t)~len, (uint8_t)(~len >> 8) };
+        if (!leak_write_all(fd, blk, sizeof(blk)) || !leak_write_all(fd, p + off, len)) return 0;
+        off += len;
+    } while (off < n);
+    uint32_t crc = leak_crc32(0, p, n), size = (uint32_t)n;
+    uint8_t trailer[8];
+    for (int i = 0; i < 4; ++i) {
+        trailer[i] = (uint8_t)(crc >> (8 * i));
+        trailer[4 + i] = (uint8_t)(size >> (8 * i));
+    }
+    return leak_write_all(fd, trailer, sizeof(trailer));
+}
+
+/* ---- profile ---- */
+
+/* in-use totals of one stack, filled in by the caller */
+typedef struct {
+    double objects;
+    double bytes;
+} leak_pprof_inuse_t;
+
+/* address -> location id, open addressing */
+typedef struct {
+    uint64_t addr;
+    uint64_t id;
+} leak_pprof_loc_t;
+
+static inline void leak_pprof_value_type(leak_pb_t *b, leak_pb_t *msg, unsigned field,
+                                         leak_pprof_strings_t *st, const char *type,
+                                         const char *unit) {
+    leak_pb_uint(msg, 1, leak_pprof_string(st, type));
+    leak_pb_uint(msg, 2, leak_pprof_string(st, unit));
+    leak_pb_msg(b, field, msg);
+}
+
+/* Function: leak_pprof_write
+ * Write a profile of every stack in the depot to `path`. `inuse` has one
+ * entry per stack id up to `nstacks` (entry 0: blocks without a stack);
+ * stacks with nothing allocated or live are left out. `period` is the
+ * sampling interval in bytes, 0 if every allocation was recorded.
+ * Returns 1 if the file was written.
+ */
+static inline int leak_pprof_write(const char *path, const leak_pprof_inuse_t *inuse,
+                                   uint32_t nstacks, size_t period) {
+    leak_pb_t out = { 0 }, msg = { 0 }, sub = { 0 };
+    leak_pprof_strings_t st = { 0 };
+    leak_pprof_mappings_t ms = { 0 };
+    size_t frames = 0;
+    for (uint32_t id = 1; id <= nstacks; ++id) {
+        const leak_stack_t *s = leak_depot_get(id);
+        if (s) frames += s->depth;
+    }
+    size_t nloc_slots = 1024;
+    while (nloc_slots < frames * 2) nloc_slots *= 2;
+    leak_pprof_loc_t *locs = leak_pages_alloc(nloc_slots * sizeof(*locs));
+    ms.m = leak_pages_alloc(LEAK_PPROF_MAX_MAPPINGS * sizeof(*ms.m));
+    /* string index -> function id; every string is a sample type, a
+     * mapping's path or build-id, or one location's function name */
+    size_t nfn_slots = nloc_slots + 2 * LEAK_PPROF_MAX_MAPPINGS + 16;
+    uint32_t *fn_ids = leak_pages_alloc(nfn_slots * sizeof(*fn_ids));
+    uint64_t nlocs = 0;
+    uint32_t nfns = 0;
+    int ok = 0;
+    if (!locs || !ms.m || !fn_ids) goto done;
+
+    dl_iterate_phdr(leak_pprof_module_cb, &ms);
+    qsort(ms.m, ms.n, sizeof(*ms.m), leak_pprof_mapping_cmp);
+
+    leak_pprof_value_type(&out, &msg, 1, &st, "alloc_objects", "count");
+    leak_pprof_value_type(&out, &msg, 1, &st, "alloc_space", "bytes");
+    leak_pprof_value_type(&out, &msg, 1, &st, "inuse_objects", "count");
+    leak_pprof_value_type(&out, &msg, 1, &st, "inuse_space", "bytes");
+
+    for (uint32_t id = 0; id <= nstacks; ++id) {
+        const leak_stack_t *s = leak_depot_get(id);
+        const leak_stack_counts_t *c = leak_depot_counts(id);
+        double aobj = 0, abytes = 0;
+        if (c) {
+            uint64_t allocs = __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+            uint64_t bytes = __atomic_load_n(&c->bytes, __ATOMIC_RELAXED);
+            abytes = (double)__atomic_load_n(&c->est, __ATOMIC_RELAXED);
+            /* a sampled block of s bytes stands for est/s blocks */
+            aobj = bytes ? (double)allocs * abytes / (double)bytes : (double)allocs;
+        }
+        /* blocks without a stack are only known while they live */
+        if (!s) {
+            aobj = inuse[id].objects;
+            abytes = inuse[id].bytes;
+        }
+        if (aobj < 0.5 && inuse[id].objects < 0.5) continue;
+
+        /* the leaf is the allocating code, not the detector */
+        for (uint32_t j = s ? leak_stack_skip_self(s) : 0; s && j < s->depth; ++j) {
+            uint64_t addr = (uint64_t)(uintptr_t)s->frames[j];
+            size_t k = (size_t)((addr * 0x9e3779b97f4a7c15ULL) >> 20) & (nloc_slots - 1);
+            while (locs[k].id && locs[k].addr != addr) k = (k + 1) & (nloc_slots - 1);
+            if (!locs[k].id) {
+                locs[k].addr = addr;
+                locs[k].id = ++nlocs;
+            }
+            leak_pb_varint(&sub, locs[k].id);
+        }
+        if (sub.n) leak_pb_bytes(&msg, 1, sub.p, sub.n);
+        sub.n = 0;
+        leak_pb_varint(&sub, (uint64_t)(aobj + 0.5));
+        leak_pb_varint(&sub, (uint64_t)(abytes + 0.5));
+        leak_pb_varint(&sub, (uint64_t)(inuse[id].objects + 0.5));
+        leak_pb_varint(&sub, (uint64_t)(inuse[id].bytes + 0.5));
+        leak_pb_bytes(&msg, 2, sub.p, sub.n);
+        sub.n = 0;
+        leak_pb_msg(&out, 2, &msg);
+    }
+
+    for (size_t i = 0; i < ms.n; ++i) {
+        const leak_pprof_mapping_t *m = &ms.m[i];
+        leak_pb_uint(&msg, 1, i + 1);
+        leak_pb_uint(&msg, 2, m->start);
+        leak_pb_uint(&msg, 3, m->limit);
+        leak_pb_uint(&msg, 4, m->offset);
+        leak_pb_uint(&msg, 5, leak_pprof_string(&st, m->path));
+        leak_pb_uint(&msg, 6, leak_pprof_string(&st, m->build_id));
+        leak_pb_msg(&out, 3, &msg);
+    }
+
+    /* dladdr only knows the nearest dynamic symbol, so pprof (which sees
+     * has_functions unset) refines these names; function ids must be dense
+     * for it to add its own */
+    for (size_t k = 0; k < nloc_slots; ++k) {
+        if (!locs[k].id) continue;
+        leak_pb_uint(&msg, 1, locs[k].id);
+        leak_pb_uint(&msg, 2, leak_pprof_mapping_of(&ms, locs[k].addr));
+        leak_pb_uint(&msg, 3, locs[k].addr);
+        Dl_info info;
+        uint64_t name;
+        if (dladdr((void *)(uintptr_t)locs[k].addr, &info) && info.dli_sname &&
+            (name = leak_pprof_string(&st, info.dli_sname)) < nfn_slots) {
+            if (!fn_ids[name]) {
+                fn_ids[name] = ++nfns;
+                leak_pb_t fn = { 0 };
+                leak_pb_uint(&fn, 1, nfns);
+                leak_pb_uint(&fn, 2, name);
+                leak_pb_uint(&fn, 3, name);
+                leak_pb_msg(&out, 5, &fn);
+                leak_pb_free(&fn);
+            }
+            leak_pb_uint(&sub, 1, fn_ids[name]);
+            leak_pb_msg(&msg, 4, &sub);
+        }
+        leak_pb_msg(&out, 4, &msg);
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    leak_pb_uint(&out, 9, (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec);
+    leak_pprof_value_type(&out, &msg, 11, &st, "space", "bytes");
+    leak_pb_uint(&out, 12, period);
+    leak_pb_uint(&out, 14, leak_pprof_string(&st, "inuse_space"));
+
+    /* the table is complete only now that every index was handed out */
+    for (size_t i = 0; i < st.n; ++i) leak_pb_bytes(&out, 6, st.str[i], strlen(st.str[i]));
+
+    if (out.failed || msg.failed || sub.failed || st.failed) goto done;
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) goto done;
+    ok = leak_gzip_write(fd, out.p, out.n);
+    if (close(fd) != 0) ok = 0;
+done:
+    leak_pb_free(&out);
+    leak_pb_free(&msg);
+    leak_pb_free(&sub);
+    leak_pprof_strings_free(&st);
+    leak_pages_free(locs, nloc_slots * sizeof(*locs));
+    leak_pages_free(fn_ids, nfn_slots * sizeof(*fn_ids));
+    leak_pages_free(ms.m, LEAK_PPROF_MAX_MAPPINGS * sizeof(*ms.m));
+    return ok;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_PPROF_H */
@@ -0,0 +1,153 @@
+/* leak_report_bin.h
+ * Writer of the binary leak report (leak_report_format.h), for
+ * LEAK_REPORT_FORMAT=bin.
+ *
+ * Only the stacks, modules and strings the sites refer to are written,
+ * each once, with a stack's frames as varint (module, offset) pairs in
+ * the protobuf encoding of leak_pprof.h. Everything is built in mmap'd
+ * memory, so the report can be written while the detector's recursion
+ * guard is held.
+ *
+ * Include after leak_pprof.h.
+ */
+#ifndef LEAK_REPORT_BIN_H
+#define LEAK_REPORT_BIN_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "leak_arena.h"
+#include "leak_depot.h"
+#include "leak_modules.h"
+#include "leak_types.h"
+#include "leak_report_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static inline void leak_report_put(leak_pb_t *b, const void *p, size_t n) {
+    if (!leak_pb_reserve(b, n)) return;
+    memcpy(b->p + b->n, p, n);
+    b->n += n;
+}
+
+static inline uint32_t leak_report_put_string(leak_pb_t *strings, const char *s) {
+    uint32_t off = (uint32_t)strings->n;
+    leak_report_put(strings, s, strlen(s) + 1);
+    return off;
+}
+
+static inline int leak_report_write_section(FILE *f, const void *p, size_t n) {
+    static const char pad[8];
+    if (n && fwrite(p, 1, n, f) != n) return 0;
+    return (n & 7) == 0 || fwrite(pad, 1, 8 - (n & 7), f) == 8 - (n & 7);
+}
+
+/* Function: leak_report_bin_write
+ * Write `nsites` sites, largest first, whose `stack` fields hold stack
+ * depot ids (rewritten here to stack indexes), and the `nblocks` blocks
+ * they index. Returns 0 if memory or the write failed.
+ */
+static inline int leak_report_bin_write(FILE *f, leak_report_site_t *sites, size_t nsites,
+                                        const leak_report_block_t *blocks, size_t nblocks,
+                                        size_t sample_bytes) {
+    uint32_t ndepot = __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE);
+    uint32_t nmod = __atomic_load_n(&leak_modules.count, __ATOMIC_ACQUIRE);
+    size_t stack_map_len = ((size_t)ndepot + 1) * sizeof(uint32_t);
+    size_t mod_map_len = ((size_t)nmod + 1) * sizeof(uint32_t);
+    uint32_t *stack_map = leak_pages_alloc(stack_map_len);   /* depot id -> index + 1 */
+    uint32_t *mod_map = leak_pages_alloc(mod_map_len);       /* module id -> index + 1 */
+    leak_pb_t stacks = { 0 }, data = { 0 }, modules = { 0 }, types = { 0 }, strings = { 0 };
+    int ok = 0;
+    if (!stack_map || !mod_map) goto out;
+
+    leak_report_put_string(&strings, "");
+    for (unsigned t = 0; t < LEAK_T_COUNT; ++t) {
+        uint32_t off = leak_report_put_string(&strings, leak_type_name(t));
+        leak_report_put(&types, &off, sizeof(off));
+    }
+    uint64_t zero = 0;
+    leak_report_put(&stacks, &zero, sizeof(zero));
+    uint32_t nstacks = 0, nmodules = 0;
+    for (size_t i = 0; i < nsites; ++i) {
+        uint32_t id = sites[i].stack;
+        const leak_stack_t *st = id <= ndepot ? leak_depot_get(id) : NULL;
+        if (!st) {
+            sites[i].stack = LEAK_REPORT_NONE;
+            continue;
+        }
+        if (!stack_map[id]) {
+            const uint32_t *ids = leak_stack_modules(st);
+            for (uint32_t j = 0; j < st->depth; ++j) {
+                uintptr_t addr = (uintptr_t)st->frames[j];
+                uint32_t mid = ids[j] ? ids[j] : leak_module_of(addr);
+                const leak_module_t *m = mid <= nmod ? leak_module_get(mid) : NULL;
+                if (!m) {
+                    leak_pb_varint(&data, 0);
+                    leak_pb_varint(&data, addr);
+                    continue;
+                }
+                if (!mod_map[mid]) {
+                    uint32_t off = leak_report_put_string(&strings, m->path);
+                    leak_report_put(&modules, &off, sizeof(off));
+                    mod_map[mid] = ++nmodules;
+                }
+                leak_pb_varint(&data, mod_map[mid]);
+                leak_pb_varint(&data, addr - m->base);
+            }
+            uint64_t end = data.n;
+            leak_report_put(&stacks, &end, sizeof(end));
+            stack_map[id] = ++nstacks;
+        }
+        sites[i].stack = stack_map[id] - 1;
+    }
+    if (stacks.failed || data.failed || modules.failed || types.failed || strings.failed)
+        goto out;
+
+    leak_report_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LEAK_REPORT_MAGIC, 8);
+    h.version = LEAK_REPORT_VERSION;
+    h.pid = (uint32_t)getpid();
+    h.sample_bytes = sample_bytes;
+    uint64_t off = sizeof(h);
+#define LEAK_REPORT_SECTION(s, count, bytes)    \
+    do {                                        \
+        h.s.off = off;                          \
+        h.s.n = (count);                        \
+        off += ((uint64_t)(bytes) + 7) & ~7ULL; \
+    } while (0)
+    LEAK_REPORT_SECTION(sites, nsites, nsites * sizeof(*sites));
+    LEAK_REPORT_SECTION(blocks, nblocks, nblocks * sizeof(*blocks));
+    LEAK_REPORT_SECTION(stacks, nstacks + 1, stacks.n);
+    LEAK_REPORT_SECTION(stack_data, data.n, data.n);
+    LEAK_REPORT_SECTION(modules, nmodules, modules.n);
+    LEAK_REPORT_SECTION(types, LEAK_T_COUNT, types.n);
+    LEAK_REPORT_SECTION(strings, strings.n, strings.n);
+#undef LEAK_REPORT_SECTION
+    ok = leak_report_write_section(f, &h, sizeof(h)) &&
+         leak_report_write_section(f, sites, nsites * sizeof(*sites)) &&
+         leak_report_write_section(f, blocks, nblocks * sizeof(*blocks)) &&
+         leak_report_write_section(f, stacks.p, stacks.n) &&
+         leak_report_write_section(f, data.p, data.n) &&
+         leak_report_write_section(f, modules.p, modules.n) &&
+         leak_report_write_section(f, types.p, types.n) &&
+         leak_report_write_section(f, strings.p, strings.n);
+out:
+    leak_pages_free(stack_map, stack_map_len);
+    leak_pages_free(mod_map, mod_map_len);
+    leak_pb_free(&stacks);
+    leak_pb_free(&data);
+    leak_pb_free(&modules);
+    leak_pb_free(&types);
+    leak_pb_free(&strings);
+    return ok;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_REPORT_BIN_H */
@@ -0,0 +1,169 @@
+/* leak_report_format.h
+ * On-disk layout of the binary leak report (LEAK_REPORT_FORMAT=bin),
+ * shared by the base detector and the offline tools.
+ *
+ * The text report repeats every frame's binary path on every line; this
+ * one stores each path and type name once in a string table, each stack
+ * once as varint (module, offset) pairs, and the leaks as fixed-width
+ * records, so a reader maps the file and uses it in place:
+ *
+ *   header      leak_report_header_t, section offsets from file start
+ *   sites       leak_report_site_t[], largest first (as in the text
+ *               report); site i owns blocks [first, first + count)
+ *   blocks      leak_report_block_t[], grouped by site
+ *   stacks      uint64_t[n + 1], stack i is stack_data[off[i], off[i+1])
+ *   stack_data  per frame: varint module index + 1 (0: no module), then
+ *               varint offset within the module (or the raw address)
+ *   modules     uint32_t[], offset of each module path in strings
+ *   types       uint32_t[], offset of each kind name (leak_types.h order)
+ *   strings     NUL-terminated strings
+ *
+ * Every section starts 8-byte aligned. Readers check the magic, the
+ * version and that each section lies inside the file before using it.
+ */
+#ifndef LEAK_REPORT_FORMAT_H
+#define LEAK_REPORT_FORMAT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_REPORT_MAGIC "LEAKRPT1"
+#define LEAK_REPORT_VERSION 1
+#define LEAK_REPORT_NONE UINT32_MAX     /* site without a stack */
+
+typedef struct {
+    uint64_t off;           /* from the start of the file */
+    uint64_t n;             /* entries (bytes for stack_data and strings) */
+} leak_report_section_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint64_t sample_bytes;  /* LEAK_SAMPLE_BYTES, 0 if every block is tracked */
+    leak_report_section_t sites, blocks, stacks, stack_data, modules, types, strings;
+} leak_report_header_t;
+
+typedef struct {
+    uint64_t count, bytes;
+    uint64_t est;           /* bytes scaled back up in sampling mode */
+    uint64_t min, max;
+    uint64_t first;         /* first block of the site */
+    uint32_t stack;         /* stack index, LEAK_REPORT_NONE if unknown */
+    uint32_t type;          /* types index */
+} leak_report_site_t;
+
+typedef struct {
+    uint64_t ptr, size;
+} leak_report_block_t;
+
+static inline int leak_report_section_ok(const leak_report_section_t *s, size_t elem,
+                                         size_t len) {
+    return s->off % 8 == 0 && s->off <= len && s->n <= (len - s->off) / elem;
+}
+
+/* Function: leak_report_check
+ * The header of the report mapped at `p` (`len` bytes), or NULL if it is
+ * not a binary report this reader understands or a section is truncated.
+ */
+static inline const leak_report_header_t *leak_report_check(const void *p, size_t len) {
+    const leak_report_header_t *h = (const leak_report_header_t *)p;
+    if (len < sizeof(*h) || memcmp(h->magic, LEAK_REPORT_MAGIC, 8) != 0 ||
+        h->version != LEAK_REPORT_VERSION)
+        return NULL;
+    if (!leak_report_section_ok(&h->sites, sizeof(leak_report_site_t), len) ||
+        !leak_report_section_ok(&h->blocks, sizeof(leak_report_block_t), len) ||
+        !leak_report_section_ok(&h->stacks, sizeof(uint64_t), len) || h->stacks.n == 0 ||
+        !leak_report_section_ok(&h->stack_data, 1, len) ||
+        !leak_report_section_ok(&h->modules, sizeof(uint32_t), len) ||
+        !leak_report_section_ok(&h->types, sizeof(uint32_t), len) ||
+        !leak_report_section_ok(&h->strings, 1, len) || h->strings.n == 0 ||
+        ((const char *)p)[h->strings.off + h->strings.n - 1] != '\0')
+        return NULL;
+    return h;
+}
+
+/* string `off` of the report, "" if out of range */
+static inline const char *leak_report_string(const leak_report_header_t *h, uint32_t off) {
+    return off < h->strings.n ? (const char *)h + h->strings.off + off : "";
+}
+
+static inline const char *leak_report_module(const leak_report_header_t *h, uint64_t i) {
+    return i < h->modules.n
+               ? leak_report_string(h, ((const uint32_t *)((const char *)h + h->modules.off))[i])
+               : "-";
+}
+
+static inline const char *leak_report_type(const leak_report_header_t *h, uint32_t i) {
+    return i < h->types.n
+               ? leak_report_string(h, ((const uint32_t *)((const char *)h + h->types.off))[i])
+               : "-";
+}
+
+/* Function: leak_report_stack
+ * Encoded frames of stack `i` in [*p, *end); 0 if there is no such stack.
+ */
+static inline int leak_report_stack(const leak_report_header_t *h, uint32_t i,
+                                    const uint8_t **p, const uint8_t **end) {
+    if (i >= h->stacks.n - 1) return 0;
+    const uint64_t *off = (const uint64_t *)((const char *)h + h->stacks.off);
+    if (off[i] > off[i + 1] || off[i + 1] > h->stack_data.n) return 0;
+    const uint8_t *data = (const uint8_t *)h + h->stack_data.off;
+    *p = data + off[i];
+    *end = data + off[i + 1];
+    return 1;
+}
+
+/* Function: leak_report_frame
+ * Decode the next frame at `*p`: its module index + 1 (0: none) and its
+ * offset. Returns 0 at the end of the stack or on a truncated varint.
+ */
+static inline int leak_report_frame(const uint8_t **p, const uint8_t *end, uint64_t *module,
+                                    uint64_t *off) {
+    uint64_t v[2];
+    for (int k = 0; k < 2; ++k) {
+        v[k] = 0;
+        for (unsigned shift = 0;; shift += 7) {
+            if (*p >= end || shift > 63) return 0;
+            uint8_t b = *(*p)++;
+            v[k] |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) break;
+        }
+    }
+    *module = v[0];
+    *off = v[1];
+    return 1;
+}
+
+/* Function: leak_report_callers
+ * Write stack `i` into `buf` in the text reports' callers syntax
+ * (comma-separated offset@binary, "-" for no stack), truncated to `len`.
+ * Returns the length of the whole string, as snprintf does.
+ */
+static inline size_t leak_report_callers(const leak_report_header_t *h, uint32_t i, char *buf,
+                                         size_t len) {
+    const uint8_t *p, *end;
+    uint64_t module, off;
+    size_t n = 0;
+    if (len) buf[0] = '\0';
+    if (!leak_report_stack(h, i, &p, &end) || p == end) return (size_t)snprintf(buf, len, "-");
+    for (int j = 0; leak_report_frame(&p, end, &module, &off); ++j) {
+        int k = snprintf(n < len ? buf + n : NULL, n < len ? len - n : 0, "%s0x%llx@%s",
+                         j ? "," : "", (unsigned long long)off,
+                         module ? leak_report_module(h, module - 1) : "-");
+        if (k > 0) n += (size_t)k;
+    }
+    return n;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_REPORT_FORMAT_H */
@@ -0,0 +1,85 @@
+/* leak_sample.h
+ * Byte-based allocation sampling (LEAK_SAMPLE_BYTES=N).
+ *
+ * Sample points are placed on the stream of allocated bytes with
+ * exponentially distributed gaps of mean N, so an allocation of s bytes
+ * is recorded with probability p(s) = 1 - exp(-s/N). Each thread keeps its
+ * own countdown; an unsampled allocation costs one subtraction and skips
+ * both the backtrace and the table insert. Reports turn each sampled block
+ * back into s / p(s) bytes, which is an unbiased estimate of what its
+ * unsampled neighbours from the same site allocated.
+ */
+#ifndef LEAK_SAMPLE_H
+#define LEAK_SAMPLE_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+static size_t leak_sample_bytes = 0;            /* 0: record everything */
+static __thread int64_t leak_sample_left = 0;   /* bytes until the next sample point */
+static __thread uint64_t leak_sample_rng = 0;
+
+/* Function: leak_sample_init
+ * Read LEAK_SAMPLE_BYTES. Call from the detector's constructor.
+ */
+static inline void leak_sample_init(void) {
+    const char *v = getenv("LEAK_SAMPLE_BYTES");
+    if (v) leak_sample_bytes = strtoull(v, NULL, 10);
+}
+
+/* Exponential gap with mean leak_sample_bytes (xorshift64* for U). */
+static inline int64_t leak_sample_next(void) {
+    if (!leak_sample_rng)
+        leak_sample_rng = ((uint64_t)(uintptr_t)&leak_sample_rng * 0x9e3779b97f4a7c15ULL) | 1;
+    leak_sample_rng ^= leak_sample_rng >> 12;
+    leak_sample_rng ^= leak_sample_rng << 25;
+    leak_sample_rng ^= leak_sample_rng >> 27;
+    uint64_t r = leak_sample_rng * 0x2545f4914f6cdd1dULL;
+    double u = ((r >> 11) + 1) * (1.0 / 9007199254740993.0);   /* (0, 1] */
+    return (int64_t)(-log(u) * (double)leak_sample_bytes) + 1;
+}
+
+static __attribute__((noinline)) int leak_sample_slow(size_t size) {
+    if (!leak_sample_rng) {
+        /* first allocation of this thread: place its first sample point */
+        leak_sample_left = leak_sample_next();
+        if ((int64_t)size < leak_sample_left) {
+            leak_sample_left -= (int64_t)size;
+            return 0;
+        }
+    }
+    /* the process is memoryless, so the next gap starts after this block */
+    leak_sample_left = leak_sample_next();
+    return 1;
+}
+
+/* Function: leak_sample_take
+ * Returns 1 if an allocation of `size` bytes should be recorded.
+ */
+static inline int leak_sample_take(size_t size) {
+    if (!leak_sample_bytes) return 1;
+    if ((int64_t)size < leak_sample_left) {
+        leak_sample_left -= (int64_t)size;
+        return 0;
+    }
+    return leak_sample_slow(size);
+}
+
+/* Function: leak_sample_estimate
+ * Bytes a recorded block of `size` stands for: s / (1 - exp(-s/N)).
+ */
+static inline double leak_sample_estimate(size_t size) {
+    if (!leak_sample_bytes || size == 0) return (double)size;
+    return (double)size / -expm1(-(double)size / (double)leak_sample_bytes);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_SAMPLE_H */
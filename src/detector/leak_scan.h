@@ -0,0 +1,411 @@
+/* leak_scan.h
+ * Conservative reachability scan at exit, in the style of LeakSanitizer.
+ *
+ * Roots are the writable PT_LOAD segments and TLS blocks of every loaded
+ * module (dl_iterate_phdr), the calling thread's stack above the frame
+ * the caller names, and the stacks of the other threads that registered with
+ * leak_scan_register_thread(). Every aligned pointer-sized word in a root
+ * or in a reachable block that points into a tracked block (interior
+ * pointers included) marks that block reachable; whatever is left
+ * unmarked is a definite leak.
+ *
+ * The blocks are radix-sorted by start address, and looked up through a
+ * bucket index over the heap's address range (at most about two buckets
+ * per block) that narrows the binary search to a few entries. The mark
+ * phase runs in rounds: each round's blocks are handed out in chunks to
+ * up to LEAK_SCAN_THREADS threads, which follow pointers depth-first
+ * with a bounded private stack and pass any overflow on to the next
+ * round.
+ *
+ * Other threads are not stopped; their stacks are read whole, as found,
+ * which only errs towards "reachable". Memory the program maps itself is
+ * not a root.
+ *
+ * Include after leak_unwind.h: registration reuses its stack bounds.
+ */
+#ifndef LEAK_SCAN_H
+#define LEAK_SCAN_H
+
+#include <errno.h>
+#include <link.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "leak_common.h"
+#include "leak_arena.h"
+#include "leak_unwind.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_SCAN_CHUNK 256        /* blocks handed out per grab */
+#define LEAK_SCAN_LOCAL 4096       /* private DFS stack before spilling */
+#define LEAK_SCAN_MAX_THREADS 64
+
+typedef struct {
+    uintptr_t lo, hi;
+} leak_range_t;
+
+/* ---- thread registry ---- */
+
+typedef struct {
+    uintptr_t lo, hi;
+    int live;
+} leak_scan_thread_t;
+
+static int leak_scan_enabled = 1;
+static leak_lock_t leak_scan_threads_lock = LEAK_LOCK_INIT;
+static leak_scan_thread_t *leak_scan_threads;
+static size_t leak_scan_nthreads, leak_scan_cap_threads;
+static pthread_key_t leak_scan_key;
+static int leak_scan_key_ok;
+static __thread size_t leak_scan_slot;     /* registry index + 1 */
+
+static void leak_scan_thread_exit(void *arg) {
+    size_t slot = (size_t)arg;
+    leak_lock(&leak_scan_threads_lock);
+    leak_scan_threads[slot - 1].live = 0;
+    leak_unlock(&leak_scan_threads_lock);
+}
+
+/* Function: leak_scan_init
+ * Read LEAK_SCAN (default on) and set up the thread registry. Call from
+ * the detector's constructor.
+ */
+static inline void leak_scan_init(void) {
+    const char *v = getenv("LEAK_SCAN");
+    if (v && !atoi(v)) leak_scan_enabled = 0;
+    if (leak_scan_enabled)
+        leak_scan_key_ok = pthread_key_create(&leak_scan_key, leak_scan_thread_exit) == 0;
+}
+
+/* Function: leak_scan_register_thread
+ * Record the calling thread's stack as a root until the thread exits.
+ * Cheap after the first call. May allocate, so callers must already hold
+ * their recursion guard.
+ */
+static inline void leak_scan_register_thread(void) {
+    if (leak_scan_slot || !leak_scan_key_ok || !leak_stack_bounds()) return;
+    leak_lock(&leak_scan_threads_lock);
+    size_t i = 0;
+    while (i < leak_scan_nthreads && leak_scan_threads[i].live) i++;
+    if (i == leak_scan_cap_threads) {
+        size_t cap = leak_scan_cap_threads ? leak_scan_cap_threads * 2 : 256;
+        leak_scan_thread_t *t = leak_pages_alloc(cap * sizeof(*t));
+        if (!t) {
+            leak_unlock(&leak_scan_threads_lock);
+            return;
+        }
+        if (leak_scan_threads) {
+            memcpy(t, leak_scan_threads, leak_scan_nthreads * sizeof(*t));
+            leak_pages_free(leak_scan_threads, leak_scan_cap_threads * sizeof(*t));
+        }
+        leak_scan_threads = t;
+        leak_scan_cap_threads = cap;
+    }
+    if (i == leak_scan_nthreads) leak_scan_nthreads++;
+    leak_scan_threads[i].lo = leak_stack_lo;
+    leak_scan_threads[i].hi = leak_stack_hi;
+    leak_scan_threads[i].live = 1;
+    leak_unlock(&leak_scan_threads_lock);
+    leak_scan_slot = i + 1;
+    pthread_setspecific(leak_scan_key, (void *)leak_scan_slot);
+}
+
+/* Function: leak_scan_child
+ * In a child after fork() only the forking thread is left: drop the other
+ * threads' stacks from the registry. The caller holds
+ * leak_scan_threads_lock.
+ */
+static inline void leak_scan_child(void) {
+    for (size_t i = 0; i < leak_scan_nthreads; ++i)
+        leak_scan_threads[i].live = i + 1 == leak_scan_slot;
+}
+
+/* ---- sort ---- */
+
+typedef struct {
+    uintptr_t key;
+    uint32_t idx;
+} leak_scan_item_t;
+
+/* LSD radix sort by key, 16 bits per pass over the bits that differ
+ * (two or three passes for a typical heap); `tmp` is scratch of n items.
+ * qsort on millions of blocks cost several times the scan itself. */
+static inline leak_scan_item_t *leak_scan_sort(leak_scan_item_t *a, leak_scan_item_t *tmp,
+                                               size_t n, size_t *count) {
+    uintptr_t min = UINTPTR_MAX, max = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i].key < min) min = a[i].key;
+        if (a[i].key > max) max = a[i].key;
+    }
+    for (unsigned shift = 0; shift < 64 && ((max - min) >> shift); shift += 16) {
+        memset(count, 0, 65536 * sizeof(*count));
+        for (size_t i = 0; i < n; ++i) count[((a[i].key - min) >> shift) & 0xffff]++;
+        for (size_t d = 0, sum = 0; d < 65536; ++d) {
+            size_t c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; ++i) tmp[count[((a[i].key - min) >> shift) & 0xffff]++] = a[i];
+        leak_scan_item_t *t = a;
+        a = tmp;
+        tmp = t;
+    }
+    return a;
+}
+
+/* ---- mark phase ---- */
+
+static struct {
+    const leak_range_t *blocks;
+    size_t n;
+    uintptr_t min, max;
+    unsigned shift;             /* bucket = (v - min) >> shift */
+    uint32_t *bucket;           /* first block starting in each bucket */
+    uint8_t *mark;
+    uint32_t *cur, *next;       /* this round's blocks / the next round's */
+    size_t ncur, pos, nnext;
+} leak_scan_st;
+
+static inline size_t leak_scan_find(uintptr_t v) {
+    if (v < leak_scan_st.min || v >= leak_scan_st.max) return SIZE_MAX;
+    const leak_range_t *b = leak_scan_st.blocks;
+    size_t k = (v - leak_scan_st.min) >> leak_scan_st.shift;
+    /* the answer starts in bucket k, or is the last block before it */
+    size_t lo = leak_scan_st.bucket[k], hi = leak_scan_st.bucket[k + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (b[mid].lo <= v) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo && v < b[lo - 1].hi ? lo - 1 : SIZE_MAX;
+}
+
+typedef struct {
+    uint32_t *stack;            /* NULL: everything goes to the next round */
+    size_t n;
+} leak_scan_local_t;
+
+static inline void leak_scan_words(uintptr_t lo, uintptr_t hi, leak_scan_local_t *l) {
+    lo = (lo + sizeof(uintptr_t) - 1) & ~(uintptr_t)(sizeof(uintptr_t) - 1);
+    for (uintptr_t p = lo; p + sizeof(uintptr_t) <= hi; p += sizeof(uintptr_t)) {
+        size_t i = leak_scan_find(*(const uintptr_t *)p);
+        if (i == SIZE_MAX || __atomic_load_n(&leak_scan_st.mark[i], __ATOMIC_RELAXED) ||
+            __atomic_exchange_n(&leak_scan_st.mark[i], 1, __ATOMIC_RELAXED))
+            continue;
+        if (l->stack && l->n < LEAK_SCAN_LOCAL)
+            l->stack[l->n++] = (uint32_t)i;
+        else
+            leak_scan_st.next[__atomic_fetch_add(&leak_scan_st.nnext, 1, __ATOMIC_RELAXED)] = (uint32_t)i;
+    }
+}
+
+static void *leak_scan_worker(void *arg) {
+    leak_scan_local_t l = { arg, 0 };
+    for (;;) {
+        size_t k = __atomic_fetch_add(&leak_scan_st.pos, LEAK_SCAN_CHUNK, __ATOMIC_RELAXED);
+        if (k >= leak_scan_st.ncur) break;
+        size_t e = k + LEAK_SCAN_CHUNK < leak_scan_st.ncur ? k + LEAK_SCAN_CHUNK : leak_scan_st.ncur;
+        for (; k < e; ++k) {
+            l.stack[l.n++] = leak_scan_st.cur[k];
+            while (l.n) {
+                const leak_range_t *b = &leak_scan_st.blocks[l.stack[--l.n]];
+                leak_scan_words(b->lo, b->hi, &l);
+            }
+        }
+    }
+    return NULL;
+}
+
+static int leak_scan_module(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    leak_scan_local_t *l = arg;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type == PT_LOAD && (ph->p_flags & PF_W)) {
+            uintptr_t lo = info->dlpi_addr + ph->p_vaddr;
+            leak_scan_words(lo, lo + ph->p_memsz, l);
+        } else if (ph->p_type == PT_TLS && info->dlpi_tls_data) {
+            uintptr_t lo = (uintptr_t)info->dlpi_tls_data;
+            leak_scan_words(lo, lo + ph->p_memsz, l);
+        }
+    }
+    return 0;
+}
+
+/* The part of [lo, hi) that is mapped, walking down from hi: the main
+ * thread's stack only grows into its rlimit as it is used. */
+static inline uintptr_t leak_scan_mapped_from(uintptr_t lo, uintptr_t hi) {
+    const uintptr_t step = 64 * 1024;
+    unsigned char vec[16];
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t top = hi & ~(page - 1);
+    while (top > lo) {
+        uintptr_t bot = top - lo > step ? top - step : lo & ~(page - 1);
+        if (mincore((void *)bot, top - bot, vec) != 0 && errno == ENOMEM) {
+            /* find the lowest mapped page of this step */
+            while (top > bot && mincore((void *)(top - page), page, vec) == 0) top -= page;
+            return top > lo ? top : lo;
+        }
+        top = bot;
+    }
+    return lo;
+}
+
+static void leak_scan_roots(uintptr_t stack_from, leak_scan_local_t *l) {
+    if (leak_stack_bounds() && stack_from >= leak_stack_lo && stack_from < leak_stack_hi)
+        leak_scan_words(stack_from, leak_stack_hi, l);
+    /* thread control block: its DTV points to the dynamic TLS blocks */
+    uintptr_t tp = (uintptr_t)pthread_self();
+    leak_scan_words(tp, tp + 8 * sizeof(void *), l);
+
+    dl_iterate_phdr(leak_scan_module, l);
+
+    leak_lock(&leak_scan_threads_lock);
+    for (size_t i = 0; i < leak_scan_nthreads; ++i) {
+        const leak_scan_thread_t *t = &leak_scan_threads[i];
+        if (!t->live || i + 1 == leak_scan_slot) continue;
+        leak_scan_words(leak_scan_mapped_from(t->lo, t->hi), t->hi, l);
+    }
+    leak_unlock(&leak_scan_threads_lock);
+}
+
+/* Function: leak_scan
+ * Mark the reachable ones among `n` tracked blocks, which must be
+ * disjoint but may come in any order. Sets reachable[i] to 1 or 0 and
+ * returns the number of reachable blocks. The calling thread's stack is
+ * scanned from `stack_from` up: pass the frame address of the detector's
+ * entry point, so that dead frames below it (which may hold copies of
+ * block addresses) are not taken for roots. The caller should keep its
+ * own allocations out of the table meanwhile (the scan itself only uses
+ * mmap).
+ */
+static inline size_t leak_scan(const leak_range_t *in, size_t n, uint8_t *reachable,
+                               const void *stack_from) {
+    memset(reachable, 0, n);
+    if (!n || n > UINT32_MAX) return 0;
+
+    /* sorted copy of the blocks; order[] maps back to the caller's index */
+    leak_scan_item_t *items = leak_pages_alloc(2 * n * sizeof(*items));
+    size_t *count = leak_pages_alloc(65536 * sizeof(size_t));
+    leak_range_t *blocks = leak_pages_alloc(n * sizeof(*blocks));
+    uint32_t *order = leak_pages_alloc(n * sizeof(uint32_t));
+    uint8_t *mark = leak_pages_alloc(n);
+    if (!items || !count || !blocks || !order || !mark) {
+        leak_pages_free(items, 2 * n * sizeof(*items));
+        leak_pages_free(count, 65536 * sizeof(size_t));
+        leak_pages_free(blocks, n * sizeof(*blocks));
+        leak_pages_free(order, n * sizeof(uint32_t));
+        leak_pages_free(mark, n);
+        memset(reachable, 1, n);    /* no verdict: report nothing as leaked */
+        return n;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        items[i].key = in[i].lo;
+        items[i].idx = (uint32_t)i;
+    }
+    const leak_scan_item_t *sorted = leak_scan_sort(items, items + n, n, count);
+    for (size_t i = 0; i < n; ++i) {
+        order[i] = sorted[i].idx;
+        blocks[i] = in[order[i]];
+    }
+    leak_pages_free(items, 2 * n * sizeof(*items));
+    leak_pages_free(count, 65536 * sizeof(size_t));
+
+    uint32_t *cur = leak_pages_alloc(n * sizeof(uint32_t));
+    uint32_t *next = leak_pages_alloc(n * sizeof(uint32_t));
+    size_t threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *v = getenv("LEAK_SCAN_THREADS");
+    if (v && atoi(v) > 0) threads = (size_t)atoi(v);
+    if (threads < 1) threads = 1;
+    if (threads > LEAK_SCAN_MAX_THREADS) threads = LEAK_SCAN_MAX_THREADS;
+    uint32_t *stacks = leak_pages_alloc(threads * LEAK_SCAN_LOCAL * sizeof(uint32_t));
+
+    uintptr_t min = blocks[0].lo, max = 0;
+    for (size_t i = 0; i < n; ++i)
+        if (blocks[i].hi > max) max = blocks[i].hi;
+    unsigned shift = 12;
+    while (shift < 63 && ((max - min) >> shift) > 2 * n) shift++;
+    size_t nb = ((max - min) >> shift) + 1;
+    uint32_t *bucket = leak_pages_alloc((nb + 1) * sizeof(uint32_t));
+
+    if (!cur || !next || !stacks || !bucket) {
+        leak_pages_free(cur, n * sizeof(uint32_t));
+        leak_pages_free(next, n * sizeof(uint32_t));
+        leak_pages_free(stacks, threads * LEAK_SCAN_LOCAL * sizeof(uint32_t));
+        leak_pages_free(bucket, (nb + 1) * sizeof(uint32_t));
+        leak_pages_free(blocks, n * sizeof(*blocks));
+        leak_pages_free(order, n * sizeof(uint32_t));
+        leak_pages_free(mark, n);
+        memset(reachable, 1, n);    /* no verdict: report nothing as leaked */
+        return n;
+    }
+    for (size_t k = 0, i = 0; k <= nb; ++k) {
+        while (i < n && ((blocks[i].lo - min) >> shift) < k) i++;
+        bucket[k] = (uint32_t)i;
+    }
+
+    leak_scan_st.blocks = blocks;
+    leak_scan_st.n = n;
+    leak_scan_st.min = min;
+    leak_scan_st.max = max;
+    leak_scan_st.shift = shift;
+    leak_scan_st.bucket = bucket;
+    leak_scan_st.mark = mark;
+    leak_scan_st.next = next;
+    leak_scan_st.nnext = 0;
+
+    leak_scan_local_t roots = { NULL, 0 };
+    leak_scan_roots((uintptr_t)stack_from, &roots);
+
+    /* helpers must not take the application's signals */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_t tid[LEAK_SCAN_MAX_THREADS];
+    while (leak_scan_st.nnext) {
+        uint32_t *t = cur;
+        leak_scan_st.cur = cur = leak_scan_st.next;
+        leak_scan_st.ncur = leak_scan_st.nnext;
+        leak_scan_st.next = next = t;
+        leak_scan_st.nnext = 0;
+        leak_scan_st.pos = 0;
+
+        size_t want = (leak_scan_st.ncur + LEAK_SCAN_CHUNK - 1) / LEAK_SCAN_CHUNK;
+        if (want > threads) want = threads;
+        size_t started = 1;
+        for (; started < want; ++started)
+            if (pthread_create(&tid[started], NULL, leak_scan_worker,
+                               stacks + started * LEAK_SCAN_LOCAL) != 0)
+                break;
+        leak_scan_worker(stacks);
+        for (size_t i = 1; i < started; ++i) pthread_join(tid[i], NULL);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    leak_pages_free(cur, n * sizeof(uint32_t));
+    leak_pages_free(next, n * sizeof(uint32_t));
+    leak_pages_free(stacks, threads * LEAK_SCAN_LOCAL * sizeof(uint32_t));
+    leak_pages_free(bucket, (nb + 1) * sizeof(uint32_t));
+    size_t marked = 0;
+    for (size_t i = 0; i < n; ++i) {
+        reachable[order[i]] = mark[i];
+        marked += mark[i];
+    }
+    leak_pages_free(blocks, n * sizeof(*blocks));
+    leak_pages_free(order, n * sizeof(uint32_t));
+    leak_pages_free(mark, n);
+    return marked;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_SCAN_H */
@@ -0,0 +1,108 @@
+/* leak_sites.h
+ * Aggregation of live blocks by allocation site (stack depot id + kind).
+ *
+ * Reports built on this scale with the number of distinct sites instead
+ * of the number of leaked blocks. The table lives in mmap'd pages, so it
+ * can be filled while the detector's recursion guard is held.
+ */
+#ifndef LEAK_SITES_H
+#define LEAK_SITES_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "leak_arena.h"
+#include "leak_sample.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    uint32_t stack;         /* stack depot id */
+    uint8_t type;           /* LEAK_T_* */
+    size_t count;           /* 0: empty slot */
+    size_t bytes;
+    size_t min, max;
+    double est;             /* bytes scaled back up in sampling mode */
+} leak_site_t;
+
+typedef struct {
+    leak_site_t *slots;
+    size_t mask;
+    size_t n;
+} leak_sites_t;
+
+static inline size_t leak_site_slot(uint32_t stack, uint8_t type, size_t mask) {
+    uint64_t h = ((uint64_t)stack << 8 | type) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32) & mask;
+}
+
+static inline int leak_sites_grow(leak_sites_t *s) {
+    size_t old_cap = s->slots ? s->mask + 1 : 0;
+    size_t cap = old_cap ? old_cap * 2 : 1024;
+    leak_site_t *slots = leak_pages_alloc(cap * sizeof(*slots));
+    if (!slots) return 0;
+    for (size_t i = 0; i < old_cap; ++i) {
+        const leak_site_t *o = &s->slots[i];
+        if (!o->count) continue;
+        size_t j = leak_site_slot(o->stack, o->type, cap - 1);
+        while (slots[j].count) j = (j + 1) & (cap - 1);
+        slots[j] = *o;
+    }
+    if (s->slots) leak_pages_free(s->slots, old_cap * sizeof(*slots));
+    s->slots = slots;
+    s->mask = cap - 1;
+    return 1;
+}
+
+/* Function: leak_sites_add
+ * Account one block of `size` bytes to its site.
+ */
+static inline void leak_sites_add(leak_sites_t *s, uint32_t stack, uint8_t type, size_t size) {
+    if ((!s->slots || (s->n + 1) * 10 > (s->mask + 1) * 7) && !leak_sites_grow(s)) return;
+    size_t i = leak_site_slot(stack, type, s->mask);
+    while (s->slots[i].count && (s->slots[i].stack != stack || s->slots[i].type != type))
+        i = (i + 1) & s->mask;
+    leak_site_t *e = &s->slots[i];
+    if (!e->count) {
+        e->stack = stack;
+        e->type = type;
+        e->min = size;
+        s->n++;
+    }
+    e->count++;
+    e->bytes += size;
+    if (size < e->min) e->min = size;
+    if (size > e->max) e->max = size;
+    e->est += leak_sample_estimate(size);
+}
+
+static int leak_site_cmp(const void *x, const void *y) {
+    const leak_site_t *a = x, *b = y;
+    if (a->est != b->est) return a->est > b->est ? -1 : 1;
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    return a->stack < b->stack ? -1 : a->stack > b->stack;
+}
+
+/* Function: leak_sites_sort
+ * Pack the sites to the front of the table, largest first. The table can
+ * only be read (not added to) afterwards.
+ */
+static inline void leak_sites_sort(leak_sites_t *s) {
+    size_t k = 0;
+    for (size_t i = 0; s->slots && i <= s->mask; ++i)
+        if (s->slots[i].count) s->slots[k++] = s->slots[i];
+    if (k) qsort(s->slots, k, sizeof(*s->slots), leak_site_cmp);
+}
+
+static inline void leak_sites_free(leak_sites_t *s) {
+    if (s->slots) leak_pages_free(s->slots, (s->mask + 1) * sizeof(*s->slots));
+    memset(s, 0, sizeof(*s));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_SITES_H */
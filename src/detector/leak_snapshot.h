@@ -0,0 +1,128 @@
+/* leak_snapshot.h
+ * Live-set dumps while the process keeps running (LEAK_SNAPSHOT=1).
+ *
+ * A background thread takes a snapshot whenever SIGUSR2 arrives or the
+ * control file named by LEAK_SNAPSHOT_FILE appears (the file is removed
+ * again). The signal handler only posts a semaphore, which is
+ * async-signal-safe; the dump itself runs on the snapshot thread.
+ * Snapshots are written to LEAK_SNAPSHOT_DIR (default: the working
+ * directory) as leak_snapshot.<pid>.<n>.txt.
+ */
+#ifndef LEAK_SNAPSHOT_H
+#define LEAK_SNAPSHOT_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int (*leak_snapshot_fn)(void);
+
+static sem_t leak_snap_sem;
+static pthread_t leak_snap_thread;
+static int leak_snap_running;
+static leak_snapshot_fn leak_snap_take;
+static const char *leak_snap_ctl;
+static unsigned leak_snap_seq;
+
+/* Function: leak_snapshot_path
+ * Name the next snapshot file. Returns its sequence number (from 1).
+ */
+static inline unsigned leak_snapshot_path(char *buf, size_t len) {
+    unsigned n = __atomic_add_fetch(&leak_snap_seq, 1, __ATOMIC_RELAXED);
+    const char *dir = getenv("LEAK_SNAPSHOT_DIR");
+    if (!dir || !dir[0]) dir = ".";
+    snprintf(buf, len, "%s/leak_snapshot.%d.%u.txt", dir, (int)getpid(), n);
+    return n;
+}
+
+static void leak_snap_signal(int sig) {
+    (void)sig;
+    int e = errno;
+    sem_post(&leak_snap_sem);
+    errno = e;
+}
+
+static void *leak_snap_main(void *arg) {
+    (void)arg;
+    while (__atomic_load_n(&leak_snap_running, __ATOMIC_ACQUIRE)) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += 1;
+        int take = sem_timedwait(&leak_snap_sem, &ts) == 0;
+        if (!__atomic_load_n(&leak_snap_running, __ATOMIC_ACQUIRE)) break;
+        /* unlink doubles as the test: only one poll can consume the file */
+        if (!take && leak_snap_ctl && unlink(leak_snap_ctl) == 0) take = 1;
+        if (take) leak_snap_take();
+    }
+    return NULL;
+}
+
+/* Function: leak_snapshot_start
+ * Start the snapshot thread and install the SIGUSR2 handler if
+ * LEAK_SNAPSHOT is set. `take` writes one snapshot. Call from the
+ * detector's constructor.
+ */
+static inline void leak_snapshot_start(leak_snapshot_fn take) {
+    const char *v = getenv("LEAK_SNAPSHOT");
+    if (!v || !atoi(v)) return;
+    if (sem_init(&leak_snap_sem, 0, 0) != 0) return;
+    leak_snap_take = take;
+    leak_snap_ctl = getenv("LEAK_SNAPSHOT_FILE");
+    if (leak_snap_ctl && !leak_snap_ctl[0]) leak_snap_ctl = NULL;
+
+    /* SIGUSR2 must be delivered to an application thread, whose handler
+     * wakes us; the snapshot thread itself takes no signals */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    __atomic_store_n(&leak_snap_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&leak_snap_thread, NULL, leak_snap_main, NULL) != 0)
+        leak_snap_running = 0;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!leak_snap_running) return;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = leak_snap_signal;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGUSR2, &sa, NULL);
+}
+
+/* Function: leak_snapshot_child
+ * In a child after fork(): the snapshot thread did not survive, so start
+ * one for this process, numbering its snapshots from 1 again.
+ */
+static inline void leak_snapshot_child(void) {
+    if (!leak_snap_running) return;
+    leak_snap_running = 0;
+    leak_snap_seq = 0;
+    leak_snapshot_start(leak_snap_take);
+}
+
+/* Function: leak_snapshot_stop
+ * Stop the snapshot thread, waiting for a dump in progress. Call from the
+ * detector's destructor.
+ */
+static inline void leak_snapshot_stop(void) {
+    if (!__atomic_load_n(&leak_snap_running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&leak_snap_running, 0, __ATOMIC_RELEASE);
+    sem_post(&leak_snap_sem);
+    pthread_join(leak_snap_thread, NULL);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_SNAPSHOT_H */
@@ -0,0 +1,374 @@
+/* leak_suppress.h
+ * Allocation sites that are not tracked at all (LEAK_SUPPRESS=file).
+ *
+ * The file lists one pattern per line, # starts a comment:
+ *
+ *   func:<glob>                 functions whose symbol name (mangled, for
+ *                               C++) matches, from .symtab or else .dynsym
+ *   module:<glob>               all code of the matching modules, by file
+ *                               name, or by path if the glob has a '/'
+ *   offset:<lo>[-<hi>]@<glob>   offsets in the matching modules, as the
+ *                               reports print them (0x1234@libfoo.so); a
+ *                               single offset is that one return address
+ *
+ * At startup, and again whenever the loader's dlopen/dlclose counters
+ * have moved (the base detector notices when its module index does, see
+ * leak_modules.h), the patterns are resolved against the loaded modules
+ * into a set of address ranges. The set is a hash table keyed by page, each slot holding one
+ * range's part of that page, so the allocation path decides with one
+ * lookup on the wrapper's own return address, before it unwinds or
+ * touches the live table. A rebuilt set replaces the old one with an
+ * atomic store; old sets are never unmapped, since a thread may still be
+ * reading one.
+ *
+ * Only the immediate caller is checked: an allocation from a helper that
+ * a suppressed function calls is still recorded.
+ */
+#ifndef LEAK_SUPPRESS_H
+#define LEAK_SUPPRESS_H
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "leak_common.h"
+#include "leak_arena.h"
+#include "leak_elf.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_SUPP_PAGE_BITS 12
+#define LEAK_SUPP_MAX_PAGES (1u << 24)  /* slots in a set, at most */
+#define LEAK_SUPP_MODULES 1024          /* modules resolved per rebuild */
+
+enum { LEAK_SUPP_FUNC, LEAK_SUPP_MODULE, LEAK_SUPP_OFFSET };
+
+typedef struct {
+    int kind;
+    const char *glob;                   /* function or module */
+    uintptr_t lo, hi;                   /* LEAK_SUPP_OFFSET */
+} leak_supp_pat_t;
+
+typedef struct {
+    uintptr_t key;                      /* page number + 1, 0: empty */
+    uintptr_t lo, hi;                   /* a range's part of the page */
+} leak_supp_slot_t;
+
+typedef struct {
+    size_t mask;
+    size_t n;                           /* slots taken */
+    size_t ranges;
+    leak_supp_slot_t slots[];
+} leak_supp_set_t;
+
+typedef struct {
+    uintptr_t lo, hi;
+} leak_supp_range_t;
+
+static struct {
+    leak_lock_t lock;                   /* one rebuild at a time */
+    leak_supp_pat_t *pats;
+    size_t npats;
+    int funcs;                          /* some pattern needs symbols */
+    unsigned long long gen;             /* loader's adds + subs at the last build */
+    leak_supp_set_t *set;
+    size_t set_len;
+} leak_supp;
+
+/* Function: leak_suppressed
+ * Whether the code at `pc` is in a suppressed range.
+ */
+static inline int leak_suppressed(const void *pc) {
+    const leak_supp_set_t *s = __atomic_load_n(&leak_supp.set, __ATOMIC_ACQUIRE);
+    if (__builtin_expect(!s, 1)) return 0;
+    uintptr_t a = (uintptr_t)pc, key = (a >> LEAK_SUPP_PAGE_BITS) + 1;
+    for (size_t i = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 20) & s->mask;;
+         i = (i + 1) & s->mask) {
+        const leak_supp_slot_t *e = &s->slots[i];
+        if (!e->key) return 0;
+        if (e->key == key && a >= e->lo && a < e->hi) return 1;
+    }
+}
+
+/* ---- building a set ---- */
+
+typedef struct {
+    char path[1024];
+    uintptr_t addr;                     /* dlpi_addr, the load bias */
+    uintptr_t base;                     /* first mapping, as in the reports */
+    int nexec;
+    leak_supp_range_t exec[8];          /* executable PT_LOAD segments */
+} leak_supp_module_t;
+
+typedef struct {
+    leak_supp_module_t *m;
+    size_t n, cap;
+    unsigned long long gen;
+} leak_supp_modules_t;
+
+static int leak_supp_module_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    leak_supp_modules_t *l = arg;
+    if (!l->n) l->gen = info->dlpi_adds + info->dlpi_subs;
+    if (l->n == l->cap) return 1;
+    leak_supp_module_t *m = &l->m[l->n];
+    uintptr_t lo = UINTPTR_MAX;
+    m->nexec = 0;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD) continue;
+        uintptr_t s = info->dlpi_addr + ph->p_vaddr;
+        if (s < lo) lo = s;
+        if ((ph->p_flags & PF_X) && m->nexec < 8) {
+            m->exec[m->nexec].lo = s;
+            m->exec[m->nexec++].hi = s + ph->p_memsz;
+        }
+    }
+    if (lo == UINTPTR_MAX) return 0;
+    m->addr = info->dlpi_addr;
+    m->base = lo & ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+    if (info->dlpi_name && info->dlpi_name[0]) {
+        snprintf(m->path, sizeof(m->path), "%s", info->dlpi_name);
+    } else {
+        ssize_t k = readlink("/proc/self/exe", m->path, sizeof(m->path) - 1);
+        m->path[k > 0 ? k : 0] = '\0';
+    }
+    l->n++;
+    return 0;
+}
+
+static inline int leak_supp_module_match(const char *glob, const char *path) {
+    const char *name = strrchr(path, '/');
+    return fnmatch(glob, strchr(glob, '/') || !name ? path : name + 1, 0) == 0;
+}
+
+typedef struct {
+    leak_supp_range_t *r;
+    size_t n, cap;
+} leak_supp_ranges_t;
+
+static inline void leak_supp_add(leak_supp_ranges_t *rs, uintptr_t lo, uintptr_t hi) {
+    if (lo >= hi) return;
+    if (rs->n == rs->cap) {
+        size_t cap = rs->cap ? rs->cap * 2 : 256;
+        leak_supp_range_t *r = leak_pages_alloc(cap * sizeof(*r));
+        if (!r) return;
+        if (rs->r) memcpy(r, rs->r, rs->n * sizeof(*r));
+        leak_pages_free(rs->r, rs->cap * sizeof(*r));
+        rs->r = r;
+        rs->cap = cap;
+    }
+    rs->r[rs->n].lo = lo;
+    rs->r[rs->n++].hi = hi;
+}
+
+/* the functions of one module that some func: pattern names */
+static inline void leak_supp_add_funcs(leak_supp_ranges_t *rs, const leak_supp_module_t *m) {
+    size_t len = 0;
+    const char *map = leak_elf_map(m->path, &len);
+    if (!map) return;
+    size_t n;
+    const Elf64_Shdr *sh = leak_elf_shdrs(map, len, &n);
+    const Elf64_Shdr *tab = NULL;
+    for (size_t i = 0; sh && i < n; ++i)
+        if (sh[i].sh_type == SHT_SYMTAB) tab = &sh[i];
+    for (size_t i = 0; sh && !tab && i < n; ++i)
+        if (sh[i].sh_type == SHT_DYNSYM) tab = &sh[i];
+    if (tab && tab->sh_link < n && tab->sh_offset + tab->sh_size <= len &&
+        sh[tab->sh_link].sh_offset + sh[tab->sh_link].sh_size <= len) {
+        const Elf64_Shdr *str = &sh[tab->sh_link];
+        const Elf64_Sym *s = (const Elf64_Sym *)(map + tab->sh_offset);
+        size_t count = tab->sh_size / sizeof(Elf64_Sym);
+        for (size_t i = 0; i < count; ++i) {
+            int type = ELF64_ST_TYPE(s[i].st_info);
+            if (type != STT_FUNC && type != STT_GNU_IFUNC) continue;
+            if (s[i].st_shndx == SHN_UNDEF || !s[i].st_value || !s[i].st_size ||
+                s[i].st_name >= str->sh_size)
+                continue;
+            const char *name = map + str->sh_offset + s[i].st_name;
+            for (size_t p = 0; p < leak_supp.npats; ++p) {
+                const leak_supp_pat_t *pat = &leak_supp.pats[p];
+                if (pat->kind != LEAK_SUPP_FUNC || fnmatch(pat->glob, name, 0) != 0) continue;
+                leak_supp_add(rs, m->addr + s[i].st_value, m->addr + s[i].st_value + s[i].st_size);
+                break;
+            }
+        }
+    }
+    munmap((void *)map, len);
+}
+
+static inline leak_supp_set_t *leak_supp_build(const leak_supp_ranges_t *rs, size_t *set_len) {
+    size_t pages = 0;
+    for (size_t i = 0; i < rs->n; ++i)
+        pages += ((rs->r[i].hi - 1) >> LEAK_SUPP_PAGE_BITS) - (rs->r[i].lo >> LEAK_SUPP_PAGE_BITS) + 1;
+    if (pages > LEAK_SUPP_MAX_PAGES / 2) pages = LEAK_SUPP_MAX_PAGES / 2;
+    size_t slots = 64;
+    while (slots < pages * 2) slots *= 2;
+    *set_len = sizeof(leak_supp_set_t) + slots * sizeof(leak_supp_slot_t);
+    leak_supp_set_t *s = leak_pages_alloc(*set_len);
+    if (!s) return NULL;
+    s->mask = slots - 1;
+    s->ranges = rs->n;
+    for (size_t i = 0; i < rs->n; ++i) {
+        uintptr_t lo = rs->r[i].lo, hi = rs->r[i].hi;
+        for (uintptr_t page = lo >> LEAK_SUPP_PAGE_BITS; page <= (hi - 1) >> LEAK_SUPP_PAGE_BITS;
+             ++page) {
+            if (s->n == pages) return s;            /* over LEAK_SUPP_MAX_PAGES */
+            uintptr_t key = page + 1;
+            uintptr_t plo = page << LEAK_SUPP_PAGE_BITS, phi = plo + (1u << LEAK_SUPP_PAGE_BITS);
+            size_t j = (size_t)((key * 0x9e3779b97f4a7c15ULL) >> 20) & s->mask;
+            while (s->slots[j].key) j = (j + 1) & s->mask;
+            s->slots[j].key = key;
+            s->slots[j].lo = lo > plo ? lo : plo;
+            s->slots[j].hi = hi < phi ? hi : phi;
+            s->n++;
+        }
+    }
+    return s;
+}
+
+/* Function: leak_suppress_refresh
+ * Resolve the patterns against the modules loaded now and publish the
+ * result, unless nothing was loaded or unloaded since the last time.
+ * Allocates through the real allocator; call with the detector's guard
+ * set, and not with the loader lock held.
+ */
+static inline void leak_suppress_refresh(void) {
+    if (!leak_supp.npats) return;
+    leak_lock(&leak_supp.lock);
+    leak_supp_modules_t l = { NULL, 0, LEAK_SUPP_MODULES, 0 };
+    l.m = leak_pages_alloc(l.cap * sizeof(*l.m));
+    if (!l.m) {
+        leak_unlock(&leak_supp.lock);
+        return;
+    }
+    dl_iterate_phdr(leak_supp_module_cb, &l);
+    if (leak_supp.set && l.gen == __atomic_load_n(&leak_supp.gen, __ATOMIC_RELAXED)) {
+        leak_pages_free(l.m, l.cap * sizeof(*l.m));
+        leak_unlock(&leak_supp.lock);
+        return;
+    }
+    leak_supp_ranges_t rs = { NULL, 0, 0 };
+    for (size_t i = 0; i < l.n; ++i) {
+        const leak_supp_module_t *m = &l.m[i];
+        for (size_t p = 0; p < leak_supp.npats; ++p) {
+            const leak_supp_pat_t *pat = &leak_supp.pats[p];
+            if (pat->kind == LEAK_SUPP_FUNC || !leak_supp_module_match(pat->glob, m->path))
+                continue;
+            if (pat->kind == LEAK_SUPP_MODULE)
+                for (int k = 0; k < m->nexec; ++k) leak_supp_add(&rs, m->exec[k].lo, m->exec[k].hi);
+            else
+                leak_supp_add(&rs, m->base + pat->lo, m->base + pat->hi);
+        }
+        if (leak_supp.funcs && m->path[0]) leak_supp_add_funcs(&rs, m);
+    }
+    size_t len;
+    leak_supp_set_t *set = leak_supp_build(&rs, &len);
+    if (set) {
+        __atomic_store_n(&leak_supp.set, set, __ATOMIC_RELEASE);
+        leak_supp.set_len = len;
+        __atomic_store_n(&leak_supp.gen, l.gen, __ATOMIC_RELAXED);
+        if (getenv("LEAK_VERBOSE"))
+            fprintf(stderr, "leak suppressions: %zu ranges over %zu pages in %zu modules\n",
+                    set->ranges, set->n, l.n);
+    }
+    leak_pages_free(rs.r, rs.cap * sizeof(*rs.r));
+    leak_pages_free(l.m, l.cap * sizeof(*l.m));
+    leak_unlock(&leak_supp.lock);
+}
+
+/* one line of the file, NUL-terminated and trimmed; 0 if it is not a
+ * pattern */
+static inline int leak_supp_parse(char *line, leak_supp_pat_t *pat) {
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+    while (*line == ' ' || *line == '\t') ++line;
+    size_t n = strlen(line);
+    while (n && (line[n - 1] == ' ' || line[n - 1] == '\t' || line[n - 1] == '\r')) line[--n] = '\0';
+    if (!n) return 0;
+    if (strncmp(line, "func:", 5) == 0 && line[5]) {
+        pat->kind = LEAK_SUPP_FUNC;
+        pat->glob = line + 5;
+        return 1;
+    }
+    if (strncmp(line, "module:", 7) == 0 && line[7]) {
+        pat->kind = LEAK_SUPP_MODULE;
+        pat->glob = line + 7;
+        return 1;
+    }
+    if (strncmp(line, "offset:", 7) == 0) {
+        char *end;
+        pat->kind = LEAK_SUPP_OFFSET;
+        pat->lo = strtoull(line + 7, &end, 16);
+        pat->hi = pat->lo + 1;
+        if (*end == '-') pat->hi = strtoull(end + 1, &end, 16);
+        if (*end != '@' || !end[1] || pat->hi <= pat->lo) return 0;
+        pat->glob = end + 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* Function: leak_suppress_init
+ * Read the file LEAK_SUPPRESS names and build the first set. Call from
+ * the detector's constructor, with its guard set.
+ */
+static inline void leak_suppress_init(void) {
+    const char *path = getenv("LEAK_SUPPRESS");
+    if (!path || !path[0]) return;
+    size_t len = 0;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "leak detector: cannot read suppressions %s\n", path);
+        if (fd >= 0) close(fd);
+        return;
+    }
+    len = (size_t)st.st_size;
+    char *text = leak_pages_alloc(len + 1);
+    size_t lines = 1;
+    ssize_t got = 0;
+    if (text) {
+        while ((size_t)got < len) {
+            ssize_t k = read(fd, text + got, len - (size_t)got);
+            if (k <= 0) break;
+            got += k;
+        }
+        text[got] = '\0';
+        for (ssize_t i = 0; i < got; ++i) lines += text[i] == '\n';
+    }
+    close(fd);
+    leak_supp_pat_t *pats = text ? leak_pages_alloc(lines * sizeof(*pats)) : NULL;
+    if (!pats) return;
+    size_t n = 0, bad = 0;
+    for (char *line = text; line;) {
+        char *nl = strchr(line, '\n');
+        if (nl) *nl = '\0';
+        if (leak_supp_parse(line, &pats[n])) {
+            leak_supp.funcs |= pats[n].kind == LEAK_SUPP_FUNC;
+            n++;
+        } else {
+            char *s = line + strspn(line, " \t\r");
+            bad += *s && *s != '#';
+        }
+        line = nl ? nl + 1 : NULL;
+    }
+    if (bad) fprintf(stderr, "leak detector: %zu malformed lines in %s ignored\n", bad, path);
+    leak_supp.pats = pats;
+    leak_supp.npats = n;
+    leak_suppress_refresh();
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_SUPPRESS_H */
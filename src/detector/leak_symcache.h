@@ -0,0 +1,356 @@
+/* leak_symcache.h
+ * Persistent symbolization cache keyed by ELF build-id.
+ *
+ * Each binary gets one file, <dir>/<build-id>.symc, holding an
+ * open-addressing table that maps an offset (relative to the first mapped
+ * page, as in the reports) to function, file and line. Readers mmap the
+ * file and probe it without parsing anything; leak_analyze merges newly
+ * resolved offsets into a fresh copy and rename()s it into place, so a
+ * reader never sees a half-written table. Entries with no information are
+ * stored too, so unresolvable offsets are not retried.
+ *
+ * The directory is LEAK_SYMCACHE_DIR, else $XDG_CACHE_HOME/leak-symcache,
+ * else ~/.cache/leak-symcache. LEAK_SYMCACHE_DIR= (empty) disables it.
+ */
+#ifndef LEAK_SYMCACHE_H
+#define LEAK_SYMCACHE_H
+
+#include <elf.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <link.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_SYMC_MAGIC "LEAKSYC1"
+
+typedef struct {
+    char magic[8];
+    uint32_t nslots;        /* power of two */
+    uint32_t nentries;
+    uint64_t str_off;       /* string pool, from the start of the file */
+    uint64_t str_len;
+} leak_symc_hdr_t;
+
+typedef struct {
+    uint64_t key;           /* offset + 1, 0 = empty */
+    uint32_t func;          /* pool offset + 1, 0 = unknown */
+    uint32_t file;
+    uint32_t line;
+    uint32_t reserved;
+} leak_symc_slot_t;
+
+typedef struct {
+    const char *map;
+    size_t len;
+    const leak_symc_hdr_t *h;
+    const leak_symc_slot_t *slots;
+    const char *strs;
+} leak_symcache_t;
+
+typedef struct {
+    uint64_t off;
+    const char *func, *file;    /* NULL if unknown */
+    unsigned line;
+} leak_symcache_entry_t;
+
+/* Function: leak_symcache_dir
+ * Resolve the cache directory into buf; returns NULL if caching is off.
+ */
+static inline const char *leak_symcache_dir(char *buf, size_t n) {
+    const char *d = getenv("LEAK_SYMCACHE_DIR");
+    if (d) {
+        if (!d[0]) return NULL;
+        snprintf(buf, n, "%s", d);
+    } else if ((d = getenv("XDG_CACHE_HOME")) && d[0]) {
+        snprintf(buf, n, "%s/leak-symcache", d);
+    } else if ((d = getenv("HOME")) && d[0]) {
+        snprintf(buf, n, "%s/.cache/leak-symcache", d);
+    } else {
+        return NULL;
+    }
+    return buf;
+}
+
+static inline uint64_t leak_symc_hash(uint64_t off) {
+    off ^= off >> 33;
+    off *= 0xff51afd7ed558ccdULL;
+    off ^= off >> 33;
+    return off;
+}
+
+/* Function: leak_symcache_open
+ * Map the cache of `build_id`. Returns 0 if there is none (or it is
+ * damaged); the cache is then empty but safe to use.
+ */
+static inline int leak_symcache_open(leak_symcache_t *c, const char *build_id) {
+    char dir[4096], path[4200];
+    memset(c, 0, sizeof(*c));
+    if (!build_id[0] || !leak_symcache_dir(dir, sizeof(dir))) return 0;
+    snprintf(path, sizeof(path), "%s/%s.symc", dir, build_id);
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return 0;
+    struct stat st;
+    const char *m = NULL;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(leak_symc_hdr_t)) {
+        m = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m == MAP_FAILED) m = NULL;
+    }
+    close(fd);
+    if (!m) return 0;
+    size_t len = (size_t)st.st_size;
+    const leak_symc_hdr_t *h = (const leak_symc_hdr_t *)m;
+    size_t slots_end = sizeof(*h) + (size_t)h->nslots * sizeof(leak_symc_slot_t);
+    if (memcmp(h->magic, LEAK_SYMC_MAGIC, 8) != 0 || !h->nslots || (h->nslots & (h->nslots - 1)) ||
+        slots_end > len || h->str_off < slots_end || h->str_off + h->str_len > len ||
+        (h->str_len && m[h->str_off + h->str_len - 1] != '\0')) {
+        munmap((void *)m, len);
+        return 0;
+    }
+    c->map = m;
+    c->len = len;
+    c->h = h;
+    c->slots = (const leak_symc_slot_t *)(m + sizeof(*h));
+    c->strs = m + h->str_off;
+    return 1;
+}
+
+static inline const char *leak_symc_str(const leak_symcache_t *c, uint32_t ref) {
+    return ref && ref - 1 < c->h->str_len ? c->strs + ref - 1 : NULL;
+}
+
+/* Function: leak_symcache_find
+ * Returns 1 and fills the outputs if `off` is cached.
+ */
+static inline int leak_symcache_find(const leak_symcache_t *c, uint64_t off, const char **func,
+                                     const char **file, unsigned *line) {
+    if (!c->map) return 0;
+    uint32_t mask = c->h->nslots - 1;
+    for (uint32_t i = (uint32_t)leak_symc_hash(off) & mask, n = 0; n <= mask; i = (i + 1) & mask, ++n) {
+        const leak_symc_slot_t *s = &c->slots[i];
+        if (!s->key) return 0;
+        if (s->key != off + 1) continue;
+        *func = leak_symc_str(c, s->func);
+        *file = leak_symc_str(c, s->file);
+        *line = s->line;
+        return 1;
+    }
+    return 0;
+}
+
+static inline void leak_symcache_close(leak_symcache_t *c) {
+    if (c->map) munmap((void *)c->map, c->len);
+    memset(c, 0, sizeof(*c));
+}
+
+/* ---- writer (tools only: allocates) ---- */
+
+typedef struct {
+    char *p;
+    size_t len, cap;
+    uint32_t *index;        /* pool offset + 1 per slot */
+    size_t mask;
+} leak_symc_pool_t;
+
+static inline uint32_t leak_symc_intern(leak_symc_pool_t *p, const char *s) {
+    if (!s) return 0;
+    size_t n = strlen(s);
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)s[i]) * 0x100000001b3ULL;
+    size_t i = h & p->mask;
+    while (p->index[i]) {
+        if (strcmp(p->p + p->index[i] - 1, s) == 0) return p->index[i];
+        i = (i + 1) & p->mask;
+    }
+    if (p->len + n + 1 > p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 65536;
+        while (cap < p->len + n + 1) cap *= 2;
+        char *np = realloc(p->p, cap);
+        if (!np) return 0;
+        p->p = np;
+        p->cap = cap;
+    }
+    memcpy(p->p + p->len, s, n + 1);
+    p->index[i] = (uint32_t)p->len + 1;
+    p->len += n + 1;
+    return p->index[i];
+}
+
+/* Returns 1 if the entry was added; the first entry for an offset wins. */
+static inline int leak_symc_put(leak_symc_slot_t *slots, uint32_t nslots, leak_symc_pool_t *pool,
+                                const leak_symcache_entry_t *e) {
+    uint32_t i = (uint32_t)leak_symc_hash(e->off) & (nslots - 1);
+    while (slots[i].key && slots[i].key != e->off + 1) i = (i + 1) & (nslots - 1);
+    if (slots[i].key) return 0;
+    slots[i].key = e->off + 1;
+    slots[i].func = leak_symc_intern(pool, e->func);
+    slots[i].file = leak_symc_intern(pool, e->file);
+    slots[i].line = e->line;
+    return 1;
+}
+
+static inline int leak_symc_mkdirs(char *dir) {
+    for (char *s = dir + 1; *s; ++s) {
+        if (*s != '/') continue;
+        *s = '\0';
+        int r = mkdir(dir, 0755);
+        *s = '/';
+        if (r != 0 && errno != EEXIST) return -1;
+    }
+    return mkdir(dir, 0755) == 0 || errno == EEXIST ? 0 : -1;
+}
+
+/* Function: leak_symcache_write
+ * Write the cache of `build_id` as `old` (may be empty) plus `n` new
+ * entries, replacing the file atomically. Returns 0 on success.
+ */
+static inline int leak_symcache_write(const char *build_id, const leak_symcache_t *old,
+                                      const leak_symcache_entry_t *add, size_t n) {
+    char dir[4096], path[4200], tmp[4300];
+    if (!build_id[0] || !leak_symcache_dir(dir, sizeof(dir)) || leak_symc_mkdirs(dir) != 0) return -1;
+
+    size_t total = n + (old->map ? old->h->nentries : 0);
+    uint32_t nslots = 64;
+    while (nslots < total * 2) nslots *= 2;
+    leak_symc_slot_t *slots = calloc(nslots, sizeof(*slots));
+    leak_symc_pool_t pool;
+    memset(&pool, 0, sizeof(pool));
+    pool.mask = nslots * 2 - 1;
+    pool.index = calloc(pool.mask + 1, sizeof(*pool.index));
+    if (!slots || !pool.index) {
+        free(slots);
+        free(pool.index);
+        return -1;
+    }
+
+    uint32_t count = 0;
+    for (size_t k = 0; k < n; ++k)
+        count += leak_symc_put(slots, nslots, &pool, &add[k]);
+    for (uint32_t k = 0; old->map && k < old->h->nslots; ++k) {
+        const leak_symc_slot_t *s = &old->slots[k];
+        if (!s->key) continue;
+        leak_symcache_entry_t e = { s->key - 1, leak_symc_str(old, s->func),
+                                    leak_symc_str(old, s->file), s->line };
+        count += leak_symc_put(slots, nslots, &pool, &e);
+    }
+
+    leak_symc_hdr_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LEAK_SYMC_MAGIC, 8);
+    h.nslots = nslots;
+    h.nentries = count;
+    h.str_off = sizeof(h) + (uint64_t)nslots * sizeof(*slots);
+    h.str_len = pool.len;
+
+    snprintf(path, sizeof(path), "%s/%s.symc", dir, build_id);
+    snprintf(tmp, sizeof(tmp), "%s.tmp.%d", path, (int)getpid());
+    int rc = -1;
+    FILE *f = fopen(tmp, "wb");
+    if (f) {
+        int ok = fwrite(&h, sizeof(h), 1, f) == 1 &&
+                 fwrite(slots, sizeof(*slots), nslots, f) == nslots &&
+                 (!pool.len || fwrite(pool.p, 1, pool.len, f) == pool.len);
+        if (fclose(f) == 0 && ok && rename(tmp, path) == 0) rc = 0;
+        else unlink(tmp);
+    }
+    free(slots);
+    free(pool.index);
+    free(pool.p);
+    return rc;
+}
+
+/* ---- build-id of a loaded module (detector side, no allocation) ---- */
+
+typedef struct {
+    uintptr_t base;         /* dli_fbase of the module */
+    char *out;
+    int found;
+} leak_symc_bid_t;
+
+static int leak_symc_bid_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    leak_symc_bid_t *q = arg;
+    (void)size;
+    uintptr_t lo = UINTPTR_MAX;
+    for (int i = 0; i < info->dlpi_phnum; ++i)
+        if (info->dlpi_phdr[i].p_type == PT_LOAD && info->dlpi_addr + info->dlpi_phdr[i].p_vaddr < lo)
+            lo = info->dlpi_addr + info->dlpi_phdr[i].p_vaddr;
+    if ((lo & ~(uintptr_t)0xfff) != q->base) return 0;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_NOTE) continue;
+        const char *p = (const char *)(info->dlpi_addr + ph->p_vaddr);
+        const char *end = p + ph->p_memsz;
+        while (p + sizeof(ElfW(Nhdr)) <= end) {
+            const ElfW(Nhdr) *nh = (const ElfW(Nhdr) *)p;
+            const char *desc = p + sizeof(*nh) + ((nh->n_namesz + 3) & ~3u);
+            if (nh->n_type == NT_GNU_BUILD_ID && nh->n_namesz == 4 && desc + nh->n_descsz <= end &&
+                memcmp(p + sizeof(*nh), "GNU", 4) == 0) {
+                size_t n = nh->n_descsz > 20 ? 20 : nh->n_descsz;
+                static const char hex[] = "0123456789abcdef";
+                for (size_t k = 0; k < n; ++k) {
+                    q->out[2 * k] = hex[(unsigned char)desc[k] >> 4];
+                    q->out[2 * k + 1] = hex[(unsigned char)desc[k] & 15];
+                }
+                q->out[2 * n] = '\0';
+                q->found = 1;
+                return 1;
+            }
+            p = desc + ((nh->n_descsz + 3) & ~3u);
+        }
+    }
+    return 1;
+}
+
+/* Function: leak_symcache_build_id_loaded
+ * Read the build-id of the loaded module whose dli_fbase is `fbase`
+ * from its in-memory PT_NOTE. Returns 0 if it has none.
+ */
+static inline int leak_symcache_build_id_loaded(const void *fbase, char out[41]) {
+    leak_symc_bid_t q = { (uintptr_t)fbase, out, 0 };
+    out[0] = '\0';
+    dl_iterate_phdr(leak_symc_bid_cb, &q);
+    return q.found;
+}
+
+#define LEAK_SYMC_MODULES 64
+
+static struct {
+    const void *fbase;
+    leak_symcache_t cache;
+} leak_symc_mods[LEAK_SYMC_MODULES];
+static int leak_symc_nmods = 0;
+
+/* Function: leak_symcache_lookup_loaded
+ * Look up an offset of a loaded module (dladdr's dli_fbase), opening the
+ * module's cache on first use. For the single-threaded report at exit.
+ */
+static inline int leak_symcache_lookup_loaded(const void *fbase, uint64_t off, const char **func,
+                                              const char **file, unsigned *line) {
+    int i;
+    for (i = 0; i < leak_symc_nmods; ++i)
+        if (leak_symc_mods[i].fbase == fbase) break;
+    if (i == leak_symc_nmods) {
+        if (i == LEAK_SYMC_MODULES) return 0;
+        char id[41];
+        leak_symc_mods[i].fbase = fbase;
+        memset(&leak_symc_mods[i].cache, 0, sizeof(leak_symc_mods[i].cache));
+        if (leak_symcache_build_id_loaded(fbase, id)) leak_symcache_open(&leak_symc_mods[i].cache, id);
+        leak_symc_nmods++;
+    }
+    return leak_symcache_find(&leak_symc_mods[i].cache, off, func, file, line);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_SYMCACHE_H */
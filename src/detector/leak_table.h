@@ -0,0 +1,284 @@
+/* leak_table.h
+ * Pointer-keyed allocation table shared by the detectors.
+ *
+ * The table is split into LEAK_SHARDS shards selected by the top bits of
+ * the pointer hash; each shard has its own spinlock, so threads touching
+ * different blocks rarely contend. Within a shard it is open addressing
+ * with linear probing. Deletion shifts the rest of the probe run back into
+ * the hole instead of leaving a tombstone, so lookups stay short no matter
+ * how many blocks have been freed.
+ *
+ * There is no fixed capacity: slot arrays are mmap'd and doubled when a
+ * shard fills up, and records come from a per-shard slab arena
+ * (leak_arena.h) that recycles freed records. Memory use follows the peak
+ * number of live allocations, not the total ever made.
+ */
+#ifndef LEAK_TABLE_H
+#define LEAK_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "leak_common.h"
+#include "leak_arena.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_SHARD_BITS 6
+#define LEAK_SHARDS (1 << LEAK_SHARD_BITS)
+#define LEAK_SHARD_MIN_SLOTS 256
+
+typedef struct {
+    uintptr_t key;      /* 0 marks an empty slot */
+    void *rec;
+} leak_slot_t;
+
+typedef struct {
+    leak_lock_t lock;
+    size_t count;
+    size_t mask;        /* slots - 1, a power of two; 0 until first insert */
+    leak_slot_t *slots;
+    leak_arena_t recs;
+} __attribute__((aligned(64))) leak_shard_t;
+
+typedef struct {
+    size_t rec_size;
+    size_t dropped;     /* inserts lost because mmap failed (atomic) */
+    leak_shard_t shards[LEAK_SHARDS];
+} leak_table_t;
+
+/* Define a table holding records of `type`. */
+#define LEAK_TABLE_DEFINE(name, type) \
+    static leak_table_t name = { sizeof(type), 0, {{ LEAK_LOCK_INIT, 0, 0, NULL, { NULL, NULL, NULL } }} }
+
+/* Function: leak_hash_ptr
+ * Mix all pointer bits (the low ones are mostly alignment zeros).
+ */
+static inline uint64_t leak_hash_ptr(uintptr_t k) {
+    uint64_t h = (uint64_t)k;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline leak_shard_t *leak_table_shard_of(leak_table_t *t, uint64_t h) {
+    return &t->shards[h >> (64 - LEAK_SHARD_BITS)];
+}
+
+/* Returns the index of `key` in the shard's slots, or of the empty slot
+ * that ends its probe run. Caller holds the shard lock and the shard has
+ * slots. */
+static inline size_t leak_table_probe(const leak_shard_t *sh, uint64_t h, uintptr_t key) {
+    size_t i = (size_t)h & sh->mask;
+    while (sh->slots[i].key != 0 && sh->slots[i].key != key)
+        i = (i + 1) & sh->mask;
+    return i;
+}
+
+/* Double the shard's slot array (or create it). Caller holds the lock.
+ * Returns 0 if mmap fails; the old array is then left untouched. */
+static inline int leak_table_grow(leak_shard_t *sh) {
+    size_t old_n = sh->slots ? sh->mask + 1 : 0;
+    size_t n = old_n ? old_n * 2 : LEAK_SHARD_MIN_SLOTS;
+    leak_slot_t *slots = leak_pages_alloc(n * sizeof(leak_slot_t));
+    if (!slots) return 0;
+
+    for (size_t j = 0; j < old_n; ++j) {
+        uintptr_t key = sh->slots[j].key;
+        if (!key) continue;
+        size_t i = (size_t)leak_hash_ptr(key) & (n - 1);
+        while (slots[i].key) i = (i + 1) & (n - 1);
+        slots[i] = sh->slots[j];
+    }
+    leak_pages_free(sh->slots, old_n * sizeof(leak_slot_t));
+    sh->slots = slots;
+    sh->mask = n - 1;
+    return 1;
+}
+
+/* Function: leak_table_find
+ * Copy the record stored for `key` into `out` (if non-NULL).
+ * Returns 1 if the key is present.
+ */
+static inline int leak_table_find(leak_table_t *t, const void *key, void *out) {
+    if (!key) return 0;
+    uint64_t h = leak_hash_ptr((uintptr_t)key);
+    leak_shard_t *sh = leak_table_shard_of(t, h);
+    int found = 0;
+
+    leak_lock(&sh->lock);
+    if (sh->slots) {
+        size_t i = leak_table_probe(sh, h, (uintptr_t)key);
+        if (sh->slots[i].key) {
+            if (out) memcpy(out, sh->slots[i].rec, t->rec_size);
+            found = 1;
+        }
+    }
+    leak_unlock(&sh->lock);
+    return found;
+}
+
+/* Function: leak_table_lock_all
+ * Take every shard lock, e.g. around fork(), so that a child never
+ * inherits a shard in the middle of another thread's update.
+ */
+static inline void leak_table_lock_all(leak_table_t *t) {
+    for (size_t s = 0; s < LEAK_SHARDS; ++s) leak_lock(&t->shards[s].lock);
+}
+
+static inline void leak_table_unlock_all(leak_table_t *t) {
+    for (size_t s = LEAK_SHARDS; s-- > 0;) leak_unlock(&t->shards[s].lock);
+}
+
+/* Function: leak_table_reset
+ * Forget every entry, as a child after fork() does. The caller holds every
+ * shard lock. Slot arrays are unmapped; record slabs are abandoned without
+ * being touched, so their pages stay shared with the parent.
+ */
+static inline void leak_table_reset(leak_table_t *t) {
+    for (size_t s = 0; s < LEAK_SHARDS; ++s) {
+        leak_shard_t *sh = &t->shards[s];
+        if (sh->slots) leak_pages_free(sh->slots, (sh->mask + 1) * sizeof(leak_slot_t));
+        sh->slots = NULL;
+        sh->mask = 0;
+        sh->count = 0;
+        memset(&sh->recs, 0, sizeof(sh->recs));
+    }
+    t->dropped = 0;
+}
+
+/* Function: leak_table_insert
+ * Store a copy of `rec` for `key`, replacing any existing entry.
+ * Returns 0 only when internal memory cannot be mapped.
+ */
+static inline int leak_table_insert(leak_table_t *t, const void *key, const void *rec) {
+    if (!key) return 0;
+    uint64_t h = leak_hash_ptr((uintptr_t)key);
+    leak_shard_t *sh = leak_table_shard_of(t, h);
+    void *dst = NULL;
+
+    leak_lock(&sh->lock);
+    /* keep the shard at most 70% full; if growing fails, carry on while
+     * there is still a free slot */
+    if ((sh->count + 1) * 10 > (sh->mask + 1) * 7) leak_table_grow(sh);
+    if (sh->slots && sh->count < sh->mask) {
+        size_t i = leak_table_probe(sh, h, (uintptr_t)key);
+        if (sh->slots[i].key) {
+            dst = sh->slots[i].rec;
+        } else if ((dst = leak_arena_alloc(&sh->recs, t->rec_size)) != NULL) {
+            sh->slots[i].key = (uintptr_t)key;
+            sh->slots[i].rec = dst;
+            sh->count++;
+        }
+        if (dst) memcpy(dst, rec, t->rec_size);
+    }
+    leak_unlock(&sh->lock);
+    if (!dst) __atomic_fetch_add(&t->dropped, 1, __ATOMIC_RELAXED);
+    return dst != NULL;
+}
+
+/* Function: leak_table_remove
+ * Drop the entry for `key`. If `out` is non-NULL the record is copied
+ * there before it is recycled. Returns 1 if the key was present.
+ */
+static inline int leak_table_remove(leak_table_t *t, const void *key, void *out) {
+    if (!key) return 0;
+    uint64_t h = leak_hash_ptr((uintptr_t)key);
+    leak_shard_t *sh = leak_table_shard_of(t, h);
+
+    leak_lock(&sh->lock);
+    size_t i;
+    if (!sh->slots || !sh->slots[i = leak_table_probe(sh, h, (uintptr_t)key)].key) {
+        leak_unlock(&sh->lock);
+        return 0;
+    }
+
+    void *rec = sh->slots[i].rec;
+    if (out) memcpy(out, rec, t->rec_size);
+    leak_arena_free(&sh->recs, rec);
+    sh->count--;
+
+    /* backward-shift: pull later members of the run into the hole as long
+     * as that does not move them before their home slot */
+    size_t hole = i;
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & sh->mask;
+        if (!sh->slots[j].key) break;
+        size_t home = (size_t)leak_hash_ptr(sh->slots[j].key) & sh->mask;
+        if (((j - home) & sh->mask) >= ((j - hole) & sh->mask)) {
+            sh->slots[hole] = sh->slots[j];
+            hole = j;
+        }
+    }
+    sh->slots[hole].key = 0;
+    sh->slots[hole].rec = NULL;
+    leak_unlock(&sh->lock);
+    return 1;
+}
+
+/* Function: leak_table_count
+ * Number of live records (a racy sum if other threads are still running).
+ */
+static inline size_t leak_table_count(const leak_table_t *t) {
+    size_t n = 0;
+    for (size_t s = 0; s < LEAK_SHARDS; ++s)
+        n += __atomic_load_n(&t->shards[s].count, __ATOMIC_RELAXED);
+    return n;
+}
+
+/* Function: leak_table_slots
+ * Slots mapped across all shards (racy, like leak_table_count).
+ */
+static inline size_t leak_table_slots(const leak_table_t *t) {
+    size_t n = 0;
+    for (size_t s = 0; s < LEAK_SHARDS; ++s) {
+        size_t mask = __atomic_load_n(&t->shards[s].mask, __ATOMIC_RELAXED);
+        n += mask ? mask + 1 : 0;
+    }
+    return n;
+}
+
+/* Function: leak_table_copy_shard
+ * Copy the records of shard `s` into `buf` (room for `cap` records) while
+ * holding only that shard's lock. Returns the shard's record count; when
+ * it exceeds `cap` nothing is copied and the caller retries with a larger
+ * buffer. Used for snapshots of a running process: allocating threads
+ * wait at most one shard's memcpy.
+ */
+static inline size_t leak_table_copy_shard(leak_table_t *t, size_t s, void *buf, size_t cap) {
+    leak_shard_t *sh = &t->shards[s];
+    leak_lock(&sh->lock);
+    size_t n = sh->count;
+    if (n <= cap) {
+        char *dst = buf;
+        for (size_t i = 0; sh->slots && i <= sh->mask; ++i) {
+            if (!sh->slots[i].key) continue;
+            memcpy(dst, sh->slots[i].rec, t->rec_size);
+            dst += t->rec_size;
+        }
+    }
+    leak_unlock(&sh->lock);
+    return n;
+}
+
+/* Iterate over live records: `var` is bound to each record in turn.
+ * Takes no locks and must not run concurrently with inserts (a shard may
+ * be re-mapped while it grows); meant for the exit report, with the
+ * reporting thread's own allocations kept out of the table. */
+#define LEAK_TABLE_FOREACH(t, var)                                            \
+    for (size_t _lt_s = 0; _lt_s < LEAK_SHARDS; ++_lt_s)                      \
+        for (size_t _lt_i = 0; (t)->shards[_lt_s].slots &&                    \
+                               _lt_i <= (t)->shards[_lt_s].mask; ++_lt_i)     \
+            if (((var) = (t)->shards[_lt_s].slots[_lt_i].rec) != NULL)
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_TABLE_H */
@@ -0,0 +1,372 @@
+/* leak_trace.h
+ * Streaming binary event log (LEAK_TRACE=path).
+ *
+ * Every recorded alloc/free is pushed into a per-thread single-producer
+ * ring; a background writer thread drains all rings every
+ * LEAK_TRACE_FLUSH_MS (default 10) milliseconds and appends the events,
+ * plus any new stacks and modules, to the trace file with large
+ * sequential writes. The file layout is in leak_trace_format.h; the
+ * leak_replay tool rebuilds the live set from it. A process that is
+ * killed loses at most the last flush interval.
+ *
+ * Include after leak_depot.h: the writer reads stacks from the depot.
+ */
+#ifndef LEAK_TRACE_H
+#define LEAK_TRACE_H
+
+#include <fcntl.h>
+#include <link.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "leak_common.h"
+#include "leak_arena.h"
+#include "leak_depot.h"
+#include "leak_trace_format.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_RING_BITS 14
+#define LEAK_RING_SIZE (1u << LEAK_RING_BITS)
+#define LEAK_TRACE_BUF (1024 * 1024)
+
+enum { LEAK_RING_FREE = 0, LEAK_RING_LIVE = 1, LEAK_RING_DEAD = 2 };
+
+typedef struct leak_ring {
+    struct leak_ring *next;                     /* registry, never unlinked */
+    int state;
+    uint64_t head __attribute__((aligned(64))); /* advanced by the owner thread */
+    uint64_t tail __attribute__((aligned(64))); /* advanced by the writer */
+    leak_event_t ev[LEAK_RING_SIZE];
+} leak_ring_t;
+
+/* Threads that already ran their TLS destructor push here, under a lock,
+ * so their ring can be handed to a new thread. */
+#define LEAK_RING_ORPHAN ((leak_ring_t *)1)
+
+static int leak_trace_fd = -1;
+static int leak_trace_running = 0;
+static unsigned leak_trace_flush_ms = 10;
+static uint64_t leak_trace_dropped = 0;
+static leak_ring_t *leak_trace_rings = NULL;
+static leak_ring_t *leak_trace_orphan = NULL;
+static leak_lock_t leak_trace_orphan_lock = LEAK_LOCK_INIT;
+static pthread_t leak_trace_thread;
+static pthread_key_t leak_trace_key;
+static int leak_trace_key_ok = 0;
+static __thread leak_ring_t *leak_trace_ring = NULL;
+
+static inline uint64_t leak_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void leak_trace_thread_exit(void *arg) {
+    leak_ring_t *r = arg;
+    leak_trace_ring = LEAK_RING_ORPHAN;
+    __atomic_store_n(&r->state, LEAK_RING_DEAD, __ATOMIC_RELEASE);
+}
+
+static leak_ring_t *leak_ring_new(int state) {
+    leak_ring_t *r = leak_pages_alloc(sizeof(leak_ring_t));
+    if (!r) return NULL;
+    r->state = state;
+    r->next = __atomic_load_n(&leak_trace_rings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&leak_trace_rings, &r->next, r, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+    return r;
+}
+
+/* First event of a thread: reuse a ring left by an exited thread or map a
+ * new one. */
+static __attribute__((noinline)) leak_ring_t *leak_trace_attach(void) {
+    leak_ring_t *r;
+    for (r = __atomic_load_n(&leak_trace_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int expect = LEAK_RING_FREE;
+        if (__atomic_compare_exchange_n(&r->state, &expect, LEAK_RING_LIVE, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (!r && !(r = leak_ring_new(LEAK_RING_LIVE))) return NULL;
+    leak_trace_ring = r;
+    pthread_setspecific(leak_trace_key, r);
+    return r;
+}
+
+static inline int leak_ring_put(leak_ring_t *r, const leak_event_t *e) {
+    uint64_t head = r->head;
+    int spins = 0;
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= LEAK_RING_SIZE) {
+        /* full: wait for the writer's next pass (up to ~1s), then drop */
+        if (!__atomic_load_n(&leak_trace_running, __ATOMIC_RELAXED) || ++spins > 10000) {
+            __atomic_fetch_add(&leak_trace_dropped, 1, __ATOMIC_RELAXED);
+            return 0;
+        }
+        if (spins < 64) {
+            sched_yield();
+        } else {
+            struct timespec ts = { 0, 100000 };
+            nanosleep(&ts, NULL);
+        }
+    }
+    r->ev[head & (LEAK_RING_SIZE - 1)] = *e;
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Function: leak_trace_push
+ * Append one event for the calling thread. Callers check
+ * leak_trace_fd >= 0 first.
+ */
+static inline void leak_trace_push(uint8_t kind, uint8_t type, uint32_t stack,
+                                   const void *ptr, uint64_t size) {
+    leak_event_t e;
+    e.kind = kind;
+    e.type = type;
+    e.reserved = 0;
+    e.stack = stack;
+    e.ts = leak_now_ns();
+    e.a = (uint64_t)(uintptr_t)ptr;
+    e.b = size;
+
+    leak_ring_t *r = leak_trace_ring;
+    if (r == LEAK_RING_ORPHAN) {
+        leak_lock(&leak_trace_orphan_lock);
+        leak_ring_put(leak_trace_orphan, &e);
+        leak_unlock(&leak_trace_orphan_lock);
+        return;
+    }
+    if (!r && !(r = leak_trace_attach())) {
+        __atomic_fetch_add(&leak_trace_dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    leak_ring_put(r, &e);
+}
+
+/* ---- writer side ---- */
+
+typedef struct {
+    char *buf;
+    size_t len;
+    uint32_t stacks_written;
+    unsigned long long modules_seen;    /* dlpi_adds + dlpi_subs at last dump */
+} leak_trace_writer_t;
+
+static leak_trace_writer_t leak_trace_w;
+
+static void leak_trace_flush(leak_trace_writer_t *w) {
+    size_t off = 0;
+    while (off < w->len) {
+        ssize_t n = write(leak_trace_fd, w->buf + off, w->len - off);
+        if (n <= 0) break;
+        off += (size_t)n;
+    }
+    w->len = 0;
+}
+
+static void leak_trace_emit(leak_trace_writer_t *w, const void *p, size_t n) {
+    if (w->len + n > LEAK_TRACE_BUF) leak_trace_flush(w);
+    if (n > LEAK_TRACE_BUF) return;
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static int leak_trace_module_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    leak_trace_writer_t *w = arg;
+    (void)size;
+    uint64_t lo = UINT64_MAX, hi = 0;
+    for (int i = 0; i < info->dlpi_phnum; ++i) {
+        const ElfW(Phdr) *ph = &info->dlpi_phdr[i];
+        if (ph->p_type != PT_LOAD) continue;
+        uint64_t s = info->dlpi_addr + ph->p_vaddr;
+        if (s < lo) lo = s;
+        if (s + ph->p_memsz > hi) hi = s + ph->p_memsz;
+    }
+    if (hi == 0) return 0;
+
+    char exe[4096];
+    const char *path = info->dlpi_name;
+    if (!path || !path[0]) {
+        /* the main program reports an empty name */
+        ssize_t n = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+        exe[n > 0 ? n : 0] = '\0';
+        path = exe;
+    }
+    size_t plen = strlen(path);
+    leak_event_t e;
+    memset(&e, 0, sizeof(e));
+    e.kind = LEAK_EV_MODULE;
+    e.a = info->dlpi_addr;
+    e.b = plen;
+    uint64_t range[2] = { lo, hi };
+    static const char zeros[8];
+    leak_trace_emit(w, &e, sizeof(e));
+    leak_trace_emit(w, range, sizeof(range));
+    leak_trace_emit(w, path, plen);
+    leak_trace_emit(w, zeros, leak_trace_pad8(plen) - plen);
+    return 0;
+}
+
+static int leak_trace_count_cb(struct dl_phdr_info *info, size_t size, void *arg) {
+    (void)size;
+    *(unsigned long long *)arg = info->dlpi_adds + info->dlpi_subs;
+    return 1;
+}
+
+static void leak_trace_drain(leak_trace_writer_t *w) {
+    unsigned long long gen = 0;
+    dl_iterate_phdr(leak_trace_count_cb, &gen);
+    if (gen != w->modules_seen) {
+        w->modules_seen = gen;
+        dl_iterate_phdr(leak_trace_module_cb, w);
+    }
+
+    /* stacks referenced by queued events were published before the events */
+    uint32_t nstacks = __atomic_load_n(&leak_depot.count, __ATOMIC_ACQUIRE);
+    for (uint32_t id = w->stacks_written + 1; id <= nstacks; ++id) {
+        const leak_stack_t *s = leak_depot_get(id);
+        if (!s) continue;
+        leak_event_t e;
+        memset(&e, 0, sizeof(e));
+        e.kind = LEAK_EV_STACK;
+        e.stack = id;
+        e.b = s->depth;
+        leak_trace_emit(w, &e, sizeof(e));
+        for (uint32_t k = 0; k < s->depth; ++k) {
+            uint64_t pc = (uint64_t)(uintptr_t)s->frames[k];
+            leak_trace_emit(w, &pc, sizeof(pc));
+        }
+    }
+    w->stacks_written = nstacks;
+
+    for (leak_ring_t *r = __atomic_load_n(&leak_trace_rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+        int state = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE);
+        uint64_t tail = r->tail;
+        uint64_t head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        while (tail != head) {
+            /* copy the contiguous part up to the end of the ring */
+            uint64_t idx = tail & (LEAK_RING_SIZE - 1);
+            uint64_t n = head - tail;
+            if (n > LEAK_RING_SIZE - idx) n = LEAK_RING_SIZE - idx;
+            leak_trace_emit(w, &r->ev[idx], n * sizeof(leak_event_t));
+            tail += n;
+            __atomic_store_n(&r->tail, tail, __ATOMIC_RELEASE);
+        }
+        if (state == LEAK_RING_DEAD) {
+            r->head = r->tail = 0;
+            __atomic_store_n(&r->state, LEAK_RING_FREE, __ATOMIC_RELEASE);
+        }
+    }
+    leak_trace_flush(w);
+}
+
+static void *leak_trace_main(void *arg) {
+    (void)arg;
+    struct timespec ts = { leak_trace_flush_ms / 1000, (long)(leak_trace_flush_ms % 1000) * 1000000L };
+    while (__atomic_load_n(&leak_trace_running, __ATOMIC_ACQUIRE)) {
+        leak_trace_drain(&leak_trace_w);
+        nanosleep(&ts, NULL);
+    }
+    return NULL;
+}
+
+/* Function: leak_trace_start
+ * Open the trace named by LEAK_TRACE (%p: the pid, see leak_output_path)
+ * and start the writer thread. Call from the detector's constructor;
+ * `forked` is set when leak_trace_child() restarts it. Does nothing if
+ * LEAK_TRACE is unset.
+ */
+static inline void leak_trace_start(int forked) {
+    const char *tmpl = getenv("LEAK_TRACE");
+    if (!tmpl || !tmpl[0]) return;
+    char path[4096];
+    leak_output_path(tmpl, NULL, forked, path, sizeof(path));
+    const char *ms = getenv("LEAK_TRACE_FLUSH_MS");
+    if (ms && atoi(ms) > 0) leak_trace_flush_ms = (unsigned)atoi(ms);
+
+    /* a restart after fork() keeps the buffer, the orphan ring and the key */
+    if (!leak_trace_w.buf) leak_trace_w.buf = leak_pages_alloc(LEAK_TRACE_BUF);
+    if (!leak_trace_orphan) leak_trace_orphan = leak_ring_new(LEAK_RING_LIVE);
+    if (!leak_trace_w.buf || !leak_trace_orphan) return;
+    if (!leak_trace_key_ok && pthread_key_create(&leak_trace_key, leak_trace_thread_exit) != 0)
+        return;
+    leak_trace_key_ok = 1;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) return;
+    leak_trace_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, LEAK_TRACE_MAGIC, sizeof(h.magic));
+    h.version = LEAK_TRACE_VERSION;
+    h.pid = (uint32_t)getpid();
+    h.start_ns = leak_now_ns();
+    if (write(fd, &h, sizeof(h)) != (ssize_t)sizeof(h)) {
+        close(fd);
+        return;
+    }
+
+    /* the writer must not take the application's signals */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    leak_trace_fd = fd;
+    __atomic_store_n(&leak_trace_running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&leak_trace_thread, NULL, leak_trace_main, NULL) != 0) {
+        leak_trace_running = 0;
+        leak_trace_fd = -1;
+        close(fd);
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+/* Function: leak_trace_stop
+ * Stop the writer and drain what is left. The last drain runs after the
+ * join so it also picks up the free of the writer's own thread state.
+ * Call from the detector's destructor.
+ */
+static inline void leak_trace_stop(void) {
+    if (!__atomic_load_n(&leak_trace_running, __ATOMIC_ACQUIRE)) return;
+    __atomic_store_n(&leak_trace_running, 0, __ATOMIC_RELEASE);
+    pthread_join(leak_trace_thread, NULL);
+    leak_trace_drain(&leak_trace_w);
+    if (leak_trace_dropped && getenv("LEAK_VERBOSE"))
+        fprintf(stderr, "leak trace: %llu events dropped\n",
+                (unsigned long long)leak_trace_dropped);
+}
+
+/* Function: leak_trace_child
+ * In a child after fork(). The writer thread did not survive, and the
+ * events still queued are the parent's to write, so drop them and start
+ * this process's own trace, which repeats the stacks and modules.
+ */
+static inline void leak_trace_child(void) {
+    if (!leak_trace_running) return;
+    leak_trace_running = 0;
+    close(leak_trace_fd);
+    leak_trace_fd = -1;
+    for (leak_ring_t *r = leak_trace_rings; r; r = r->next) {
+        r->head = r->tail = 0;
+        if (r != leak_trace_orphan) r->state = LEAK_RING_FREE;
+    }
+    leak_trace_ring = NULL;
+    leak_trace_w.len = 0;
+    leak_trace_w.stacks_written = 0;
+    leak_trace_w.modules_seen = 0;
+    leak_trace_dropped = 0;
+    leak_trace_start(1);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_TRACE_H */
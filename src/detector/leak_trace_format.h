@@ -0,0 +1,66 @@
+/* leak_trace_format.h
+ * On-disk layout of the binary event trace (LEAK_TRACE=path), shared by
+ * the detector and the offline leak_replay tool.
+ *
+ * The file is a leak_trace_header_t followed by 32-byte leak_event_t
+ * records, appended in large sequential writes. STACK and MODULE records
+ * carry a variable-size payload right after them, padded to 8 bytes.
+ * Events from different threads are written in batches, so they are not
+ * in global order; readers sort by `ts` before replaying. A process
+ * killed mid-write leaves at most one truncated record at the end, which
+ * readers ignore.
+ *
+ * Descriptors have events of their own (version 2 on): their numbers
+ * start at 0 and come back as soon as they are closed, so they share no
+ * key space with block addresses. Version 1 traces wrote them as ALLOC
+ * and FREE.
+ */
+#ifndef LEAK_TRACE_FORMAT_H
+#define LEAK_TRACE_FORMAT_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define LEAK_TRACE_MAGIC "LEAKTRC1"
+#define LEAK_TRACE_VERSION 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t pid;
+    uint64_t start_ns;      /* CLOCK_MONOTONIC at trace start */
+} leak_trace_header_t;
+
+enum {
+    LEAK_EV_ALLOC = 1,      /* a = ptr, b = size, type, stack */
+    LEAK_EV_FREE = 2,       /* a = ptr */
+    LEAK_EV_STACK = 3,      /* stack = id, b = depth; followed by depth u64 frames */
+    LEAK_EV_MODULE = 4,     /* a = load bias, b = path length; followed by
+                             * u64 start and end of the loaded segments, then
+                             * the path */
+    LEAK_EV_FD_OPEN = 5,    /* a = descriptor, type, stack */
+    LEAK_EV_FD_CLOSE = 6,   /* a = descriptor */
+};
+
+typedef struct {
+    uint8_t kind;
+    uint8_t type;           /* leak_types.h kind for ALLOC and FD_OPEN */
+    uint16_t reserved;
+    uint32_t stack;         /* stack depot id, 0 if none */
+    uint64_t ts;            /* CLOCK_MONOTONIC ns */
+    uint64_t a;
+    uint64_t b;
+} leak_event_t;
+
+static inline uint64_t leak_trace_pad8(uint64_t n) {
+    return (n + 7) & ~(uint64_t)7;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_TRACE_FORMAT_H */
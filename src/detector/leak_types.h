@@ -0,0 +1,52 @@
+/* leak_types.h
+ * Allocation kinds recorded by the detectors. The numeric values are
+ * written to binary traces, so only append to this list.
+ */
+#ifndef LEAK_TYPES_H
+#define LEAK_TYPES_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    LEAK_T_MALLOC = 0,
+    LEAK_T_CALLOC,
+    LEAK_T_REALLOC,
+    LEAK_T_STRDUP,
+    LEAK_T_STRNDUP,
+    LEAK_T_FOPEN,
+    LEAK_T_ALIGNED_ALLOC,
+    LEAK_T_POSIX_MEMALIGN,
+    LEAK_T_NEW,             /* every operator new overload */
+    LEAK_T_NEW_ARRAY,       /* every operator new[] overload */
+    LEAK_T_OPEN,            /* file descriptors (leak_fds.h): open, openat */
+    LEAK_T_SOCKET,
+    LEAK_T_ACCEPT,          /* accept, accept4 */
+    LEAK_T_DUP,             /* dup, dup2, dup3 */
+    LEAK_T_PIPE,            /* either end of pipe, pipe2 */
+    LEAK_T_EVENTFD,
+    LEAK_T_EPOLL,           /* epoll_create, epoll_create1 */
+    LEAK_T_COUNT
+};
+
+static const char *const leak_type_names[LEAK_T_COUNT] = {
+    "malloc", "calloc", "realloc", "strdup", "strndup",
+    "fopen", "aligned_alloc", "posix_memalign", "new", "new[]",
+    "open", "socket", "accept", "dup", "pipe", "eventfd", "epoll",
+};
+
+/* a file descriptor rather than a block */
+static inline int leak_type_is_fd(unsigned t) {
+    return t >= LEAK_T_OPEN && t < LEAK_T_COUNT;
+}
+
+static inline const char *leak_type_name(unsigned t) {
+    return t < LEAK_T_COUNT ? leak_type_names[t] : "-";
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_TYPES_H */
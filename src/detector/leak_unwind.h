@@ -0,0 +1,103 @@
+/* leak_unwind.h
+ * Stack capture for the detectors.
+ *
+ * leak_unwind_fp() follows the saved frame-pointer chain. It never
+ * allocates and never takes locks, and it only dereferences addresses
+ * inside the current thread's stack, so a frame without a frame pointer
+ * (e.g. inside libc) ends the walk instead of faulting. glibc's
+ * backtrace() stays available for code built without frame pointers;
+ * LEAK_UNWIND=backtrace selects it at startup.
+ */
+#ifndef LEAK_UNWIND_H
+#define LEAK_UNWIND_H
+
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum {
+    LEAK_UNWIND_FP = 0,
+    LEAK_UNWIND_BACKTRACE = 1,
+};
+
+static int leak_unwind_mode = LEAK_UNWIND_FP;
+
+/* [lo, hi) of the current thread's stack; hi == 1 means unknown */
+static __thread uintptr_t leak_stack_lo = 0;
+static __thread uintptr_t leak_stack_hi = 0;
+
+/* Function: leak_unwind_init
+ * Pick the unwinder from LEAK_UNWIND (fp|backtrace). Call from the
+ * detector's constructor.
+ */
+static inline void leak_unwind_init(void) {
+    const char *m = getenv("LEAK_UNWIND");
+    if (m && strcmp(m, "backtrace") == 0) leak_unwind_mode = LEAK_UNWIND_BACKTRACE;
+}
+
+/* Look up the thread's stack once and cache it. pthread_getattr_np() may
+ * allocate, so callers must already hold their recursion guard. */
+static inline int leak_stack_bounds(void) {
+    if (!leak_stack_hi) {
+        pthread_attr_t attr;
+        void *addr;
+        size_t size;
+        leak_stack_hi = 1;
+        if (pthread_getattr_np(pthread_self(), &attr) == 0) {
+            if (pthread_attr_getstack(&attr, &addr, &size) == 0) {
+                leak_stack_lo = (uintptr_t)addr;
+                leak_stack_hi = (uintptr_t)addr + size;
+            }
+            pthread_attr_destroy(&attr);
+        }
+    }
+    return leak_stack_hi > 1;
+}
+
+/* Function: leak_unwind_fp
+ * Store up to `max` return addresses, starting with this function's
+ * caller, by walking the frame-pointer chain. Returns the count, or -1 if
+ * the stack bounds are unknown.
+ */
+static __attribute__((noinline)) int leak_unwind_fp(void **buf, int max) {
+    if (!leak_stack_bounds()) return -1;
+    uintptr_t lo = leak_stack_lo, hi = leak_stack_hi;
+    uintptr_t fp = (uintptr_t)__builtin_frame_address(0);
+    int n = 0;
+
+    while (n < max) {
+        if (fp < lo || fp + 2 * sizeof(void *) > hi || (fp & (sizeof(void *) - 1)))
+            break;
+        void *ret = ((void **)fp)[1];
+        uintptr_t next = ((uintptr_t *)fp)[0];
+        if (!ret) break;
+        buf[n++] = ret;
+        /* frames grow towards higher addresses as we go up the chain */
+        if (next <= fp) break;
+        fp = next;
+    }
+    return n;
+}
+
+/* Function: leak_unwind
+ * Capture the current stack with the configured unwinder.
+ */
+static inline int leak_unwind(void **buf, int max) {
+    if (leak_unwind_mode == LEAK_UNWIND_FP) {
+        int n = leak_unwind_fp(buf, max);
+        if (n >= 0) return n;
+    }
+    return backtrace(buf, max);
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LEAK_UNWIND_H */
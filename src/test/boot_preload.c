@@ -0,0 +1,29 @@
+/* boot_preload.c
+ * Preload helper whose constructor allocates before the detector's own
+ * constructor has run: listed after the detector in LD_PRELOAD, it is
+ * initialized first while its malloc calls still bind to the detector.
+ * Prints "boot_preload: ok" if every allocation worked.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void __attribute__((constructor)) boot_preload_init(void) {
+    int ok = 1;
+    char *a = malloc(100);
+    char *b = calloc(10, 10);
+    char *s = strdup("bootstrap");
+    if (!a || !b || !s || strcmp(s, "bootstrap") != 0) ok = 0;
+    for (int i = 0; ok && i < 100; ++i)
+        if (b[i]) ok = 0;
+    if (a) {
+        memset(a, 'x', 100);
+        a = realloc(a, 1000);
+        if (!a || a[99] != 'x') ok = 0;
+    }
+    free(a);
+    free(b);
+    free(s);
+    fprintf(stderr, "boot_preload: %s\n", ok ? "ok" : "FAILED");
+}
@@ -0,0 +1,66 @@
+/* cxx_test.cpp
+ * C++ allocations for the detectors' operator new/delete wrappers:
+ *   leaked     - one block each from new, new[], aligned new, nothrow
+ *                new[] and a new made after a bad_alloc went through the
+ *                wrapper (so the guard was restored): 5 blocks whose
+ *                caller is this program, of kind new or new[];
+ *   mismatched - new/free, malloc/delete, new[]/delete and a sized delete
+ *                with the wrong size: 4 "Mismatch:" lines on stderr;
+ *   freed      - everything else, through each delete overload.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+struct alignas(64) line_t {
+    char bytes[64];
+};
+
+static void *volatile sink;
+static volatile size_t huge = static_cast<size_t>(-1) / 4;
+
+static void __attribute__((noinline)) make_leaks() {
+    sink = new int(1);
+    sink = new char[100];
+    sink = new line_t;
+    sink = new (std::nothrow) long[8];
+}
+
+static void __attribute__((noinline)) make_mismatches() {
+    free(new int(2));
+    int *m = static_cast<int *>(malloc(sizeof(int)));
+    delete m;
+    int *a = new int[4];
+    delete a;
+    void *s = ::operator new(8);
+    ::operator delete(s, 3);
+}
+
+static void __attribute__((noinline)) free_properly() {
+    delete new int(3);
+    delete[] new char[10];
+    delete new line_t;
+    delete[] new line_t[2];
+    ::operator delete(::operator new(16), 16);
+    ::operator delete[](::operator new[](16), 16);
+    ::operator delete(::operator new(8, std::nothrow), std::nothrow);
+    ::operator delete[](::operator new[](8, std::nothrow), std::nothrow);
+    std::align_val_t al{128};
+    ::operator delete(::operator new(256, al), al);
+    ::operator delete(::operator new(256, al), 256, al);
+    ::operator delete[](::operator new[](256, al, std::nothrow), al, std::nothrow);
+}
+
+int main() {
+    make_leaks();
+    make_mismatches();
+    free_properly();
+    try {
+        sink = new char[huge];
+    } catch (const std::bad_alloc &) {
+        printf("cxx_test: bad_alloc caught\n");
+    }
+    sink = new int(4);
+    printf("cxx_test: expect 5 leaked blocks and 4 mismatches\n");
+    return 0;
+}
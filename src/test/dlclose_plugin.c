@@ -0,0 +1,10 @@
+/* dlclose_plugin.c
+ * Loaded and unloaded by dlclose_test: leaks 3 blocks of 444 bytes from
+ * its own code before it is dlclose'd.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+void __attribute__((noinline)) plugin_leak(void) {
+    for (int i = 0; i < 3; ++i) memset(malloc(444), 4, 444);
+}
@@ -0,0 +1,80 @@
+/* fd_test.c
+ * Open descriptors through every call the detectors track, from 4
+ * threads that each open and close 25000 eventfds, then leave exactly
+ * these open: 2 open, 1 socket, 1 accept, 1 dup (the dup2 onto a tracked
+ * descriptor replaces its record), 2 pipe ends, 1 eventfd and 1 epoll.
+ * Everything else is closed again, including one end of a second pipe.
+ * Standard input is closed first, so the first of them is descriptor 0.
+ */
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREADS 4
+#define CHURN 25000
+
+static void *churn(void *arg) {
+    (void)arg;
+    for (int i = 0; i < CHURN; ++i) close(eventfd(0, 0));
+    return NULL;
+}
+
+static void __attribute__((noinline)) leak_fds(void) {
+    close(STDIN_FILENO);
+    int a = open("/dev/null", O_RDONLY);
+    int b = openat(AT_FDCWD, "/dev/null", O_WRONLY | O_CLOEXEC);
+    close(open("/dev/null", O_RDONLY));
+    (void)a;
+    (void)b;
+
+    /* listening socket closed, the accepted connection leaked */
+    int srv = socket(AF_UNIX, SOCK_STREAM, 0);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "fd_test.%d", (int)getpid());
+    socklen_t len = (socklen_t)(offsetof(struct sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1));
+    bind(srv, (struct sockaddr *)&addr, len);
+    listen(srv, 1);
+    int cli = socket(AF_UNIX, SOCK_STREAM, 0);
+    connect(cli, (struct sockaddr *)&addr, len);
+    int conn = accept4(srv, NULL, NULL, SOCK_CLOEXEC);
+    close(srv);
+    (void)conn;
+
+    int p[2], q[2];
+    pipe(p);
+    pipe2(q, O_CLOEXEC);
+    close(q[0]);
+    /* q[1] is now a dup of cli: one dup leaked, q[1]'s pipe record gone */
+    dup2(cli, q[1]);
+    close(dup(p[0]));
+
+    int e = eventfd(0, 0);
+    int ep = epoll_create1(EPOLL_CLOEXEC);
+    close(epoll_create(1));
+    (void)e;
+    (void)ep;
+}
+
+int main(void) {
+    pthread_t t[THREADS];
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (int i = 0; i < THREADS; ++i) pthread_create(&t[i], NULL, churn, NULL);
+    for (int i = 0; i < THREADS; ++i) pthread_join(t[i], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("fd_test: %.0f ns per eventfd+close pair per thread\n", ns / CHURN);
+
+    leak_fds();
+    printf("fd_test: expect 2 open, 1 socket, 1 accept, 1 dup, 2 pipe, 1 eventfd, 1 epoll\n");
+    return 0;
+}
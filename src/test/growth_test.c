@@ -0,0 +1,47 @@
+/* growth_test.c
+ * Run for about 3 seconds under LEAK_GROWTH: one site keeps 20 more
+ * blocks of 1000 bytes every 50 ms, a pool allocates 20 blocks of 1500
+ * bytes every 50 ms and frees them all every 400 ms, and a cache of 100
+ * blocks of 2000 bytes is filled once at start. Only the first grows
+ * steadily.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define ROUNDS 60
+#define PER_ROUND 20
+#define POOL_ROUNDS 8
+#define CACHE 100
+
+static void *kept[ROUNDS * PER_ROUND];
+static void *pool[POOL_ROUNDS * PER_ROUND];
+static void *cache[CACHE];
+
+static void __attribute__((noinline)) grow(int round) {
+    for (int i = 0; i < PER_ROUND; ++i) kept[round * PER_ROUND + i] = malloc(1000);
+}
+
+static void __attribute__((noinline)) refill(int round) {
+    int r = round % POOL_ROUNDS;
+    if (!r)
+        for (int i = 0; i < POOL_ROUNDS * PER_ROUND; ++i) {
+            free(pool[i]);
+            pool[i] = NULL;
+        }
+    for (int i = 0; i < PER_ROUND; ++i) pool[r * PER_ROUND + i] = malloc(1500);
+}
+
+static void __attribute__((noinline)) fill_cache(void) {
+    for (int i = 0; i < CACHE; ++i) cache[i] = memset(malloc(2000), 0, 2000);
+}
+
+int main(void) {
+    fill_cache();
+    for (int r = 0; r < ROUNDS; ++r) {
+        grow(r);
+        refill(r);
+        nanosleep(&(struct timespec){ .tv_nsec = 50 * 1000000L }, NULL);
+    }
+    return 0;
+}
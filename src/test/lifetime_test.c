@@ -0,0 +1,48 @@
+/* lifetime_test.c
+ * Three sites with known lifetimes for LEAK_LIFETIME: 200000 blocks of
+ * 48 bytes freed right away, 64 of 4000 freed after 300 ms and 16 of 3000
+ * still live at exit, allocated before that wait. Run with
+ * LEAK_LIFETIME_LONG_MS=100 so the last two count as long-lived.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHURN 200000
+#define HELD 64
+#define KEPT 16
+
+static void *volatile sink;
+static void *kept[KEPT];
+
+static void __attribute__((noinline)) churn(void) {
+    for (int i = 0; i < CHURN; ++i) {
+        sink = malloc(48);
+        free(sink);
+    }
+}
+
+static void __attribute__((noinline)) keep(void) {
+    for (int i = 0; i < KEPT; ++i) kept[i] = malloc(3000);
+}
+
+static void __attribute__((noinline)) hold(void) {
+    void *held[HELD];
+    for (int i = 0; i < HELD; ++i) held[i] = malloc(4000);
+    nanosleep(&(struct timespec){ .tv_nsec = 300 * 1000000L }, NULL);
+    for (int i = 0; i < HELD; ++i) free(held[i]);
+}
+
+int main(void) {
+    struct timespec t0, t1;
+    keep();
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    churn();
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double ns = (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    printf("lifetime_test: %.0f ns per malloc+free pair\n", ns / CHURN);
+    hold();
+    printf("lifetime_test: expect %d short blocks of 48, %d long of 4000, %d live of 3000\n",
+           CHURN, HELD, KEPT);
+    return 0;
+}
@@ -0,0 +1,78 @@
+/* sites_test.c
+ * Run for about 3 seconds for leaktop to watch: a thread first allocates
+ * from 4096 different stacks, more than a fixed per-thread site table
+ * holds, then frees the blocks of 4000 bytes that main keeps allocating
+ * from one site, never more than 64 at a time. Prints its pid first.
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LEVELS 12                       /* 2^LEVELS stacks */
+#define POOL 64
+#define ROUNDS 60
+
+static void *pool[POOL];
+static int head, tail;                  /* pool[tail % POOL] is the oldest */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static volatile int done;
+static volatile unsigned steps;
+
+/* one frame per level, left or right by the bits of `path`; the two
+ * differ so that the compiler keeps both */
+static void __attribute__((noinline)) right(int level, unsigned path);
+
+static void __attribute__((noinline)) left(int level, unsigned path) {
+    if (level == LEVELS)
+        free(malloc(16));
+    else if (path >> level & 1)
+        left(level + 1, path);
+    else
+        right(level + 1, path);
+    steps += 1;
+}
+
+static void __attribute__((noinline)) right(int level, unsigned path) {
+    if (level == LEVELS)
+        free(malloc(32));
+    else if (path >> level & 1)
+        left(level + 1, path);
+    else
+        right(level + 1, path);
+    steps += 2;
+}
+
+static void *drain(void *arg) {
+    (void)arg;
+    for (unsigned path = 0; path < 1u << LEVELS; ++path) left(0, path);
+    while (!done) {
+        pthread_mutex_lock(&lock);
+        while (tail != head) free(pool[tail++ % POOL]);
+        pthread_mutex_unlock(&lock);
+        nanosleep(&(struct timespec){ .tv_nsec = 1000000L }, NULL);
+    }
+    return NULL;
+}
+
+static void __attribute__((noinline)) fill(void) {
+    pthread_mutex_lock(&lock);
+    while (head - tail < POOL) pool[head++ % POOL] = malloc(4000);
+    pthread_mutex_unlock(&lock);
+}
+
+int main(void) {
+    printf("%d\n", (int)getpid());
+    fflush(stdout);
+    pthread_t t;
+    pthread_create(&t, NULL, drain, NULL);
+    for (int r = 0; r < ROUNDS; ++r) {
+        fill();
+        nanosleep(&(struct timespec){ .tv_nsec = 50 * 1000000L }, NULL);
+    }
+    done = 1;
+    pthread_join(t, NULL);
+    while (tail != head) free(pool[tail++ % POOL]);
+    return 0;
+}
@@ -0,0 +1,96 @@
+/* snapshot_test.c
+ * Take live snapshots through all three triggers (leak_snapshot(),
+ * SIGUSR2 and the control file) while worker threads keep allocating,
+ * with a site that grows between snapshots. Run with the base detector in
+ * LD_PRELOAD and LEAK_SNAPSHOT=1, LEAK_SNAPSHOT_FILE and
+ * LEAK_SNAPSHOT_DIR set; exits non-zero if a snapshot does not appear.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define THREADS 4
+#define WINDOW 64
+
+static volatile int stop;
+
+static void *churn(void *arg) {
+    unsigned seed = (unsigned)(size_t)arg;
+    void *win[WINDOW] = {0};
+    while (!stop) {
+        int k = rand_r(&seed) % WINDOW;
+        free(win[k]);
+        win[k] = malloc(1 + rand_r(&seed) % 256);
+    }
+    for (int k = 0; k < WINDOW; ++k) free(win[k]);
+    return NULL;
+}
+
+/* the "slow leak": every call keeps n more blocks */
+static void __attribute__((noinline)) leak_slow(int n) {
+    for (int i = 0; i < n; ++i) {
+        void *p = malloc(48);
+        __asm__ __volatile__("" : : "r"(p) : "memory");
+    }
+}
+
+static int wait_for(const char *path, int present) {
+    for (int i = 0; i < 500; ++i) {
+        if ((access(path, F_OK) == 0) == present) return 1;
+        struct timespec ts = { 0, 10 * 1000 * 1000 };
+        nanosleep(&ts, NULL);
+    }
+    return 0;
+}
+
+int main(void) {
+    int (*snapshot)(void) = (int (*)(void))dlsym(RTLD_DEFAULT, "leak_snapshot");
+    const char *dir = getenv("LEAK_SNAPSHOT_DIR");
+    const char *ctl = getenv("LEAK_SNAPSHOT_FILE");
+    if (!snapshot || !dir || !ctl) {
+        fprintf(stderr, "snapshot_test: run with the base detector, LEAK_SNAPSHOT=1, "
+                        "LEAK_SNAPSHOT_DIR and LEAK_SNAPSHOT_FILE\n");
+        return 2;
+    }
+
+    pthread_t t[THREADS];
+    for (int i = 0; i < THREADS; ++i) pthread_create(&t[i], NULL, churn, (void *)(size_t)(i + 1));
+
+    int failed = 0;
+    char path[4096];
+
+    /* one call site, so the snapshots see a single site growing by 100
+     * blocks per round */
+    for (int round = 1; round <= 3; ++round) {
+        leak_slow(100);
+        const char *how = "leak_snapshot()";
+        if (round == 1) {
+            if (snapshot() != 1) failed = 1;
+        } else if (round == 2) {
+            how = "SIGUSR2";
+            raise(SIGUSR2);
+        } else {
+            how = ctl;
+            int fd = open(ctl, O_WRONLY | O_CREAT, 0644);
+            if (fd < 0 || close(fd) != 0 || !wait_for(ctl, 0)) failed = 1;
+        }
+        snprintf(path, sizeof(path), "%s/leak_snapshot.%d.%d.txt", dir, (int)getpid(), round);
+        if (failed || !wait_for(path, 1)) {
+            fprintf(stderr, "snapshot_test: no snapshot %d after %s\n", round, how);
+            failed = 1;
+            break;
+        }
+    }
+
+    stop = 1;
+    for (int i = 0; i < THREADS; ++i) pthread_join(t[i], NULL);
+    fprintf(stderr, "snapshot_test: %s\n", failed ? "FAILED" : "done");
+    return failed;
+}
@@ -0,0 +1,148 @@
+/* storm_test.c
+ * Spawn multiple threads that hammer malloc/calloc/realloc/free and check
+ * that the preloaded detector neither loses records nor keeps stale ones.
+ * Run with LD_PRELOAD set to one of the detector libraries; exits non-zero
+ * on a mismatch.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WINDOW 64
+#define RETAIN 32
+
+typedef int (*lookup_fn)(const void *ptr, size_t *size);
+
+typedef struct {
+    int loops;
+    int id;
+    unsigned seed;
+    void *kept[RETAIN];
+    size_t kept_size[RETAIN];
+    long missing;       /* blocks the detector did not know right after allocation */
+} thr_arg_t;
+
+static lookup_fn leak_lookup;
+static int use_calloc;      /* only exercise the calls the detector wraps */
+static int use_realloc;
+static pthread_barrier_t ready_barrier;
+static pthread_barrier_t go_barrier;
+static pthread_barrier_t done_barrier;
+static pthread_barrier_t exit_barrier;
+
+static void check(thr_arg_t *a, void *p, size_t size) {
+    size_t got = 0;
+    if (!leak_lookup(p, &got) || got != size) a->missing++;
+}
+
+static void *worker(void *arg) {
+    thr_arg_t *a = (thr_arg_t*)arg;
+    void *win[WINDOW] = {0};
+
+    pthread_barrier_wait(&ready_barrier);
+    pthread_barrier_wait(&go_barrier);
+    for (int i = 0; i < a->loops; ++i) {
+        int k = rand_r(&a->seed) % WINDOW;
+        size_t size = 1 + rand_r(&a->seed) % 512;
+        if (!win[k]) {
+            win[k] = (use_calloc && (i & 1)) ? calloc(1, size) : malloc(size);
+            check(a, win[k], size);
+        } else if (use_realloc && i % 3 == 0) {
+            win[k] = realloc(win[k], size);
+            check(a, win[k], size);
+        } else {
+            free(win[k]);
+            win[k] = NULL;
+        }
+    }
+    for (int k = 0; k < WINDOW; ++k) free(win[k]);
+
+    for (int r = 0; r < RETAIN; ++r) {
+        a->kept_size[r] = 16 + r;
+        a->kept[r] = malloc(a->kept_size[r]);
+        check(a, a->kept[r], a->kept_size[r]);
+    }
+    /* stay alive so thread teardown does not disturb the live count */
+    pthread_barrier_wait(&done_barrier);
+    pthread_barrier_wait(&exit_barrier);
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    int threads = 8;
+    int loops = 200000;
+    if (argc > 1) threads = atoi(argv[1]);
+    if (argc > 2) loops = atoi(argv[2]);
+
+    leak_lookup = (lookup_fn)dlsym(RTLD_DEFAULT, "leak_lookup");
+    size_t (*live_count)(void) = (size_t (*)(void))dlsym(RTLD_DEFAULT, "leak_live_count");
+    if (!leak_lookup || !live_count) {
+        fprintf(stderr, "storm_test: run with a detector in LD_PRELOAD\n");
+        return 2;
+    }
+
+    void *probe = calloc(1, 8);
+    use_calloc = leak_lookup(probe, NULL);
+    probe = realloc(probe, 4096);
+    use_realloc = leak_lookup(probe, NULL);
+    free(probe);
+
+    pthread_t *t = calloc(threads, sizeof(pthread_t));
+    thr_arg_t *args = calloc(threads, sizeof(thr_arg_t));
+    if (!t || !args) return 2;
+
+    fprintf(stderr, "storm_test: threads=%d loops=%d calloc=%d realloc=%d\n",
+            threads, loops, use_calloc, use_realloc);
+    pthread_barrier_init(&ready_barrier, NULL, threads + 1);
+    pthread_barrier_init(&go_barrier, NULL, threads + 1);
+    pthread_barrier_init(&done_barrier, NULL, threads + 1);
+    pthread_barrier_init(&exit_barrier, NULL, threads + 1);
+    for (int i = 0; i < threads; ++i) {
+        args[i].loops = loops;
+        args[i].id = i;
+        args[i].seed = 12345u + i;
+        if (pthread_create(&t[i], NULL, worker, &args[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    pthread_barrier_wait(&ready_barrier);
+    size_t before = live_count();
+    pthread_barrier_wait(&go_barrier);
+    pthread_barrier_wait(&done_barrier);
+    size_t after = live_count();
+
+    int failed = 0;
+    long missing = 0;
+    for (int i = 0; i < threads; ++i) {
+        missing += args[i].missing;
+        for (int r = 0; r < RETAIN; ++r) {
+            size_t got = 0;
+            if (!leak_lookup(args[i].kept[r], &got) || got != args[i].kept_size[r]) missing++;
+        }
+    }
+    if (missing) {
+        fprintf(stderr, "storm_test: %ld records lost\n", missing);
+        failed = 1;
+    }
+    if (after - before != (size_t)threads * RETAIN) {
+        fprintf(stderr, "storm_test: live count grew by %zu, expected %zu\n",
+                after - before, (size_t)threads * RETAIN);
+        failed = 1;
+    }
+
+    for (int i = 0; i < threads; ++i) {
+        for (int r = 0; r < RETAIN; ++r) free(args[i].kept[r]);
+    }
+    pthread_barrier_wait(&exit_barrier);
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(t[i], NULL);
+    }
+
+    fprintf(stderr, "storm_test: %s\n", failed ? "FAILED" : "done");
+    return failed;
+}
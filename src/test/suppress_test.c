@@ -0,0 +1,34 @@
+/* suppress_test.c
+ * Leaks from three sites for LEAK_SUPPRESS: 5 blocks of 111 bytes from
+ * noisy_cache(), 2 of 222 from kept() and, through a plugin it dlopens
+ * after startup, 3 of 444. Run with func:noisy_* and the plugin's module
+ * suppressed, only the 2 blocks of 222 may be reported.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void __attribute__((noinline)) noisy_cache(void) {
+    for (int i = 0; i < 5; ++i) memset(malloc(111), 1, 111);
+}
+
+static void __attribute__((noinline)) kept(void) {
+    for (int i = 0; i < 2; ++i) memset(malloc(222), 2, 222);
+}
+
+int main(int argc, char **argv) {
+    noisy_cache();
+    kept();
+    const char *plugin = argc > 1 ? argv[1] : "build/libdlclose_plugin.so";
+    void *h = dlopen(plugin, RTLD_NOW);
+    if (!h) {
+        fprintf(stderr, "suppress_test: %s\n", dlerror());
+        return 1;
+    }
+    void (*leak)(void) = (void (*)(void))dlsym(h, "plugin_leak");
+    if (leak) leak();
+    printf("suppress_test: expect only 2 blocks of 222 bytes\n");
+    return 0;
+}
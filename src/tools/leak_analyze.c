@@ -0,0 +1,1010 @@
+/* leak_analyze.c
+ * Compiled replacement for scripts/analyze_leaks.sh.
+ *
+ *   leak_analyze [options] [leak_analysis.txt]
+ *
+ * Reads every report format (`#ptr size type callers` from the base
+ * detector, `#ptr size caller binary func` from the line detector and the
+ * binary one of leak_report_format.h, which is mapped and used in place),
+ * symbolizes every distinct (binary, offset) once with the in-process
+ * ELF/DWARF reader from leak_elf.h, and prints the same report as the
+ * script. Loading binaries, resolving addresses and formatting leaks are
+ * spread over -j threads (default: all online CPUs).
+ *
+ * Results are kept in the per-build-id cache from leak_symcache.h, so a
+ * binary is only parsed when the report has offsets the cache has not
+ * seen yet. --no-cache skips the cache entirely.
+ *
+ * --diff OLD compares two reports of the same program (typically two
+ * live snapshots) and prints only the sites whose block count or bytes
+ * grew, largest growth first.
+ */
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <math.h>
+#include <unistd.h>
+#include "../detector/leak_elf.h"
+#include "../detector/leak_report_format.h"
+#include "../detector/leak_symcache.h"
+
+#define MAX_DET_FRAMES 32
+
+/* ---- options (same names as analyze_leaks.sh) ---- */
+
+static struct {
+    int summary, depth, compact_paths, no_dup, show_internal, json, no_raw;
+    int hide_system_only, hide_system, hide_start;
+    int fr_start, fr_end;       /* --frame-range, 0 = unset */
+    int jobs;
+    int no_cache;
+    const char *diff_base;      /* --diff OLD */
+} opt = { .depth = 999 };
+
+/* ---- small helpers ---- */
+
+typedef struct {
+    const char *p;
+    size_t n;
+} str_t;
+
+typedef struct {
+    char *p;
+    size_t len, cap;
+} buf_t;
+
+static void buf_reserve(buf_t *b, size_t n) {
+    if (b->len + n <= b->cap) return;
+    size_t cap = b->cap ? b->cap : 4096;
+    while (cap < b->len + n) cap *= 2;
+    b->p = realloc(b->p, cap);
+    if (!b->p) {
+        perror("realloc");
+        exit(1);
+    }
+    b->cap = cap;
+}
+
+static void buf_put(buf_t *b, const char *s, size_t n) {
+    buf_reserve(b, n);
+    memcpy(b->p + b->len, s, n);
+    b->len += n;
+}
+
+static void buf_puts(buf_t *b, const char *s) { buf_put(b, s, strlen(s)); }
+
+static void buf_printf(buf_t *b, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+static void buf_printf(buf_t *b, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(NULL, 0, fmt, ap);
+    va_end(ap);
+    buf_reserve(b, (size_t)n + 1);
+    va_start(ap, fmt);
+    vsnprintf(b->p + b->len, (size_t)n + 1, fmt, ap);
+    va_end(ap);
+    b->len += (size_t)n;
+}
+
+static void buf_json(buf_t *b, const char *s) {
+    for (; *s; ++s) {
+        if (*s == '\\' || *s == '"') buf_put(b, "\\", 1);
+        if (*s == '\n') buf_put(b, "\\n", 2);
+        else buf_put(b, s, 1);
+    }
+}
+
+static uint64_t hash_bytes(const char *p, size_t n, uint64_t h) {
+    for (size_t i = 0; i < n; ++i) h = (h ^ (unsigned char)p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static void *xcalloc(size_t n, size_t size) {
+    void *p = calloc(n ? n : 1, size);
+    if (!p) {
+        perror("calloc");
+        exit(1);
+    }
+    return p;
+}
+
+/* ---- binaries and unique addresses ---- */
+
+typedef struct {
+    char *path;
+    int loaded;                 /* probed: load base and build-id known */
+    int misses;                 /* offsets the cache could not answer */
+    leak_elf_t elf;
+    leak_symcache_t cache;
+} binary_t;
+
+typedef struct {
+    uint32_t bin;               /* UINT32_MAX: no binary ("-") */
+    uint64_t off;
+    str_t text;                 /* address as written in the report */
+    int miss;                   /* not in the symbol cache */
+    /* resolved */
+    char *func;
+    char *fileline;
+    char *chain;                /* "func (file:line)" */
+} addr_t;
+
+static binary_t *bins;
+static size_t nbins, cap_bins;
+static uint32_t *bin_index;     /* open addressing over bins, UINT32_MAX empty */
+static size_t bin_index_mask;
+
+static addr_t *addrs;
+static size_t naddrs, cap_addrs;
+static uint32_t *addr_index;
+static size_t addr_index_mask;
+
+static uint32_t intern_bin(str_t s) {
+    if (s.n == 0 || (s.n == 1 && s.p[0] == '-')) return UINT32_MAX;
+    if (!bin_index || (nbins + 1) * 2 > bin_index_mask + 1) {
+        size_t cap = bin_index ? (bin_index_mask + 1) * 2 : 256;
+        free(bin_index);
+        bin_index = xcalloc(cap, sizeof(*bin_index));
+        memset(bin_index, 0xff, cap * sizeof(*bin_index));
+        bin_index_mask = cap - 1;
+        for (size_t i = 0; i < nbins; ++i) {
+            size_t j = hash_bytes(bins[i].path, strlen(bins[i].path), 0xcbf29ce484222325ULL) & bin_index_mask;
+            while (bin_index[j] != UINT32_MAX) j = (j + 1) & bin_index_mask;
+            bin_index[j] = (uint32_t)i;
+        }
+    }
+    size_t j = hash_bytes(s.p, s.n, 0xcbf29ce484222325ULL) & bin_index_mask;
+    while (bin_index[j] != UINT32_MAX) {
+        const char *p = bins[bin_index[j]].path;
+        if (strncmp(p, s.p, s.n) == 0 && p[s.n] == '\0') return bin_index[j];
+        j = (j + 1) & bin_index_mask;
+    }
+    if (nbins == cap_bins) {
+        cap_bins = cap_bins ? cap_bins * 2 : 64;
+        bins = realloc(bins, cap_bins * sizeof(*bins));
+    }
+    memset(&bins[nbins], 0, sizeof(*bins));
+    bins[nbins].path = strndup(s.p, s.n);
+    bin_index[j] = (uint32_t)nbins;
+    return (uint32_t)nbins++;
+}
+
+static uint64_t addr_hash(uint32_t bin, str_t text) {
+    return hash_bytes(text.p, text.n, 0xcbf29ce484222325ULL ^ ((uint64_t)bin * 0x9e3779b97f4a7c15ULL));
+}
+
+static uint32_t intern_addr(uint32_t bin, str_t text) {
+    if (!addr_index || (naddrs + 1) * 2 > addr_index_mask + 1) {
+        size_t cap = addr_index ? (addr_index_mask + 1) * 2 : 4096;
+        free(addr_index);
+        addr_index = xcalloc(cap, sizeof(*addr_index));
+        memset(addr_index, 0xff, cap * sizeof(*addr_index));
+        addr_index_mask = cap - 1;
+        for (size_t i = 0; i < naddrs; ++i) {
+            size_t j = addr_hash(addrs[i].bin, addrs[i].text) & addr_index_mask;
+            while (addr_index[j] != UINT32_MAX) j = (j + 1) & addr_index_mask;
+            addr_index[j] = (uint32_t)i;
+        }
+    }
+    size_t j = addr_hash(bin, text) & addr_index_mask;
+    while (addr_index[j] != UINT32_MAX) {
+        const addr_t *a = &addrs[addr_index[j]];
+        if (a->bin == bin && a->text.n == text.n && memcmp(a->text.p, text.p, text.n) == 0)
+            return addr_index[j];
+        j = (j + 1) & addr_index_mask;
+    }
+    if (naddrs == cap_addrs) {
+        cap_addrs = cap_addrs ? cap_addrs * 2 : 4096;
+        addrs = realloc(addrs, cap_addrs * sizeof(*addrs));
+    }
+    addr_t *a = &addrs[naddrs];
+    memset(a, 0, sizeof(*a));
+    a->bin = bin;
+    a->text = text;
+    a->off = strtoull(text.p, NULL, 16);
+    addr_index[j] = (uint32_t)naddrs;
+    return (uint32_t)naddrs++;
+}
+
+/* ---- leaks ---- */
+
+typedef struct {
+    str_t ptr, size, type, raw;
+    str_t func;                 /* line format: name from dladdr or "-" */
+    str_t min, max;             /* sites format */
+    uint32_t first, nframes;    /* into frames[] */
+    long count;                 /* blocks: 1 unless sites format */
+    double est;
+    long dcount;                /* --diff: growth since the older report */
+    double dest;
+} leak_t;
+
+static leak_t *leaks;
+static size_t nleaks, cap_leaks;
+static uint32_t *frames;
+static size_t nframes, cap_frames;
+static int has_callers, has_func, has_sites, two_cols;
+static uint64_t sample_bytes;
+
+static void add_frame(uint32_t id) {
+    if (nframes == cap_frames) {
+        cap_frames = cap_frames ? cap_frames * 2 : 65536;
+        frames = realloc(frames, cap_frames * sizeof(*frames));
+    }
+    frames[nframes++] = id;
+}
+
+static int next_field(const char **p, const char *end, str_t *out) {
+    const char *s = *p;
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    const char *e = s;
+    while (e < end && *e != ' ' && *e != '\t') e++;
+    out->p = s;
+    out->n = (size_t)(e - s);
+    *p = e;
+    return out->n > 0;
+}
+
+static double estimate(uint64_t size) {
+    if (!sample_bytes || !size) return (double)size;
+    return (double)size / -expm1(-(double)size / (double)sample_bytes);
+}
+
+/* frames of a `callers` field: comma-separated offset@binary */
+static void add_callers(str_t raw) {
+    const char *c = raw.p, *ce = raw.p + raw.n;
+    for (int k = 0; c < ce && k < MAX_DET_FRAMES; ++k) {
+        const char *comma = memchr(c, ',', (size_t)(ce - c));
+        const char *pe = comma ? comma : ce;
+        const char *at = memchr(c, '@', (size_t)(pe - c));
+        str_t a = { c, (size_t)((at ? at : pe) - c) };
+        str_t b = { at ? at + 1 : pe, at ? (size_t)(pe - at - 1) : 0 };
+        add_frame(intern_addr(intern_bin(b), a));
+        c = comma ? comma + 1 : ce;
+    }
+}
+
+static void add_leak(const leak_t *l) {
+    if (nleaks == cap_leaks) {
+        cap_leaks = cap_leaks ? cap_leaks * 2 : 4096;
+        leaks = realloc(leaks, cap_leaks * sizeof(*leaks));
+    }
+    leaks[nleaks++] = *l;
+}
+
+/* A binary report (leak_report_format.h), used in place: type names point
+ * into the mapping, and each stack is turned into frames once, however
+ * many sites share it. */
+static void parse_report_bin(const leak_report_header_t *h) {
+    has_callers = has_sites = 1;
+    sample_bytes = h->sample_bytes;
+    const leak_report_site_t *sites = (const void *)((const char *)h + h->sites.off);
+    size_t nstacks = h->stacks.n - 1;
+    uint32_t *stack_first = xcalloc(nstacks, sizeof(*stack_first));
+    uint32_t *stack_n = xcalloc(nstacks, sizeof(*stack_n));
+    str_t *stack_raw = xcalloc(nstacks, sizeof(*stack_raw));
+    char (*nums)[3][24] = xcalloc(h->sites.n, sizeof(*nums));
+    for (size_t i = 0; i < h->sites.n; ++i) {
+        const leak_report_site_t *s = &sites[i];
+        leak_t l;
+        memset(&l, 0, sizeof(l));
+        l.ptr = (str_t){ "site", 4 };
+        l.count = (long)s->count;
+        l.est = (double)s->est;
+        const char *type = leak_report_type(h, s->type);
+        l.type = (str_t){ type, strlen(type) };
+        l.size = (str_t){ nums[i][0], (size_t)sprintf(nums[i][0], "%llu", (unsigned long long)s->bytes) };
+        l.min = (str_t){ nums[i][1], (size_t)sprintf(nums[i][1], "%llu", (unsigned long long)s->min) };
+        l.max = (str_t){ nums[i][2], (size_t)sprintf(nums[i][2], "%llu", (unsigned long long)s->max) };
+        if (s->stack >= nstacks) {
+            l.raw = (str_t){ "-", 1 };
+            l.first = (uint32_t)nframes;
+            add_callers(l.raw);
+        } else {
+            if (!stack_raw[s->stack].p) {
+                size_t n = leak_report_callers(h, s->stack, NULL, 0);
+                char *raw = malloc(n + 1);
+                if (!raw) {
+                    perror("malloc");
+                    exit(1);
+                }
+                leak_report_callers(h, s->stack, raw, n + 1);
+                stack_raw[s->stack] = (str_t){ raw, n };
+                stack_first[s->stack] = (uint32_t)nframes;
+                add_callers(stack_raw[s->stack]);
+                stack_n[s->stack] = (uint32_t)nframes - stack_first[s->stack];
+            }
+            l.raw = stack_raw[s->stack];
+            l.first = stack_first[s->stack];
+        }
+        l.nframes = s->stack < nstacks ? stack_n[s->stack] : (uint32_t)nframes - l.first;
+        add_leak(&l);
+    }
+    free(stack_first);
+    free(stack_n);
+    free(stack_raw);
+}
+
+static void parse_report(const char *p, size_t len) {
+    const char *end = p + len;
+    int first_line = 1;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *le = nl ? nl : end;
+        if (le > p && le[-1] == '\r') le--;
+        if (p < le && *p == '#') {
+            if (first_line) {
+                str_t h = { p, (size_t)(le - p) };
+                has_func = memmem(h.p, h.n, "func", 4) != NULL;
+                has_callers = memmem(h.p, h.n, "callers", 7) != NULL;
+                has_sites = h.n >= 6 && !memcmp(h.p, "#sites", 6);
+                const char *sb = memmem(h.p, h.n, "sample_bytes=", 13);
+                if (sb) sample_bytes = strtoull(sb + 13, NULL, 10);
+            }
+        } else if (p < le) {
+            const char *q = p;
+            leak_t l;
+            memset(&l, 0, sizeof(l));
+            str_t f3 = { 0 }, f4 = { 0 }, f5 = { 0 };
+            l.count = 1;
+            if (has_sites) {
+                /* count bytes est_bytes min max type callers */
+                str_t cnt, est;
+                next_field(&q, le, &cnt);
+                next_field(&q, le, &l.size);
+                next_field(&q, le, &est);
+                next_field(&q, le, &l.min);
+                next_field(&q, le, &l.max);
+                next_field(&q, le, &f3);
+                next_field(&q, le, &f4);
+                l.ptr = (str_t){ "site", 4 };
+                l.count = strtol(cnt.p, NULL, 10);
+                l.est = strtod(est.p, NULL);
+            } else {
+                next_field(&q, le, &l.ptr);
+                next_field(&q, le, &l.size);
+                int nf = 2 + next_field(&q, le, &f3);
+                nf += next_field(&q, le, &f4);
+                nf += next_field(&q, le, &f5);
+                if (nleaks == 0 && nf == 2) two_cols = 1;
+                l.est = estimate(strtoull(l.size.p, NULL, 10));
+            }
+            l.first = (uint32_t)nframes;
+            if (has_callers) {
+                l.type = f3;
+                l.raw = f4;
+                add_callers(f4);
+            } else if (!two_cols) {
+                l.func = f5;
+                add_frame(intern_addr(intern_bin(f4), f3));
+            }
+            l.nframes = (uint32_t)nframes - l.first;
+            add_leak(&l);
+        }
+        first_line = 0;
+        p = nl ? nl + 1 : end;
+    }
+}
+
+/* ---- diff ---- */
+
+typedef struct {
+    int used;
+    size_t rep;                 /* leak whose frames stand for the site */
+    long count[2];              /* [0] older report, [1] newer */
+    double est[2];
+} diff_t;
+
+static int diff_cmp(const void *x, const void *y) {
+    const leak_t *a = x, *b = y;
+    if (a->dest != b->dest) return a->dest > b->dest ? -1 : 1;
+    if (a->dcount != b->dcount) return a->dcount > b->dcount ? -1 : 1;
+    return a->first < b->first ? -1 : a->first > b->first;
+}
+
+/* Fold leaks[0..n_old) and leaks[n_old..) by (type, callers) and keep one
+ * entry per site that grew. Offsets are module-relative, so this also
+ * matches sites across runs of the same binaries. */
+static void build_diff(size_t n_old) {
+    size_t cap = 1;
+    while (cap < nleaks * 2) cap *= 2;
+    diff_t *tab = xcalloc(cap, sizeof(*tab));
+    for (size_t i = 0; i < nleaks; ++i) {
+        const leak_t *l = &leaks[i];
+        int side = i >= n_old;
+        uint64_t h = hash_bytes(l->raw.p, l->raw.n, hash_bytes(l->type.p, l->type.n, 0xcbf29ce484222325ULL));
+        size_t j = h & (cap - 1);
+        while (tab[j].used) {
+            const leak_t *r = &leaks[tab[j].rep];
+            if (r->raw.n == l->raw.n && r->type.n == l->type.n && !memcmp(r->raw.p, l->raw.p, l->raw.n) &&
+                !memcmp(r->type.p, l->type.p, l->type.n))
+                break;
+            j = (j + 1) & (cap - 1);
+        }
+        if (!tab[j].used || side) tab[j].rep = i;
+        tab[j].used = 1;
+        tab[j].count[side] += l->count;
+        tab[j].est[side] += l->est;
+    }
+
+    leak_t *grown = xcalloc(nleaks, sizeof(*grown));
+    size_t k = 0;
+    for (size_t j = 0; j < cap; ++j) {
+        const diff_t *d = &tab[j];
+        if (!d->used || (d->count[1] <= d->count[0] && d->est[1] <= d->est[0])) continue;
+        leak_t *g = &grown[k++];
+        *g = leaks[d->rep];
+        g->count = d->count[1];
+        g->est = d->est[1];
+        g->dcount = d->count[1] - d->count[0];
+        g->dest = d->est[1] - d->est[0];
+    }
+    qsort(grown, k, sizeof(*grown), diff_cmp);
+    free(tab);
+    free(leaks);
+    leaks = grown;
+    nleaks = cap_leaks = k;
+}
+
+/* ---- parallel phases ---- */
+
+typedef void (*work_fn)(size_t i);
+
+static struct {
+    work_fn fn;
+    size_t n;
+    size_t next;
+} work;
+
+static void *worker(void *arg) {
+    (void)arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&work.next, 1, __ATOMIC_RELAXED);
+        if (i >= work.n) break;
+        work.fn(i);
+    }
+    return NULL;
+}
+
+static void run_parallel(work_fn fn, size_t n) {
+    work.fn = fn;
+    work.n = n;
+    work.next = 0;
+    int t = opt.jobs;
+    if ((size_t)t > n) t = n ? (int)n : 1;
+    pthread_t *th = xcalloc((size_t)t, sizeof(*th));
+    int started = 0;
+    for (int i = 1; i < t; ++i)
+        if (pthread_create(&th[i], NULL, worker, NULL) == 0) started = i;
+        else break;
+    worker(NULL);
+    for (int i = 1; i <= started; ++i) pthread_join(th[i], NULL);
+    free(th);
+}
+
+static void probe_binary(size_t i) {
+    binary_t *b = &bins[i];
+    b->loaded = leak_elf_probe(&b->elf, b->path);
+    if (b->loaded && !opt.no_cache) leak_symcache_open(&b->cache, b->elf.build_id);
+}
+
+static void load_binary(size_t i) {
+    binary_t *b = &bins[i];
+    if (b->loaded && b->misses) leak_elf_load(&b->elf, b->path);
+}
+
+static char *fmt_str(const char *fmt, const char *a, unsigned b) {
+    int n = snprintf(NULL, 0, fmt, a, b);
+    char *s = malloc((size_t)n + 1);
+    if (s) snprintf(s, (size_t)n + 1, fmt, a, b);
+    return s;
+}
+
+/* Same strings addr2line -f -p produces, split the way the script splits
+ * them: "func" and "file:line", with ?? for the unknown parts. */
+static void set_addr(addr_t *a, const char *func, const char *file, unsigned line) {
+    if (a->bin == UINT32_MAX) {
+        a->func = strndup(a->text.p, a->text.n);
+        a->fileline = strdup("<unknown>");
+    } else {
+        a->func = strdup(func ? func : "??");
+        if (file && line) a->fileline = fmt_str("%s:%u", file, line);
+        else if (file) a->fileline = fmt_str("%s:?", file, 0);
+        else a->fileline = strdup(func ? "??:?" : "??:0");
+    }
+    if (strcmp(a->fileline, "<unknown>") == 0) {
+        a->chain = strdup(a->func);
+    } else {
+        size_t n = strlen(a->func) + strlen(a->fileline) + 4;
+        a->chain = malloc(n);
+        snprintf(a->chain, n, "%s (%s)", a->func, a->fileline);
+    }
+}
+
+/* first pass: answer from the cache, count what is left per binary */
+static void resolve_cached(size_t i) {
+    addr_t *a = &addrs[i];
+    const char *func = NULL, *file = NULL;
+    unsigned line = 0;
+    if (a->bin != UINT32_MAX) {
+        binary_t *b = &bins[a->bin];
+        if (b->loaded && !leak_symcache_find(&b->cache, a->off, &func, &file, &line)) {
+            a->miss = 1;
+            __atomic_fetch_add(&b->misses, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+    set_addr(a, func, file, line);
+}
+
+static void resolve_addr(size_t i) {
+    addr_t *a = &addrs[i];
+    if (!a->miss) return;
+    const binary_t *b = &bins[a->bin];
+    const char *func = NULL, *file = NULL;
+    unsigned line = 0;
+    leak_elf_lookup(&b->elf, a->off + b->elf.base_vaddr, &func, &file, &line);
+    set_addr(a, func, file, line);
+}
+
+/* merge what the binaries resolved into their caches */
+static leak_symcache_entry_t **cache_adds;
+static size_t *cache_nadds;
+
+static void save_cache(size_t i) {
+    binary_t *b = &bins[i];
+    if (cache_nadds[i]) leak_symcache_write(b->elf.build_id, &b->cache, cache_adds[i], cache_nadds[i]);
+}
+
+static void update_caches(void) {
+    cache_adds = xcalloc(nbins, sizeof(*cache_adds));
+    cache_nadds = xcalloc(nbins, sizeof(*cache_nadds));
+    for (size_t i = 0; i < nbins; ++i)
+        if (bins[i].misses && bins[i].elf.build_id[0])
+            cache_adds[i] = xcalloc((size_t)bins[i].misses, sizeof(**cache_adds));
+    for (size_t i = 0; i < naddrs; ++i) {
+        const addr_t *a = &addrs[i];
+        if (!a->miss || !cache_adds[a->bin]) continue;
+        const binary_t *b = &bins[a->bin];
+        leak_symcache_entry_t *e = &cache_adds[a->bin][cache_nadds[a->bin]++];
+        e->off = a->off;
+        leak_elf_lookup(&b->elf, a->off + b->elf.base_vaddr, &e->func, &e->file, &e->line);
+    }
+    run_parallel(save_cache, nbins);
+}
+
+/* ---- formatting ---- */
+
+#define CHUNK 256
+
+typedef struct {
+    buf_t out;
+    int any_json;
+} chunk_t;
+
+static chunk_t *chunks;
+
+/* per-leak summary key: outermost frame and size estimate */
+typedef struct {
+    const char *func, *fileline, *bin;
+    long count;
+    double est;
+} agg_t;
+
+static agg_t *aggs;
+
+static int is_system_bin(const char *b) {
+    return strstr(b, "libc.so") || strstr(b, "ld-linux") || strstr(b, "/lib/") || strstr(b, "/lib64/");
+}
+
+static const char *bin_name(uint32_t id) { return id == UINT32_MAX ? "-" : bins[id].path; }
+
+static void format_callers_leak(size_t li, buf_t *o, int *any_json) {
+    const leak_t *l = &leaks[li];
+    const addr_t *f[MAX_DET_FRAMES];
+    uint32_t n = l->nframes;
+    for (uint32_t k = 0; k < n; ++k) f[k] = &addrs[frames[l->first + k]];
+
+    agg_t *g = &aggs[li];
+    g->func = "<unknown>";
+    g->fileline = "<unknown>";
+    g->bin = "-";
+    g->count = opt.diff_base ? l->dcount : l->count;
+    g->est = opt.diff_base ? l->dest : l->est;
+    if (n) {
+        g->func = f[n - 1]->func;
+        g->fileline = f[n - 1]->fileline;
+        g->bin = bin_name(f[n - 1]->bin);
+    }
+
+    const addr_t *kept[MAX_DET_FRAMES];
+    int nk = 0;
+    for (uint32_t k = 0; k < n; ++k) {
+        const char *b = bin_name(f[k]->bin);
+        if (!opt.show_internal && b[0]) {
+            if (strstr(b, "libleak_detector")) continue;
+            if (opt.hide_system && is_system_bin(b)) continue;
+            if (opt.hide_start && strcmp(f[k]->func, "_start") == 0 && strstr(f[k]->fileline, "??"))
+                continue;
+        }
+        if (opt.no_dup && nk && strcmp(kept[nk - 1]->chain, f[k]->chain) == 0) continue;
+        kept[nk++] = f[k];
+    }
+    if (opt.hide_start && nk == 0) return;
+
+    int all_system = 1;
+    for (int k = 0; k < nk && all_system; ++k) {
+        const char *b = bin_name(kept[k]->bin);
+        if (strcmp(b, "-") != 0 && !is_system_bin(b)) all_system = 0;
+    }
+    if (opt.hide_system_only && all_system) return;
+
+    /* common directory prefix of every frame's binary, for --compact-paths */
+    char prefix[4096];
+    size_t plen = 0;
+    if (opt.compact_paths) {
+        const char *first = NULL;
+        for (uint32_t k = 0; k < n; ++k) {
+            const char *b = bin_name(f[k]->bin);
+            if (strcmp(b, "-") == 0) continue;
+            if (!first) {
+                first = b;
+                plen = strlen(b);
+                continue;
+            }
+            size_t m = 0;
+            while (m < plen && b[m] == first[m]) m++;
+            plen = m;
+        }
+        if (first) {
+            /* cut back to whole segments */
+            while (plen && first[plen] != '/' && first[plen] != '\0') plen--;
+            if (plen >= sizeof(prefix)) plen = 0;
+            memcpy(prefix, first, plen);
+            prefix[plen] = '\0';
+        }
+    }
+
+    int fs = 1, fe = nk;
+    if (opt.fr_start) {
+        fs = opt.fr_start < 1 ? 1 : opt.fr_start;
+        fe = opt.fr_end > nk ? nk : opt.fr_end;
+    }
+
+    if (!opt.json) {
+        if (opt.diff_base)
+            buf_printf(o, "Growth: %+ld blocks, %+.0f bytes (now %ld blocks, %.0f bytes) [%.*s]\n", l->dcount,
+                       l->dest, l->count, l->est, (int)l->type.n, l->type.p);
+        else if (has_sites && sample_bytes)
+            buf_printf(o, "Site: %ld blocks, %.*s bytes, ~%.0f bytes estimated (min %.*s, max %.*s) [%.*s]\n",
+                       l->count, (int)l->size.n, l->size.p, l->est, (int)l->min.n, l->min.p,
+                       (int)l->max.n, l->max.p, (int)l->type.n, l->type.p);
+        else if (has_sites)
+            buf_printf(o, "Site: %ld blocks, %.*s bytes (min %.*s, max %.*s) [%.*s]\n", l->count,
+                       (int)l->size.n, l->size.p, (int)l->min.n, l->min.p, (int)l->max.n, l->max.p,
+                       (int)l->type.n, l->type.p);
+        else if (sample_bytes)
+            buf_printf(o, "Leak: %.*s (%.*s bytes, ~%.0f bytes estimated) [%.*s]\n", (int)l->ptr.n,
+                       l->ptr.p, (int)l->size.n, l->size.p, l->est, (int)l->type.n, l->type.p);
+        else
+            buf_printf(o, "Leak: %.*s (%.*s bytes) [%.*s]\n", (int)l->ptr.n, l->ptr.p,
+                       (int)l->size.n, l->size.p, (int)l->type.n, l->type.p);
+    } else {
+        if (*any_json) buf_put(o, ",", 1);
+        *any_json = 1;
+        if (opt.diff_base) {
+            buf_printf(o, "{\"count_delta\":%ld,\"bytes_delta\":%.0f,\"count\":%ld,\"est_size\":%.0f,\"type\":\"",
+                       l->dcount, l->dest, l->count, l->est);
+        } else if (has_sites) {
+            buf_printf(o, "{\"count\":%ld,\"size\":%.*s,\"est_size\":%.0f,\"min\":%.*s,\"max\":%.*s,\"type\":\"",
+                       l->count, (int)l->size.n, l->size.p, l->est, (int)l->min.n, l->min.p,
+                       (int)l->max.n, l->max.p);
+        } else {
+            buf_puts(o, "{\"ptr\":\"");
+            buf_put(o, l->ptr.p, l->ptr.n);
+            buf_printf(o, "\",\"size\":%.*s,\"est_size\":%.0f,\"type\":\"", (int)l->size.n, l->size.p,
+                       l->est);
+        }
+        buf_put(o, l->type.p, l->type.n);
+        buf_puts(o, "\",\"frames\":[");
+    }
+
+    int shown = 0;
+    for (int k = fs; k <= fe; ++k) {
+        const addr_t *a = kept[k - 1];
+        const char *b = bin_name(a->bin);
+        if (plen && strcmp(b, "-") != 0 && strncmp(b, prefix, plen) == 0 && b[plen] == '/')
+            b += plen + 1;
+        shown++;
+        if (!opt.json) {
+            buf_printf(o, "  #%02d: %s [binary: %s]\n", shown, a->chain, b);
+        } else {
+            if (shown > 1) buf_put(o, ",", 1);
+            buf_printf(o, "{\"index\":%d,\"function\":\"", shown);
+            buf_json(o, a->func);
+            buf_puts(o, "\",\"file\":\"");
+            buf_json(o, a->fileline);
+            buf_puts(o, "\",\"binary\":\"");
+            buf_json(o, b);
+            buf_puts(o, "\"}");
+        }
+        if (shown >= opt.depth) break;
+    }
+    if (opt.json) {
+        buf_puts(o, "]}");
+        return;
+    }
+    if (!shown) buf_puts(o, "  (no frames shown -- internal/system frames hidden)\n");
+    if (!opt.no_raw) {
+        buf_puts(o, "  raw: ");
+        buf_put(o, l->raw.p, l->raw.n);
+        buf_puts(o, "\n\n");
+    } else {
+        buf_puts(o, "\n");
+    }
+}
+
+static void format_line_leak(size_t li, buf_t *o, int *any_json) {
+    const leak_t *l = &leaks[li];
+    agg_t *g = &aggs[li];
+    g->count = l->count;
+    g->est = l->est;
+    g->func = g->fileline = "<unknown>";
+    g->bin = "-";
+    if (!l->nframes) {
+        buf_printf(o, "Leak: %.*s (%.*s bytes)\n", (int)l->ptr.n, l->ptr.p, (int)l->size.n, l->size.p);
+        return;
+    }
+    const addr_t *a = &addrs[frames[l->first]];
+    if (a->bin == UINT32_MAX) {
+        g->func = NULL;         /* the script leaves these out of the summary */
+        if (!opt.json)
+            buf_printf(o, "Leak: %.*s (%.*s bytes) at <unknown binary> (addr %.*s)\n", (int)l->ptr.n,
+                       l->ptr.p, (int)l->size.n, l->size.p, (int)a->text.n, a->text.p);
+        return;
+    }
+    /* the detector's dladdr name wins over the symbol table */
+    const char *func = a->func;
+    char fbuf[1024];
+    if (l->func.n && !(l->func.n == 1 && l->func.p[0] == '-')) {
+        snprintf(fbuf, sizeof(fbuf), "%.*s", (int)l->func.n, l->func.p);
+        func = fbuf;
+    }
+    g->func = func == fbuf ? strdup(fbuf) : func;
+    g->fileline = a->fileline;
+    g->bin = bins[a->bin].path;
+    if (!opt.json) {
+        buf_printf(o, "Leak: %.*s (%.*s bytes)\n", (int)l->ptr.n, l->ptr.p, (int)l->size.n, l->size.p);
+        buf_printf(o, "  #01: %s (%s) [binary: %s]\n", func, a->fileline, g->bin);
+    } else {
+        if (*any_json) buf_put(o, ",", 1);
+        *any_json = 1;
+        buf_puts(o, "{\"ptr\":\"");
+        buf_put(o, l->ptr.p, l->ptr.n);
+        buf_printf(o, "\",\"size\":%.*s,\"est_size\":%.0f,\"type\":\"-\",\"frames\":[{\"index\":1,\"function\":\"",
+                   (int)l->size.n, l->size.p, l->est);
+        buf_json(o, func);
+        buf_puts(o, "\",\"file\":\"");
+        buf_json(o, a->fileline);
+        buf_puts(o, "\",\"binary\":\"");
+        buf_json(o, g->bin);
+        buf_puts(o, "\"}]}");
+    }
+}
+
+static void format_chunk(size_t c) {
+    size_t lo = c * CHUNK, hi = lo + CHUNK > nleaks ? nleaks : lo + CHUNK;
+    for (size_t i = lo; i < hi; ++i) {
+        if (has_callers) format_callers_leak(i, &chunks[c].out, &chunks[c].any_json);
+        else format_line_leak(i, &chunks[c].out, &chunks[c].any_json);
+    }
+}
+
+/* ---- summary ---- */
+
+typedef struct {
+    const char *bin, *fileline, *func;
+    long count;
+    double bytes;
+} site_t;
+
+static int site_cmp(const void *x, const void *y) {
+    const site_t *a = x, *b = y;
+    if (a->bytes != b->bytes) return a->bytes > b->bytes ? -1 : 1;
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    int r = strcmp(a->bin, b->bin);
+    if (!r) r = strcmp(a->fileline, b->fileline);
+    if (!r) r = strcmp(a->func, b->func);
+    return r;
+}
+
+static void print_summary(FILE *out) {
+    size_t cap = 1;
+    while (cap < nleaks * 2) cap *= 2;
+    site_t *tab = xcalloc(cap, sizeof(*tab));
+    size_t nsites = 0;
+    for (size_t i = 0; i < nleaks; ++i) {
+        const agg_t *g = &aggs[i];
+        if (!g->func) continue;
+        uint64_t h = hash_bytes(g->bin, strlen(g->bin), 0xcbf29ce484222325ULL);
+        h = hash_bytes(g->fileline, strlen(g->fileline), h);
+        h = hash_bytes(g->func, strlen(g->func), h);
+        size_t j = h & (cap - 1);
+        while (tab[j].bin && (strcmp(tab[j].bin, g->bin) || strcmp(tab[j].fileline, g->fileline) ||
+                              strcmp(tab[j].func, g->func)))
+            j = (j + 1) & (cap - 1);
+        if (!tab[j].bin) {
+            tab[j].bin = g->bin;
+            tab[j].fileline = g->fileline;
+            tab[j].func = g->func;
+            nsites++;
+        }
+        tab[j].count += g->count;
+        /* the script sums integers */
+        tab[j].bytes += floor(g->est + 0.5);
+    }
+    size_t k = 0;
+    for (size_t j = 0; j < cap; ++j)
+        if (tab[j].bin) tab[k++] = tab[j];
+    qsort(tab, k, sizeof(*tab), site_cmp);
+
+    fprintf(out, "\n==== 汇总 (按 binary / file / function) ====\n");
+    if (sample_bytes && has_callers)
+        fprintf(out, "(采样模式：每 %llu 字节采样一次，BYTES 为还原后的估计值)\n",
+                (unsigned long long)sample_bytes);
+    fprintf(out, "%6s %10s %s\n", "COUNT", "BYTES", "BINARY | FILE | FUNCTION");
+    for (size_t j = 0; j < k; ++j)
+        fprintf(out, "%6ld %10.0f %s | %s | %s\n", tab[j].count, tab[j].bytes, tab[j].bin,
+                tab[j].fileline, tab[j].func);
+    (void)nsites;
+    free(tab);
+}
+
+/* Map `path` and append its leaks. The mapping stays for the whole run:
+ * leaks point into it. */
+static int load_report(const char *path) {
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Raw file '%s' not found\n", path);
+        if (fd >= 0) close(fd);
+        return 0;
+    }
+    size_t len = (size_t)st.st_size;
+    const char *map = len ? mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0) : "";
+    close(fd);
+    if (map == MAP_FAILED) {
+        perror("mmap");
+        return 0;
+    }
+    if (len >= sizeof(LEAK_REPORT_MAGIC) - 1 && !memcmp(map, LEAK_REPORT_MAGIC, sizeof(LEAK_REPORT_MAGIC) - 1)) {
+        const leak_report_header_t *h = leak_report_check(map, len);
+        if (!h) {
+            fprintf(stderr, "'%s' is a truncated or unsupported binary report\n", path);
+            return 0;
+        }
+        parse_report_bin(h);
+    } else {
+        parse_report(map, len);
+    }
+    return 1;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [--summary] [--depth N] [--no-dup] [--hide-system] [--hide-system-only]\n"
+            "          [--hide-start] [--show-internal] [--compact-paths] [--frame-range A:B]\n"
+            "          [--json] [--no-raw] [--no-cache] [-j N] [--diff OLD] [leak_analysis.txt]\n",
+            prog);
+}
+
+static int parse_range(const char *s) {
+    char *e;
+    long a = strtol(s, &e, 10);
+    if (e == s) return 0;
+    long b = a;
+    if (*e == ':') b = strtol(e + 1, &e, 10);
+    if (*e) return 0;
+    opt.fr_start = (int)a;
+    opt.fr_end = (int)b;
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    const char *raw = NULL;
+    for (int i = 1; i < argc; ++i) {
+        const char *a = argv[i];
+        const char *val = (i + 1 < argc) ? argv[i + 1] : NULL;
+        if (strcmp(a, "--summary") == 0) opt.summary = 1;
+        else if (strcmp(a, "--compact-paths") == 0) opt.compact_paths = 1;
+        else if (strcmp(a, "--no-dup") == 0) opt.no_dup = 1;
+        else if (strcmp(a, "--show-internal") == 0) opt.show_internal = 1;
+        else if (strcmp(a, "--json") == 0) opt.json = 1;
+        else if (strcmp(a, "--no-raw") == 0) opt.no_raw = 1;
+        else if (strcmp(a, "--hide-system-only") == 0) opt.hide_system_only = 1;
+        else if (strcmp(a, "--hide-system") == 0) opt.hide_system = 1;
+        else if (strcmp(a, "--hide-start") == 0) opt.hide_start = 1;
+        else if (strcmp(a, "--no-cache") == 0) opt.no_cache = 1;
+        else if (strncmp(a, "--depth=", 8) == 0) opt.depth = atoi(a + 8);
+        else if (strcmp(a, "--depth") == 0 && val) opt.depth = atoi(argv[++i]);
+        else if (strncmp(a, "--frame-range=", 14) == 0) parse_range(a + 14);
+        else if (strcmp(a, "--frame-range") == 0 && val) parse_range(argv[++i]);
+        else if (strcmp(a, "-j") == 0 && val) opt.jobs = atoi(argv[++i]);
+        else if (strncmp(a, "--diff=", 7) == 0) opt.diff_base = a + 7;
+        else if (strcmp(a, "--diff") == 0 && val) opt.diff_base = argv[++i];
+        else if (a[0] == '-' && a[1]) {
+            fprintf(stderr, "Unknown option: %s\n", a);
+            usage(argv[0]);
+            return 1;
+        } else if (!raw) raw = a;
+    }
+    if (!raw) raw = "leak_analysis.txt";
+    if (opt.depth < 1) opt.depth = 1;
+    if (opt.jobs < 1) opt.jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (opt.jobs < 1) opt.jobs = 1;
+
+    size_t n_old = 0;
+    if (opt.diff_base) {
+        if (!load_report(opt.diff_base)) return 1;
+        if (!has_callers) {
+            fprintf(stderr, "--diff needs reports from the base detector ('%s' has no callers)\n",
+                    opt.diff_base);
+            return 1;
+        }
+        n_old = nleaks;
+    }
+    if (!load_report(raw)) return 1;
+
+    static char obuf[1 << 16];
+    setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+    if (opt.diff_base) {
+        if (!has_callers) {
+            fprintf(stderr, "--diff needs reports from the base detector ('%s' has no callers)\n", raw);
+            return 1;
+        }
+        if (!opt.json) printf("==== 快照差异: %s -> %s ====\n", opt.diff_base, raw);
+        build_diff(n_old);
+    } else if (!opt.json) {
+        printf("==== 分析文件: %s ====\n", raw);
+    }
+
+    if (two_cols) {
+        for (size_t i = 0; i < nleaks; ++i)
+            printf("Leak: %.*s (%.*s bytes)\n", (int)leaks[i].ptr.n, leaks[i].ptr.p,
+                   (int)leaks[i].size.n, leaks[i].size.p);
+        return 0;
+    }
+
+    run_parallel(probe_binary, nbins);
+    run_parallel(resolve_cached, naddrs);
+    run_parallel(load_binary, nbins);
+    run_parallel(resolve_addr, naddrs);
+    if (!opt.no_cache) update_caches();
+
+    size_t nchunks = (nleaks + CHUNK - 1) / CHUNK;
+    chunks = xcalloc(nchunks, sizeof(*chunks));
+    aggs = xcalloc(nleaks, sizeof(*aggs));
+    run_parallel(format_chunk, nchunks);
+
+    if (opt.json) fputs("[", stdout);
+    int sep = 0;
+    for (size_t c = 0; c < nchunks; ++c) {
+        if (opt.json && sep && chunks[c].any_json) fputs(",", stdout);
+        fwrite(chunks[c].out.p, 1, chunks[c].out.len, stdout);
+        sep |= chunks[c].any_json;
+        free(chunks[c].out.p);
+    }
+    if (opt.json) {
+        fputs("]\n", stdout);
+        return 0;
+    }
+    if (opt.summary) print_summary(stdout);
+    fflush(stdout);
+    return 0;
+}
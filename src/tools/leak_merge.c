@@ -0,0 +1,340 @@
+/* leak_merge.c
+ * Merge the leak reports of many processes, e.g. the master and workers of
+ * a prefork server (each fork() child writes leak_analysis.<pid>.txt),
+ * into one report aggregated by allocation site.
+ *
+ *   leak_merge [-o merged.txt] [--top N] report...
+ *
+ * Every report format is accepted: sites (#sites count bytes est_bytes
+ * min max type callers), one block per line with its stack (#ptr size
+ * type callers, from LEAK_REPORT_ALL=1 or leak_replay), the line
+ * detector's (#ptr size caller binary func) and binary reports
+ * (LEAK_REPORT_FORMAT=bin), told apart by their magic. Frames are offsets
+ * within their binary, so a site has the same key in every process. The inputs
+ * are read in one pass into a single hash table; the output is in the
+ * sites format, largest first, for leak_analyze or analyze_leaks.sh, and
+ * the top sites are listed on stderr with the number of reports each one
+ * appeared in.
+ */
+#include <fcntl.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../detector/leak_report_format.h"
+
+typedef struct {
+    const char *p;
+    size_t n;
+} str_t;
+
+typedef struct {
+    str_t type;
+    str_t callers;
+    uint64_t hash;
+    uint64_t count, bytes, min, max;
+    double est;
+    unsigned reports;       /* reports the site appeared in */
+    unsigned last;          /* index + 1 of the last report that added to it */
+} site_t;
+
+static site_t *sites;
+static size_t nsites, mask;
+
+static void *xmalloc(size_t n) {
+    void *p = malloc(n);
+    if (!p) {
+        perror("malloc");
+        exit(1);
+    }
+    return p;
+}
+
+static uint64_t hash_str(uint64_t h, str_t s) {
+    for (size_t i = 0; i < s.n; ++i) h = (h ^ (uint8_t)s.p[i]) * 0x100000001b3ULL;
+    return h;
+}
+
+static int str_eq(str_t a, str_t b) {
+    return a.n == b.n && memcmp(a.p, b.p, a.n) == 0;
+}
+
+static void grow(void) {
+    size_t n = sites ? (mask + 1) * 2 : 4096;
+    site_t *t = calloc(n, sizeof(*t));
+    if (!t) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; sites && i <= mask; ++i) {
+        if (!sites[i].count) continue;
+        size_t j = sites[i].hash & (n - 1);
+        while (t[j].count) j = (j + 1) & (n - 1);
+        t[j] = sites[i];
+    }
+    free(sites);
+    sites = t;
+    mask = n - 1;
+}
+
+/* Add `count` blocks of one site from report number `report` (from 1). */
+static void add(str_t type, str_t callers, uint64_t count, uint64_t bytes, double est,
+                uint64_t min, uint64_t max, unsigned report) {
+    if (!count) return;
+    if (!sites || (nsites + 1) * 10 > (mask + 1) * 7) grow();
+    uint64_t h = hash_str(hash_str(0xcbf29ce484222325ULL, type), callers);
+    size_t i = h & mask;
+    while (sites[i].count && !(sites[i].hash == h && str_eq(sites[i].type, type) &&
+                               str_eq(sites[i].callers, callers)))
+        i = (i + 1) & mask;
+    site_t *s = &sites[i];
+    if (!s->count) {
+        s->type = type;
+        s->callers = callers;
+        s->hash = h;
+        s->min = min;
+        nsites++;
+    }
+    s->count += count;
+    s->bytes += bytes;
+    s->est += est;
+    if (min < s->min) s->min = min;
+    if (max > s->max) s->max = max;
+    if (s->last != report) {
+        s->last = report;
+        s->reports++;
+    }
+}
+
+static int next_field(const char **p, const char *end, str_t *out) {
+    const char *s = *p;
+    while (s < end && (*s == ' ' || *s == '\t')) s++;
+    const char *e = s;
+    while (e < end && *e != ' ' && *e != '\t') e++;
+    out->p = s;
+    out->n = (size_t)(e - s);
+    *p = e;
+    return out->n > 0;
+}
+
+static uint64_t to_u64(str_t s) {
+    return s.n ? strtoull(s.p, NULL, 10) : 0;
+}
+
+/* what a sampled block of `size` bytes stands for (see leak_sample.h) */
+static double estimate(uint64_t size, uint64_t sample_bytes) {
+    if (!sample_bytes || !size) return (double)size;
+    return (double)size / -expm1(-(double)size / (double)sample_bytes);
+}
+
+static const str_t no_type = { "-", 1 };
+
+/* sample_bytes of the inputs: 0 until the first, UINT64_MAX once they differ */
+static uint64_t merged_sample = 0;
+static int nreports_sampled = 0;
+
+static void merge_report(const char *p, size_t len, unsigned report) {
+    const char *end = p + len;
+    int sites_fmt = 0, callers_fmt = 0, func_fmt = 0;
+    uint64_t sample_bytes = 0;
+    for (int first = 1; p < end; first = 0) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *le = nl ? nl : end;
+        if (le > p && le[-1] == '\r') le--;
+        if (p < le && *p == '#') {
+            if (first) {
+                size_t n = (size_t)(le - p);
+                sites_fmt = n >= 6 && !memcmp(p, "#sites", 6);
+                callers_fmt = memmem(p, n, "callers", 7) != NULL;
+                func_fmt = memmem(p, n, "func", 4) != NULL;
+                const char *sb = memmem(p, n, "sample_bytes=", 13);
+                if (sb) sample_bytes = strtoull(sb + 13, NULL, 10);
+            }
+        } else if (p < le) {
+            const char *q = p;
+            str_t f[5] = { { 0 } };
+            if (sites_fmt) {
+                str_t est, min, max, type, callers;
+                next_field(&q, le, &f[0]);
+                next_field(&q, le, &f[1]);
+                next_field(&q, le, &est);
+                next_field(&q, le, &min);
+                next_field(&q, le, &max);
+                next_field(&q, le, &type);
+                next_field(&q, le, &callers);
+                add(type, callers, to_u64(f[0]), to_u64(f[1]),
+                    est.n ? strtod(est.p, NULL) : 0, to_u64(min), to_u64(max), report);
+            } else {
+                int nf = 0;
+                while (nf < 5 && next_field(&q, le, &f[nf])) nf++;
+                uint64_t size = to_u64(f[1]);
+                double est = estimate(size, sample_bytes);
+                if (callers_fmt && nf >= 4) {
+                    add(f[2], f[3], 1, size, est, size, size, report);
+                } else if (func_fmt && nf >= 4) {
+                    /* one caller: offset and binary become one frame; a
+                     * raw address (no binary) differs between processes */
+                    str_t c;
+                    char *buf = xmalloc(f[2].n + f[3].n + 2);
+                    memcpy(buf, f[2].p, f[2].n);
+                    buf[f[2].n] = '@';
+                    memcpy(buf + f[2].n + 1, f[3].p, f[3].n);
+                    c.p = buf;
+                    c.n = f[2].n + 1 + f[3].n;
+                    add(no_type, c, 1, size, est, size, size, report);
+                } else {
+                    add(no_type, no_type, 1, size, est, size, size, report);
+                }
+            }
+        }
+        p = nl ? nl + 1 : end;
+    }
+    if (!nreports_sampled++) merged_sample = sample_bytes;
+    else if (merged_sample != sample_bytes) merged_sample = UINT64_MAX;
+}
+
+/* A binary report (leak_report_format.h): each stack becomes a callers
+ * string once, shared by every site of the report that has it. */
+static void merge_report_bin(const leak_report_header_t *h, unsigned report) {
+    const leak_report_site_t *rs = (const void *)((const char *)h + h->sites.off);
+    size_t nstacks = h->stacks.n - 1;
+    str_t *callers = calloc(nstacks ? nstacks : 1, sizeof(*callers));
+    if (!callers) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < h->sites.n; ++i) {
+        const leak_report_site_t *s = &rs[i];
+        const char *type = leak_report_type(h, s->type);
+        str_t c = no_type;
+        if (s->stack < nstacks) {
+            if (!callers[s->stack].p) {
+                size_t n = leak_report_callers(h, s->stack, NULL, 0);
+                char *buf = xmalloc(n + 1);
+                leak_report_callers(h, s->stack, buf, n + 1);
+                callers[s->stack] = (str_t){ buf, n };
+            }
+            c = callers[s->stack];
+        }
+        add((str_t){ type, strlen(type) }, c, s->count, s->bytes, (double)s->est, s->min, s->max,
+            report);
+    }
+    free(callers);
+    if (!nreports_sampled++) merged_sample = h->sample_bytes;
+    else if (merged_sample != h->sample_bytes) merged_sample = UINT64_MAX;
+}
+
+static int cmp_site(const void *x, const void *y) {
+    const site_t *a = x, *b = y;
+    if (a->est != b->est) return a->est > b->est ? -1 : 1;
+    if (a->count != b->count) return a->count > b->count ? -1 : 1;
+    size_t n = a->callers.n < b->callers.n ? a->callers.n : b->callers.n;
+    int c = memcmp(a->callers.p, b->callers.p, n);
+    if (c) return c;
+    return a->callers.n < b->callers.n ? -1 : a->callers.n > b->callers.n;
+}
+
+static void usage(const char *argv0) {
+    fprintf(stderr, "usage: %s [-o merged.txt] [--top N] report...\n", argv0);
+}
+
+int main(int argc, char **argv) {
+    const char *outname = NULL;
+    size_t top = 0;
+    char **in = xmalloc((size_t)argc * sizeof(*in));
+    int nin = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outname = argv[++i];
+        } else if (strcmp(argv[i], "--top") == 0 && i + 1 < argc) {
+            top = strtoull(argv[++i], NULL, 10);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            in[nin++] = argv[i];
+        }
+    }
+    if (!nin) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    /* the inputs stay mapped: sites point into them */
+    for (int i = 0; i < nin; ++i) {
+        int fd = open(in[i], O_RDONLY);
+        struct stat st;
+        if (fd < 0 || fstat(fd, &st) != 0) {
+            perror(in[i]);
+            return 1;
+        }
+        if (st.st_size) {
+            const char *base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (base == MAP_FAILED) {
+                perror("mmap");
+                return 1;
+            }
+            size_t len = (size_t)st.st_size;
+            if (len >= sizeof(LEAK_REPORT_MAGIC) - 1 &&
+                !memcmp(base, LEAK_REPORT_MAGIC, sizeof(LEAK_REPORT_MAGIC) - 1)) {
+                const leak_report_header_t *h = leak_report_check(base, len);
+                if (!h) {
+                    fprintf(stderr, "%s: truncated or unsupported binary report\n", in[i]);
+                    return 1;
+                }
+                merge_report_bin(h, (unsigned)i + 1);
+            } else {
+                merge_report(base, len, (unsigned)i + 1);
+            }
+        }
+        close(fd);
+    }
+
+    size_t k = 0;
+    uint64_t blocks = 0, bytes = 0;
+    for (size_t i = 0; sites && i <= mask; ++i) {
+        if (!sites[i].count) continue;
+        blocks += sites[i].count;
+        bytes += sites[i].bytes;
+        sites[k++] = sites[i];
+    }
+    if (k) qsort(sites, k, sizeof(*sites), cmp_site);
+    if (!top || top > k) top = k;
+
+    FILE *f = outname ? fopen(outname, "w") : stdout;
+    if (!f) {
+        perror(outname);
+        return 1;
+    }
+    fprintf(f, "#sites count bytes est_bytes min max type callers");
+    if (merged_sample && merged_sample != UINT64_MAX)
+        fprintf(f, " sample_bytes=%llu", (unsigned long long)merged_sample);
+    fprintf(f, " merged=%d\n", nin);
+    for (size_t i = 0; i < top; ++i) {
+        const site_t *s = &sites[i];
+        fprintf(f, "%llu %llu %.0f %llu %llu %.*s %.*s\n", (unsigned long long)s->count,
+                (unsigned long long)s->bytes, s->est, (unsigned long long)s->min,
+                (unsigned long long)s->max, (int)s->type.n, s->type.p, (int)s->callers.n,
+                s->callers.p);
+    }
+    if (f != stdout && fclose(f) != 0) {
+        perror(outname);
+        return 1;
+    }
+
+    for (size_t i = 0; i < top && i < 10; ++i) {
+        const site_t *s = &sites[i];
+        fprintf(stderr, "Leak site: %llu blocks, %llu bytes in %u of %d reports [%.*s]\n",
+                (unsigned long long)s->count, (unsigned long long)s->bytes, s->reports, nin,
+                (int)s->type.n, s->type.p);
+    }
+    fprintf(stderr, "%llu leaks (%llu bytes) from %zu sites in %d reports",
+            (unsigned long long)blocks, (unsigned long long)bytes, k, nin);
+    if (top < k) fprintf(stderr, ", top %zu written", top);
+    fprintf(stderr, "\n");
+    return 0;
+}
@@ -0,0 +1,326 @@
+/* leak_replay.c
+ * Rebuild the live allocation set from a binary trace written by
+ * libleak_detector_base.so with LEAK_TRACE=path.
+ *
+ *   leak_replay [--at SECONDS] [-o report.txt] trace.bin
+ *
+ * Events are sorted by timestamp and replayed; --at stops the replay that
+ * many seconds after the trace started, which shows what was live at that
+ * point of the run. The result is written in the same format as
+ * leak_analysis.txt, so scripts/analyze_leaks.sh can symbolize it: the
+ * live blocks, then the descriptors still open under a #fd line of their
+ * own, numbered as the program saw them.
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "../detector/leak_types.h"
+#include "../detector/leak_trace_format.h"
+
+typedef struct {
+    uint64_t ts;
+    uint64_t seq;           /* file order, keeps the sort stable */
+    const leak_event_t *ev;
+} ev_ref_t;
+
+typedef struct {
+    uint64_t bias, start, end;
+    const char *path;
+    uint64_t path_len;
+} module_t;
+
+typedef struct {
+    uint32_t depth;
+    const uint64_t *frames;
+} stack_ref_t;
+
+static ev_ref_t *events;
+static size_t nevents, cap_events;
+static module_t *modules;
+static size_t nmodules, cap_modules;
+static stack_ref_t *stacks;
+static size_t cap_stacks;
+
+static void *grow(void *p, size_t *cap, size_t need, size_t elem) {
+    if (need <= *cap) return p;
+    size_t n = *cap ? *cap : 1024;
+    while (n < need) n *= 2;
+    p = realloc(p, n * elem);
+    if (!p) {
+        perror("realloc");
+        exit(1);
+    }
+    memset((char *)p + *cap * elem, 0, (n - *cap) * elem);
+    *cap = n;
+    return p;
+}
+
+static int cmp_ev(const void *x, const void *y) {
+    const ev_ref_t *a = x, *b = y;
+    if (a->ts != b->ts) return a->ts < b->ts ? -1 : 1;
+    return a->seq < b->seq ? -1 : a->seq > b->seq;
+}
+
+/* Walk the records once; a truncated record at the end stops the walk. */
+static void parse(const char *base, size_t len) {
+    size_t off = sizeof(leak_trace_header_t);
+    while (off + sizeof(leak_event_t) <= len) {
+        const leak_event_t *e = (const leak_event_t *)(base + off);
+        size_t next = off + sizeof(*e);
+        if (e->kind == LEAK_EV_ALLOC || e->kind == LEAK_EV_FREE || e->kind == LEAK_EV_FD_OPEN ||
+            e->kind == LEAK_EV_FD_CLOSE) {
+            events = grow(events, &cap_events, nevents + 1, sizeof(*events));
+            events[nevents].ts = e->ts;
+            events[nevents].seq = nevents;
+            events[nevents].ev = e;
+            nevents++;
+        } else if (e->kind == LEAK_EV_STACK) {
+            if (e->b > (len - next) / 8) break;
+            stacks = grow(stacks, &cap_stacks, (size_t)e->stack + 1, sizeof(*stacks));
+            stacks[e->stack].depth = (uint32_t)e->b;
+            stacks[e->stack].frames = (const uint64_t *)(base + next);
+            next += e->b * 8;
+        } else if (e->kind == LEAK_EV_MODULE) {
+            if (e->b > len || 16 + leak_trace_pad8(e->b) > len - next) break;
+            const uint64_t *range = (const uint64_t *)(base + next);
+            modules = grow(modules, &cap_modules, nmodules + 1, sizeof(*modules));
+            modules[nmodules].bias = e->a;
+            modules[nmodules].start = range[0];
+            modules[nmodules].end = range[1];
+            modules[nmodules].path = base + next + 16;
+            modules[nmodules].path_len = e->b;
+            nmodules++;
+            next += 16 + leak_trace_pad8(e->b);
+        } else {
+            fprintf(stderr, "leak_replay: unknown record kind %u at offset %zu\n", e->kind, off);
+            break;
+        }
+        off = next;
+    }
+}
+
+/* The most recent mapping wins if a range was reused after dlclose. */
+static const module_t *find_module(uint64_t pc) {
+    for (size_t i = nmodules; i-- > 0;)
+        if (pc >= modules[i].start && pc < modules[i].end) return &modules[i];
+    return NULL;
+}
+
+/* key -> index into events of the ALLOC or FD_OPEN that is live, open
+ * addressing; keys are addresses or descriptor numbers, so 0 is one too */
+typedef struct {
+    uint64_t key;
+    size_t idx;
+    int used;
+} live_slot_t;
+
+typedef struct {
+    live_slot_t *slots;
+    size_t mask, count;
+} live_t;
+
+static live_t blocks, fds;
+
+static size_t slot_of(const live_t *l, uint64_t key) {
+    uint64_t h = key;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    return (size_t)h & l->mask;
+}
+
+static void live_put(live_t *l, uint64_t key, size_t idx);
+
+static void live_grow(live_t *l) {
+    live_slot_t *old = l->slots;
+    size_t old_cap = old ? l->mask + 1 : 0;
+    size_t cap = old_cap ? old_cap * 2 : 4096;
+    l->slots = calloc(cap, sizeof(*l->slots));
+    if (!l->slots) {
+        perror("calloc");
+        exit(1);
+    }
+    l->mask = cap - 1;
+    l->count = 0;
+    for (size_t i = 0; i < old_cap; ++i)
+        if (old[i].used) live_put(l, old[i].key, old[i].idx);
+    free(old);
+}
+
+static void live_put(live_t *l, uint64_t key, size_t idx) {
+    if (!l->slots || (l->count + 1) * 10 > (l->mask + 1) * 7) live_grow(l);
+    size_t i = slot_of(l, key);
+    while (l->slots[i].used && l->slots[i].key != key) i = (i + 1) & l->mask;
+    if (!l->slots[i].used) l->count++;
+    l->slots[i].key = key;
+    l->slots[i].idx = idx;
+    l->slots[i].used = 1;
+}
+
+static void live_del(live_t *l, uint64_t key) {
+    if (!l->slots) return;
+    size_t i = slot_of(l, key);
+    for (;; i = (i + 1) & l->mask) {
+        if (!l->slots[i].used) return;
+        if (l->slots[i].key == key) break;
+    }
+    /* backward-shift deletion, as in leak_table.h */
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & l->mask;
+        if (!l->slots[j].used) break;
+        size_t home = slot_of(l, l->slots[j].key);
+        if (((j - home) & l->mask) >= ((j - i) & l->mask)) {
+            l->slots[i] = l->slots[j];
+            i = j;
+        }
+    }
+    l->slots[i].used = 0;
+    l->count--;
+}
+
+static int cmp_idx(const void *x, const void *y) {
+    size_t a = *(const size_t *)x, b = *(const size_t *)y;
+    return a < b ? -1 : a > b;
+}
+
+/* the live events of `l`, in the order they happened */
+static size_t *live_order(const live_t *l, size_t *n) {
+    size_t *order = malloc((l->count + 1) * sizeof(*order));
+    if (!order) {
+        perror("malloc");
+        exit(1);
+    }
+    *n = 0;
+    for (size_t i = 0; l->slots && i <= l->mask; ++i)
+        if (l->slots[i].used) order[(*n)++] = l->slots[i].idx;
+    qsort(order, *n, sizeof(*order), cmp_idx);
+    return order;
+}
+
+static void write_callers(FILE *f, const leak_event_t *e) {
+    const stack_ref_t *s = e->stack < cap_stacks ? &stacks[e->stack] : NULL;
+    if (!s || !s->depth) fputs("-", f);
+    for (uint32_t j = 0; s && j < s->depth; ++j) {
+        uint64_t pc = s->frames[j];
+        const module_t *m = find_module(pc);
+        if (j) fputc(',', f);
+        /* relative to the first mapped page, like dladdr's dli_fbase */
+        if (m)
+            fprintf(f, "0x%llx@%.*s", (unsigned long long)(pc - (m->start & ~(uint64_t)0xfff)),
+                    (int)m->path_len, m->path);
+        else
+            fprintf(f, "0x%llx@-", (unsigned long long)pc);
+    }
+    fputc('\n', f);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--at SECONDS] [-o report.txt] trace.bin\n", prog);
+}
+
+int main(int argc, char **argv) {
+    const char *in = NULL, *outname = NULL;
+    double at = -1;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--at") == 0 && i + 1 < argc) {
+            at = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc) {
+            outname = argv[++i];
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            in = argv[i];
+        }
+    }
+    if (!in) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    int fd = open(in, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(in);
+        return 1;
+    }
+    size_t len = (size_t)st.st_size;
+    if (len < sizeof(leak_trace_header_t)) {
+        fprintf(stderr, "%s: not a leak trace\n", in);
+        return 1;
+    }
+    const char *base = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    const leak_trace_header_t *h = (const leak_trace_header_t *)base;
+    if (memcmp(h->magic, LEAK_TRACE_MAGIC, sizeof(h->magic)) != 0 || h->version < 1 ||
+        h->version > LEAK_TRACE_VERSION) {
+        fprintf(stderr, "%s: not a leak trace (or unsupported version)\n", in);
+        return 1;
+    }
+
+    parse(base, len);
+    qsort(events, nevents, sizeof(*events), cmp_ev);
+
+    uint64_t stop = at < 0 ? UINT64_MAX : h->start_ns + (uint64_t)(at * 1e9);
+    for (size_t i = 0; i < nevents && events[i].ts <= stop; ++i) {
+        const leak_event_t *e = events[i].ev;
+        if (e->kind == LEAK_EV_ALLOC)
+            live_put(&blocks, e->a, i);
+        else if (e->kind == LEAK_EV_FREE)
+            live_del(&blocks, e->a);
+        else if (e->kind == LEAK_EV_FD_OPEN)
+            live_put(&fds, e->a, i);
+        else
+            live_del(&fds, e->a);
+    }
+
+    FILE *f = outname ? fopen(outname, "w") : stdout;
+    if (!f) {
+        perror(outname);
+        return 1;
+    }
+
+    /* report in allocation order */
+    size_t n, nfds;
+    size_t *order = live_order(&blocks, &n);
+    uint64_t bytes = 0;
+    fprintf(f, "#ptr size type callers\n");
+    for (size_t k = 0; k < n; ++k) {
+        const leak_event_t *e = events[order[k]].ev;
+        fprintf(f, "0x%llx %llu %s ", (unsigned long long)e->a,
+                (unsigned long long)e->b, leak_type_name(e->type));
+        write_callers(f, e);
+        bytes += e->b;
+    }
+    free(order);
+
+    order = live_order(&fds, &nfds);
+    if (nfds) fprintf(f, "#fd size type callers\n");
+    for (size_t k = 0; k < nfds; ++k) {
+        const leak_event_t *e = events[order[k]].ev;
+        fprintf(f, "%llu 0 %s ", (unsigned long long)e->a, leak_type_name(e->type));
+        write_callers(f, e);
+    }
+    free(order);
+    if (f != stdout) fclose(f);
+
+    fprintf(stderr, "%zu events, %zu live blocks, %llu bytes, %zu open descriptors\n",
+            nevents, n, (unsigned long long)bytes, nfds);
+    free(blocks.slots);
+    free(fds.slots);
+    free(events);
+    free(stacks);
+    free(modules);
+    munmap((void *)base, len);
+    return 0;
+}
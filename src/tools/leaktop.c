@@ -0,0 +1,237 @@
+/* leaktop.c
+ * Watch the heap of a process running under the base detector with
+ * LEAK_METRICS=1, through its live metrics segment (leak_metrics_format.h):
+ * live bytes and blocks, allocation and free rates, table occupancy,
+ * dropped records, totals per allocation kind and the sites that grew
+ * most over the detector's last publishing interval.
+ *
+ *   leaktop [-d seconds] [-n count] [-b] pid
+ *
+ * -d is the refresh interval (default 1), -n stops after that many
+ * screens and -b writes them one after another instead of redrawing, as
+ * it does anyway when stdout is not a terminal. Rates are differences of
+ * the cumulative counters between two screens; the first screen's are
+ * averages since the process started.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "../detector/leak_metrics_format.h"
+
+typedef struct {
+    uint64_t allocs, frees, alloc_bytes, free_bytes;
+    uint64_t type_allocs[LEAK_T_COUNT], type_alloc_bytes[LEAK_T_COUNT];
+    uint64_t type_frees[LEAK_T_COUNT], type_free_bytes[LEAK_T_COUNT];
+} totals_t;
+
+/* the part of the header the detector rewrites, copied out whole */
+typedef struct {
+    uint64_t now_ns, window_ns, sample_bytes, table_records, table_slots;
+    uint32_t threads, ndropped, nsites;
+    leak_metrics_counter_t dropped[LEAK_METRICS_DROPPED];
+    leak_metrics_site_t sites[LEAK_METRICS_TOP];
+} published_t;
+
+static void usage(const char *prog) {
+    fprintf(stderr, "usage: %s [-d seconds] [-n count] [-b] pid\n", prog);
+}
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static const char *fmt_bytes(double b, char *buf, size_t len) {
+    static const char *units[] = { "B", "KB", "MB", "GB", "TB" };
+    unsigned u = 0;
+    double a = b < 0 ? -b : b;
+    while (a >= 1024 && u + 1 < sizeof(units) / sizeof(units[0])) {
+        a /= 1024;
+        b /= 1024;
+        ++u;
+    }
+    snprintf(buf, len, u ? "%.1f %s" : "%.0f %s", b, units[u]);
+    return buf;
+}
+
+static void sum_slots(const leak_metrics_seg_t *seg, unsigned ntypes, totals_t *t) {
+    memset(t, 0, sizeof(*t));
+    for (unsigned i = 0; i < LEAK_METRICS_SLOTS; ++i) {
+        const leak_metrics_slot_t *s = &seg->slots[i];
+        t->allocs += __atomic_load_n(&s->allocs, __ATOMIC_RELAXED);
+        t->frees += __atomic_load_n(&s->frees, __ATOMIC_RELAXED);
+        t->alloc_bytes += __atomic_load_n(&s->alloc_bytes, __ATOMIC_RELAXED);
+        t->free_bytes += __atomic_load_n(&s->free_bytes, __ATOMIC_RELAXED);
+        for (unsigned k = 0; k < ntypes; ++k) {
+            t->type_allocs[k] += __atomic_load_n(&s->type_allocs[k], __ATOMIC_RELAXED);
+            t->type_alloc_bytes[k] += __atomic_load_n(&s->type_alloc_bytes[k], __ATOMIC_RELAXED);
+            t->type_frees[k] += __atomic_load_n(&s->type_frees[k], __ATOMIC_RELAXED);
+            t->type_free_bytes[k] += __atomic_load_n(&s->type_free_bytes[k], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+/* seqlock read: retry while the publisher is mid-update */
+static int read_published(const leak_metrics_seg_t *seg, published_t *p) {
+    for (int tries = 0; tries < 1000; ++tries) {
+        uint64_t seq = __atomic_load_n(&seg->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            usleep(100);
+            continue;
+        }
+        p->now_ns = seg->now_ns;
+        p->window_ns = seg->window_ns;
+        p->sample_bytes = seg->sample_bytes;
+        p->table_records = seg->table_records;
+        p->table_slots = seg->table_slots;
+        p->threads = seg->threads;
+        p->ndropped = seg->ndropped;
+        p->nsites = seg->nsites;
+        memcpy(p->dropped, seg->dropped, sizeof(p->dropped));
+        memcpy(p->sites, seg->sites, sizeof(p->sites));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&seg->seq, __ATOMIC_RELAXED) == seq) {
+            if (p->ndropped > LEAK_METRICS_DROPPED) p->ndropped = LEAK_METRICS_DROPPED;
+            if (p->nsites > LEAK_METRICS_TOP) p->nsites = LEAK_METRICS_TOP;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void show(const leak_metrics_seg_t *seg, unsigned ntypes, const totals_t *cur,
+                 const totals_t *prev, double dt, const published_t *p) {
+    char b1[32], b2[32];
+    double up = (double)(p->now_ns ? p->now_ns - seg->start_ns : 0) / 1e9;
+    printf("leaktop: pid %u, published %.1fs after start, every %.1fs", seg->pid, up,
+           seg->interval_ms / 1e3);
+    if (p->sample_bytes) printf(", sampled 1 per %lu bytes", (unsigned long)p->sample_bytes);
+    printf("\n");
+
+    printf("live: %s in %lu blocks   table: %lu records in %lu slots (%.0f%%)   threads: %u\n",
+           fmt_bytes((double)cur->alloc_bytes - (double)cur->free_bytes, b1, sizeof(b1)),
+           (unsigned long)(cur->allocs - cur->frees), (unsigned long)p->table_records,
+           (unsigned long)p->table_slots,
+           p->table_slots ? 100.0 * p->table_records / p->table_slots : 0.0, p->threads);
+    printf("allocs: %.0f/s (%s/s)   frees: %.0f/s (%s/s)\n", (cur->allocs - prev->allocs) / dt,
+           fmt_bytes((cur->alloc_bytes - prev->alloc_bytes) / dt, b1, sizeof(b1)),
+           (cur->frees - prev->frees) / dt,
+           fmt_bytes((cur->free_bytes - prev->free_bytes) / dt, b2, sizeof(b2)));
+    printf("dropped:");
+    for (uint32_t i = 0; i < p->ndropped; ++i)
+        printf(" %.*s %lu", (int)sizeof(p->dropped[i].name), p->dropped[i].name,
+               (unsigned long)p->dropped[i].value);
+    printf("\n\n");
+
+    printf("%-16s %12s %12s %12s %12s\n", "type", "allocs/s", "frees/s", "live_blocks",
+           "live_bytes");
+    for (unsigned k = 0; k < ntypes; ++k) {
+        if (!cur->type_allocs[k]) continue;
+        printf("%-16s %12.0f %12.0f %12lu %12s\n", leak_type_name(k),
+               (cur->type_allocs[k] - prev->type_allocs[k]) / dt,
+               (cur->type_frees[k] - prev->type_frees[k]) / dt,
+               (unsigned long)(cur->type_allocs[k] - cur->type_frees[k]),
+               fmt_bytes((double)cur->type_alloc_bytes[k] - (double)cur->type_free_bytes[k], b1,
+                         sizeof(b1)));
+    }
+
+    printf("\ngrowing sites:\n%12s %12s %12s  %s\n", "growth/s", "live_bytes", "live_blocks",
+           "callers");
+    double iv = p->window_ns ? p->window_ns / 1e9 : seg->interval_ms / 1e3;
+    for (uint32_t i = 0; i < p->nsites; ++i) {
+        const leak_metrics_site_t *s = &p->sites[i];
+        printf("%12s %12s %12ld  %.*s\n", fmt_bytes(s->growth / iv, b1, sizeof(b1)),
+               fmt_bytes((double)s->bytes, b2, sizeof(b2)), (long)s->blocks,
+               (int)sizeof(s->callers), s->callers);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    double delay = 1;
+    long count = -1;
+    int batch = !isatty(STDOUT_FILENO);
+    int pid = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delay = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            count = atol(argv[++i]);
+        } else if (strcmp(argv[i], "-b") == 0) {
+            batch = 1;
+        } else if (argv[i][0] == '-' || pid) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            pid = atoi(argv[i]);
+        }
+    }
+    if (pid <= 0 || delay <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), LEAK_METRICS_NAME, pid);
+    int fd = shm_open(name, O_RDONLY, 0);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "leaktop: no metrics for pid %d (%s: %s); run it with LEAK_METRICS=1\n",
+                pid, name, strerror(errno));
+        return 1;
+    }
+    if ((size_t)st.st_size < sizeof(leak_metrics_seg_t)) {
+        fprintf(stderr, "leaktop: %s is not a metrics segment\n", name);
+        return 1;
+    }
+    const leak_metrics_seg_t *seg =
+        mmap(NULL, sizeof(leak_metrics_seg_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (seg == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+    if (memcmp(seg->magic, LEAK_METRICS_MAGIC, sizeof(seg->magic)) != 0 ||
+        seg->version != LEAK_METRICS_VERSION) {
+        fprintf(stderr, "leaktop: %s is not a metrics segment (or unsupported version)\n", name);
+        return 1;
+    }
+    unsigned ntypes = seg->ntypes < LEAK_T_COUNT ? seg->ntypes : LEAK_T_COUNT;
+
+    totals_t prev, cur;
+    memset(&prev, 0, sizeof(prev));
+    double t_prev = now_s();
+    /* first screen: averages since the process started */
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    double since = (double)((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec -
+                            seg->start_ns) / 1e9;
+    for (long n = 0; count < 0 || n < count; ++n) {
+        if (n) usleep((useconds_t)(delay * 1e6));
+        if (kill(pid, 0) != 0 && errno == ESRCH) {
+            fprintf(stderr, "leaktop: pid %d has exited\n", pid);
+            break;
+        }
+        published_t p;
+        if (!read_published(seg, &p)) continue;
+        sum_slots(seg, ntypes, &cur);
+        double t = now_s();
+        double dt = n ? t - t_prev : since;
+        if (dt <= 0) dt = 1e-9;
+        if (!batch) printf("\033[H\033[J");
+        else if (n) printf("\n");
+        show(seg, ntypes, &cur, &prev, dt, &p);
+        prev = cur;
+        t_prev = t;
+    }
+    return 0;
+}